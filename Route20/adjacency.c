@@ -48,10 +48,12 @@ typedef struct
 static adjacency_t adjacencies[NC + NBRA + NBEA + 1]; /* Add one so there is room temporarily to store one router above the limit while choosing which one to drop */
 static int routerAdjacencyCount = 0;
 static int endnodeAdjacencyCount = 0;
+static unsigned int routerListGeneration = 0; /* incremented whenever the contents of the Ethernet router list change */
 static void (*stateChangeCallback)(adjacency_t *adjacency);
 
 static void LogAdjacencyType(LogLevel level, AdjacencyType type);
 static void UpdateAdjacencyLiveness(adjacency_t *adjacency);
+static void RouterListChanged(adjacency_t *adjacency);
 static void AdjacencyUp(adjacency_t *adjacency);
 static void SoftAdjacencyUp(adjacency_t *adjacency);
 static void SoftAdjacencyDown(adjacency_t *adjacency);
@@ -80,6 +82,7 @@ void CheckRouterAdjacency(decnet_address_t *from, circuit_t *circuit, AdjacencyT
 {
 	adjacency_t *adjacency = NULL;
 	AdjacencyState newState;
+	int changed = 0;
 
 	Log(LogAdjacency, LogVerbose, "Checking adjacency for "); LogDecnetAddress(LogAdjacency, LogVerbose, from); Log(LogAdjacency, LogVerbose, ", hello=%d, priority=%d\n", helloTimerPeriod, priority);
 
@@ -89,27 +92,39 @@ void CheckRouterAdjacency(decnet_address_t *from, circuit_t *circuit, AdjacencyT
 	{
         Log(LogAdjacency, LogVerbose, "Adding adjacency\n");
         adjacency = AddRouterAdjacency(from, circuit, type, helloTimerPeriod, priority);
+		changed = 1;
 	}
 
 	if (adjacency != NULL)
 	{
 		UpdateAdjacencyLiveness(adjacency);
 		adjacency->helloTimerPeriod = helloTimerPeriod;
-		adjacency->priority = (byte)priority;
+		if (adjacency->priority != (byte)priority)
+		{
+			adjacency->priority = (byte)priority;
+			RouterListChanged(adjacency);
+			changed = 1;
+		}
 
 		newState = GetNewAdjacencyState(routers, routersCount);
 
 		if (adjacency->state == Initialising && newState == Up)
 		{
 			AdjacencyUp(adjacency);
+			changed = 1;
 		}
 		else if (adjacency->state == Up && newState == Initialising)
 		{
 			AdjacencyDown(adjacency);
+			changed = 1;
 		}
-	}
 
-    EthInitCheckDesignatedRouter();
+		/* only changes to the router list can affect the designated router election, so most hellos do not need to re-run it */
+		if (changed)
+		{
+			EthInitRouterAdjacencyChanged(adjacency);
+		}
+	}
 }
 
 void CheckEndnodeAdjacency(decnet_address_t *from, circuit_t *circuit, int helloTimerPeriod)
@@ -199,8 +214,7 @@ void ProcessRouterAdjacencies(int (*process)(adjacency_t *adjacency, void *conte
 
 void PurgeAdjacencies(void)
 {
-	time_t now;
-	time(&now);
+	clock_ms_t now = ClockNow();
 	ProcessAllAdjacencies(PurgeAdjacencyCallback, &now);
 }
 
@@ -239,10 +253,23 @@ int IsBroadcastEndnodeAdjacency(adjacency_t *adjacency)
 	return adjacency->type == EndnodeAdjacency;
 }
 
+unsigned int GetRouterListGeneration(void)
+{
+	return routerListGeneration;
+}
+
 static void UpdateAdjacencyLiveness(adjacency_t *adjacency)
 {
 	Log(LogAdjacency, LogVerbose, "Adjacency liveness update "); LogDecnetAddress(LogAdjacency, LogVerbose, &adjacency->id); Log(LogAdjacency, LogVerbose, " (Slot %d) on %s\n", adjacency->slot, adjacency->circuit->name);
-    time(&adjacency->lastHeardFrom);
+    adjacency->lastHeardFrom = ClockNow();
+}
+
+static void RouterListChanged(adjacency_t *adjacency)
+{
+	if (IsBroadcastRouterAdjacency(adjacency) && IsBroadcastCircuit(adjacency->circuit))
+	{
+		routerListGeneration++;
+	}
 }
 
 static void AdjacencyUp(adjacency_t *adjacency)
@@ -253,7 +280,11 @@ static void AdjacencyUp(adjacency_t *adjacency)
 
 static void SoftAdjacencyUp(adjacency_t *adjacency)
 {
-	adjacency->state = Up;
+	if (adjacency->state != Up)
+	{
+		adjacency->state = Up;
+		RouterListChanged(adjacency);
+	}
 }
 
 void AdjacencyUpComplete(adjacency_t *adjacency)
@@ -264,6 +295,7 @@ void AdjacencyUpComplete(adjacency_t *adjacency)
 void AdjacencyDown(adjacency_t *adjacency)
 {
 	adjacency->state = Initialising;
+	RouterListChanged(adjacency);
 	stateChangeCallback(adjacency);
 }
 
@@ -275,19 +307,30 @@ void AdjacencyDownComplete(adjacency_t *adjacency)
 static void DeleteAdjacency(adjacency_t *adjacency)
 {
 	int slot;
-	if (IsBroadcastRouterAdjacency(adjacency))
+	int wasRouter = IsBroadcastRouterAdjacency(adjacency);
+	circuit_t *circuit = adjacency->circuit;
+	decnet_address_t id;
+
+	if (wasRouter)
 	{
 		routerAdjacencyCount--;
+		RouterListChanged(adjacency);
 	}
 	else if (adjacency->type == EndnodeAdjacency)
 	{
 		endnodeAdjacencyCount--;
 	}
 
+	memcpy(&id, &adjacency->id, sizeof(decnet_address_t));
 	slot = adjacency->slot;
 	memset(adjacency, 0, sizeof(adjacency_t));
 	adjacency->slot = slot;
 	adjacency->type = UnusedAdjacency;
+
+	if (wasRouter)
+	{
+		EthInitRouterAdjacencyRemoved(circuit, &id);
+	}
 }
 
 static adjacency_t *FindFreeAdjacencySlot(int from, int n)
@@ -367,6 +410,7 @@ static adjacency_t *AddRouterAdjacency(decnet_address_t *id, circuit_t *circuit,
 	adjacency->state = Initialising;
 	adjacency->helloTimerPeriod = helloTimerPeriod;
 	adjacency->priority = (byte)priority;
+	RouterListChanged(adjacency);
 
 	if (routerAdjacencyCount > NBRA)
 	{
@@ -515,10 +559,10 @@ static int StopAdjacencyCallback(adjacency_t *adjacency, void *context)
 
 static int PurgeAdjacencyCallback(adjacency_t *adjacency, void *context)
 {
-	time_t now = *((time_t *)context);
+	clock_ms_t now = *((clock_ms_t *)context);
     int mult = IsBroadcastCircuit(adjacency->circuit) ? BCT3MULT : T3MULT;
 
-	if ((now - adjacency->lastHeardFrom) > (mult * adjacency->helloTimerPeriod))
+	if ((now - adjacency->lastHeardFrom) > SECS_TO_MS(mult * adjacency->helloTimerPeriod))
 	{
 	    Log(LogAdjacency, LogInfo, "Adjacency timeout "); LogDecnetAddress(LogAdjacency, LogInfo, &adjacency->id); Log(LogAdjacency, LogInfo, " (Slot %d)\n", adjacency->slot);
         if (IsBroadcastCircuit(adjacency->circuit))
@@ -28,6 +28,7 @@
 
 #include <time.h>
 #include "constants.h"
+#include "clock.h"
 #include "basictypes.h"
 #include "eth_decnet.h"
 #include "circuit.h"
@@ -61,7 +62,7 @@ typedef struct
 	circuit_t       *circuit;
 	AdjacencyType    type;
 	decnet_address_t id;
-	time_t           lastHeardFrom;
+	clock_ms_t       lastHeardFrom;
 	int              helloTimerPeriod;
 	AdjacencyState   state;
 	byte             priority;
@@ -83,6 +84,7 @@ adjacency_t *GetAdjacency(int i);
 void SetAdjacencyStateChangeCallback(void (*callback)(adjacency_t *adjacency));
 int IsBroadcastRouterAdjacency(adjacency_t *adjacency);
 int IsBroadcastEndnodeAdjacency(adjacency_t *adjacency);
+unsigned int GetRouterListGeneration(void);
 
 #define ADJACENCY_H
 #endif
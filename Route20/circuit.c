@@ -34,6 +34,7 @@
 #include "circuit.h"
 #include "eth_circuit.h"
 #include "ddcmp_circuit.h"
+#include "messages.h"
 
 int numCircuits = 0;
 int numEthPcapCircuits = 0;
@@ -42,6 +43,11 @@ int numDdcmpCircuits = 0;
 
 static void (*stateChangeCallback)(circuit_t *circuit);
 static int FirstLevel1Node(void);
+static void InitialiseCircuitEgress(circuit_ptr circuit);
+static int CircuitWritePacket(circuit_ptr circuit, decnet_address_t *from, decnet_address_t *to, packet_t *packet, int isHello);
+static void DrainEgressQueue(circuit_ptr circuit);
+static void HandleEgressTimer(rtimer_t *timer, char *name, void *context);
+static void StartEgressTimer(circuit_ptr circuit);
 
 // TODO: abstract properly by putting common functions for read/write etc which do logging, stats etc, then delegate to actual circuit/line implementations.
 
@@ -82,6 +88,12 @@ void CircuitDown(circuit_t *circuit)
 void CircuitDownComplete(circuit_t *circuit)
 {
 	circuit->Down(circuit);
+	if (circuit->egress.drainTimer != NULL)
+	{
+		StopTimer(circuit->egress.drainTimer);
+		circuit->egress.drainTimer = NULL;
+	}
+	FlushEgressQueue(&circuit->egress);
 	Log(LogCircuit, LogInfo, "Circuit %s down\n", circuit->name);
 }
 
@@ -98,11 +110,11 @@ void CircuitReject(circuit_t *circuit)
 	}
 }
 
-void CircuitCreateEthernetPcap(circuit_ptr circuit, char *name, int cost, void (*waitEventHandler)(void *context))
+void CircuitCreateEthernetPcap(circuit_ptr circuit, char *name, struct eth_pcap_options *options, int cost, void (*waitEventHandler)(void *context))
 {
     circuit->name = (char *)malloc(strlen(name)+1);
 	strcpy(circuit->name, name);
-	circuit->context = (void *)EthCircuitCreatePcap(circuit);
+	circuit->context = (void *)EthCircuitCreatePcap(circuit, options);
 	circuit->circuitType = EthernetCircuit;
 	circuit->state = CircuitStateOff;
 	circuit->cost = cost;
@@ -112,14 +124,88 @@ void CircuitCreateEthernetPcap(circuit_ptr circuit, char *name, int cost, void (
 	circuit->Up = EthCircuitUp;
 	circuit->Down = EthCircuitDown;
 	circuit->ReadPacket = EthCircuitReadPacket;
-	circuit->WritePacket = EthCircuitWritePacket;
+	circuit->WritePacket = CircuitWritePacket;
+	circuit->TransmitPacket = EthCircuitWritePacket;
 	circuit->Stop = EthCircuitStop;
 	circuit->Reject = NULL;
 	circuit->WaitEventHandler = waitEventHandler;
+	InitialiseCircuitEgress(circuit);
 
     numEthPcapCircuits++;
 }
 
+#if defined(USE_PACKET_RING)
+void CircuitCreateEthernetPacket(circuit_ptr circuit, char *name, int cost, void (*waitEventHandler)(void *context))
+{
+    circuit->name = (char *)malloc(strlen(name)+1);
+	strcpy(circuit->name, name);
+	circuit->context = (void *)EthCircuitCreatePacket(circuit);
+	circuit->circuitType = EthernetCircuit;
+	circuit->state = CircuitStateOff;
+	circuit->cost = cost;
+	circuit->startLevel1Node = FirstLevel1Node();
+
+	circuit->Start = EthCircuitStart;
+	circuit->Up = EthCircuitUp;
+	circuit->Down = EthCircuitDown;
+	circuit->ReadPacket = EthCircuitReadPacket;
+	circuit->WritePacket = CircuitWritePacket;
+	circuit->TransmitPacket = EthCircuitWritePacket;
+	circuit->Stop = EthCircuitStop;
+	circuit->Reject = NULL;
+	circuit->WaitEventHandler = waitEventHandler;
+	InitialiseCircuitEgress(circuit);
+}
+#endif
+
+#if defined(USE_XDP)
+void CircuitCreateEthernetXdp(circuit_ptr circuit, char *name, int queueId, int cost, void (*waitEventHandler)(void *context))
+{
+    circuit->name = (char *)malloc(strlen(name)+1);
+	strcpy(circuit->name, name);
+	circuit->context = (void *)EthCircuitCreateXdp(circuit, queueId);
+	circuit->circuitType = EthernetCircuit;
+	circuit->state = CircuitStateOff;
+	circuit->cost = cost;
+	circuit->startLevel1Node = FirstLevel1Node();
+
+	circuit->Start = EthCircuitStart;
+	circuit->Up = EthCircuitUp;
+	circuit->Down = EthCircuitDown;
+	circuit->ReadPacket = EthCircuitReadPacket;
+	circuit->WritePacket = CircuitWritePacket;
+	circuit->TransmitPacket = EthCircuitWritePacket;
+	circuit->Stop = EthCircuitStop;
+	circuit->Reject = NULL;
+	circuit->WaitEventHandler = waitEventHandler;
+	InitialiseCircuitEgress(circuit);
+}
+#endif
+
+#if defined(USE_TAP)
+void CircuitCreateEthernetTap(circuit_ptr circuit, char *name, int queueCount, int cost, void (*waitEventHandler)(void *context))
+{
+    circuit->name = (char *)malloc(strlen(name)+1);
+	strcpy(circuit->name, name);
+	circuit->context = (void *)EthCircuitCreateTap(circuit, queueCount);
+	circuit->circuitType = EthernetCircuit;
+	circuit->state = CircuitStateOff;
+	circuit->cost = cost;
+	circuit->startLevel1Node = FirstLevel1Node();
+
+	circuit->Start = EthCircuitStart;
+	circuit->Up = EthCircuitUp;
+	circuit->Down = EthCircuitDown;
+	circuit->ReadPacket = EthCircuitReadPacket;
+	circuit->WritePacket = CircuitWritePacket;
+	circuit->TransmitPacket = EthCircuitWritePacket;
+	circuit->Stop = EthCircuitStop;
+	circuit->Reject = NULL;
+	circuit->WaitEventHandler = waitEventHandler;
+	InitialiseCircuitEgress(circuit);
+}
+#endif
+
 void CircuitCreateEthernetSocket(circuit_ptr circuit, char *name, uint16 receivePort, uint16 destinationPort, int cost, void (*waitEventHandler)(void *context))
 {
 	circuit->name = (char *)malloc(strlen(name)+1);
@@ -134,19 +220,21 @@ void CircuitCreateEthernetSocket(circuit_ptr circuit, char *name, uint16 receive
 	circuit->Up = EthCircuitUp;
 	circuit->Down = EthCircuitDown;
 	circuit->ReadPacket = EthCircuitReadPacket;
-	circuit->WritePacket = EthCircuitWritePacket;
+	circuit->WritePacket = CircuitWritePacket;
+	circuit->TransmitPacket = EthCircuitWritePacket;
 	circuit->Stop = EthCircuitStop;
 	circuit->Reject = NULL;
 	circuit->WaitEventHandler = waitEventHandler;
+	InitialiseCircuitEgress(circuit);
 
     numEthSockCircuits++;
 }
 
-void CircuitCreateDdcmpSocket(circuit_ptr circuit, char *name, uint16 port, int cost, int connectPoll, void (*waitEventHandler)(void *context))
+void CircuitCreateDdcmpSocket(circuit_ptr circuit, char *name, uint16 port, int cost, int connectPoll, struct ddcmp_options *options, void (*waitEventHandler)(void *context))
 {
 	circuit->name = (char *)malloc(strlen(name)+1);
 	strcpy(circuit->name, name);
-	circuit->context = (void *)DdcmpCircuitCreateSocket(circuit, name, port, connectPoll);
+	circuit->context = (void *)DdcmpCircuitCreateSocket(circuit, name, port, connectPoll, options);
 	circuit->circuitType = DDCMPCircuit;
 	circuit->state = CircuitStateOff;
 	circuit->cost = cost;
@@ -156,14 +244,25 @@ void CircuitCreateDdcmpSocket(circuit_ptr circuit, char *name, uint16 port, int
 	circuit->Up = DdcmpCircuitUp;
 	circuit->Down = DdcmpCircuitDown;
 	circuit->ReadPacket = DdcmpCircuitReadPacket;
-	circuit->WritePacket = DdcmpCircuitWritePacket;
+	circuit->WritePacket = CircuitWritePacket;
+	circuit->TransmitPacket = DdcmpCircuitWritePacket;
 	circuit->Stop = DdcmpCircuitStop;
 	circuit->Reject = DdcmpCircuitReject;
 	circuit->WaitEventHandler = waitEventHandler;
+	InitialiseCircuitEgress(circuit);
 
     numDdcmpCircuits++;
 }
 
+void CircuitConfigureEgress(circuit_ptr circuit, int queueLimit, long rateLimit, long burstSize)
+{
+	InitialiseEgressQueue(&circuit->egress, queueLimit, rateLimit, burstSize);
+	if (rateLimit > 0)
+	{
+		Log(LogCircuit, LogInfo, "Circuit %s limited to %ld bytes per second, burst %ld bytes, queue limit %d\n", circuit->name, rateLimit, circuit->egress.burstSize, queueLimit);
+	}
+}
+
 line_t *GetLineFromCircuit(circuit_t *circuit)
 {
     return circuit->line;
@@ -189,5 +288,82 @@ static int FirstLevel1Node(void)
 	return ans;
 }
 
+static void InitialiseCircuitEgress(circuit_ptr circuit)
+{
+	InitialiseEgressQueue(&circuit->egress, EGRESS_QUEUE_LIMIT, 0, 0);
+}
+
+static int CircuitWritePacket(circuit_ptr circuit, decnet_address_t *from, decnet_address_t *to, packet_t *packet, int isHello)
+{
+	int ans = 0;
+	egress_queue_t *egress = &circuit->egress;
+	EgressClass class = IsDataMessage(packet) ? EgressClassData : EgressClassControl;
+
+	if (CanSendWithoutQueueing(egress, class) && EgressQueueHasTokens(egress))
+	{
+		EgressQueueChargeTokens(egress, packet->payloadLen);
+		ans = circuit->TransmitPacket(circuit, from, to, packet, isHello);
+	}
+	else if (IsEgressQueueFull(egress, class))
+	{
+		/* failing the write lets the forwarding process return the packet to the sender if it asked for that */
+		Log(LogCircuit, LogWarning, "Egress queue full on circuit %s, packet discarded\n", circuit->name);
+		circuit->stats.packetsDiscardedCongestion++;
+	}
+	else
+	{
+		EnqueueToEgressQueue(egress, class, from, to, packet->payload, packet->payloadLen, isHello);
+		circuit->stats.packetsQueued++;
+		StartEgressTimer(circuit);
+		ans = 1;
+	}
+
+	return ans;
+}
+
+static void DrainEgressQueue(circuit_ptr circuit)
+{
+	egress_queue_t *egress = &circuit->egress;
+
+	while (!IsEgressQueueEmpty(egress) && EgressQueueHasTokens(egress))
+	{
+		packet_t packet;
+		egress_queue_entry_t *entry = DequeueFromEgressQueue(egress);
+
+		memset(&packet, 0, sizeof(packet_t));
+		packet.rawData = entry->data;
+		packet.rawLen = entry->dataLength;
+		packet.payload = entry->data;
+		packet.payloadLen = entry->dataLength;
+
+		EgressQueueChargeTokens(egress, entry->dataLength);
+		if (!circuit->TransmitPacket(circuit, entry->hasFrom ? &entry->from : NULL, entry->hasTo ? &entry->to : NULL, &packet, entry->isHello))
+		{
+			Log(LogCircuit, LogWarning, "Failed to send queued packet on circuit %s\n", circuit->name);
+		}
+
+		FreeEgressQueueEntry(entry);
+	}
+
+	if (!IsEgressQueueEmpty(egress))
+	{
+		StartEgressTimer(circuit);
+	}
+}
 
+static void HandleEgressTimer(rtimer_t *timer, char *name, void *context)
+{
+	circuit_ptr circuit = (circuit_ptr)context;
+	circuit->egress.drainTimer = NULL;
+	DrainEgressQueue(circuit);
+}
 
+static void StartEgressTimer(circuit_ptr circuit)
+{
+	/* wake up when enough tokens have accumulated to send the next packet */
+	if (circuit->egress.drainTimer == NULL)
+	{
+		clock_ms_t delay = EgressQueueTimeUntilTokens(&circuit->egress);
+		circuit->egress.drainTimer = CreateTimer("EgressQueue", ClockNow() + ((delay > 0) ? delay : 1), 0, circuit, HandleEgressTimer);
+	}
+}
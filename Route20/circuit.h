@@ -30,6 +30,7 @@
 #include "decnet.h"
 #include "timer.h"
 #include "line.h"
+#include "egress_queue.h"
 
 extern int numCircuits;
 extern int numEthPcapCircuits;
@@ -39,6 +40,8 @@ extern int numDdcmpCircuits;
 #if !defined(CIRCUIT_H)
 
 typedef struct circuit *circuit_ptr;
+struct eth_pcap_options;
+struct ddcmp_options;
 
 typedef enum
 {
@@ -61,6 +64,8 @@ typedef struct circuit_stats
 	long          packetsSent;
 	long          loopbackPacketsReceived;
 	long          nonDecnetPacketsReceived;
+	long          packetsQueued;
+	long          packetsDiscardedCongestion;
 } circuit_stats_t;
 
 typedef struct circuit
@@ -78,12 +83,14 @@ typedef struct circuit
 	int                cost;
 	int                startLevel1Node; /* used to stagger the starting point for Level 1 updates to satisfy the requirements of section 4.8.1 to mitigate packet loss */
 	circuit_stats_t    stats;
+	egress_queue_t     egress;
 
 	int (*Start)(circuit_ptr circuit);
 	void (*Up)(circuit_ptr circuit);
 	void (*Down)(circuit_ptr circuit);
 	packet_t *(*ReadPacket)(circuit_ptr circuit);
 	int (*WritePacket)(circuit_ptr circuit, decnet_address_t *from, decnet_address_t *to, packet_t *, int isHello);
+	int (*TransmitPacket)(circuit_ptr circuit, decnet_address_t *from, decnet_address_t *to, packet_t *, int isHello); /* circuit type specific write, called by WritePacket once the egress queue allows */
 	void (*Stop)(circuit_ptr circuit);
 	void (*Reject)(circuit_ptr circuit);
 	void (*WaitEventHandler)(void *context);
@@ -95,9 +102,13 @@ void CircuitUpComplete(circuit_t *circuit);
 void CircuitDown(circuit_t *circuit);
 void CircuitDownComplete(circuit_t *circuit);
 void CircuitReject(circuit_t *circuit);
-void CircuitCreateEthernetPcap(circuit_ptr circuit, char *name, int cost, void (*waitEventHandler)(void *context));
+void CircuitCreateEthernetPcap(circuit_ptr circuit, char *name, struct eth_pcap_options *options, int cost, void (*waitEventHandler)(void *context));
+void CircuitCreateEthernetPacket(circuit_ptr circuit, char *name, int cost, void (*waitEventHandler)(void *context));
+void CircuitCreateEthernetXdp(circuit_ptr circuit, char *name, int queueId, int cost, void (*waitEventHandler)(void *context));
+void CircuitCreateEthernetTap(circuit_ptr circuit, char *name, int queueCount, int cost, void (*waitEventHandler)(void *context));
 void CircuitCreateEthernetSocket(circuit_ptr circuit, char *name, uint16 receivePort, uint16 destinationPort, int cost, void (*waitEventHandler)(void *context));
-void CircuitCreateDdcmpSocket(circuit_ptr circuit, char *name, uint16 port, int cost, int connectPoll, void (*waitEventHandler)(void *context));
+void CircuitCreateDdcmpSocket(circuit_ptr circuit, char *name, uint16 port, int cost, int connectPoll, struct ddcmp_options *options, void (*waitEventHandler)(void *context));
+void CircuitConfigureEgress(circuit_ptr circuit, int queueLimit, long rateLimit, long burstSize);
 line_t *GetLineFromCircuit(circuit_t *circuit);
 int  IsBroadcastCircuit(circuit_ptr circuit);
 circuit_t *GetCircuitFromLine(line_t *line);
@@ -0,0 +1,94 @@
+/* clock.c: Monotonic millisecond clock
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "clock.h"
+
+/* The clock counts milliseconds from an arbitrary starting point and is not affected by changes to the system time.
+   Reading it is comparatively expensive, so the event loop calls ClockUpdate once each time it wakes and everything
+   processed in that pass uses the same cached value from ClockNow. */
+
+static clock_ms_t ReadClock(void);
+
+static clock_ms_t cachedNow;
+static int        cacheValid = 0;
+
+void ClockUpdate(void)
+{
+	cachedNow = ReadClock();
+	cacheValid = 1;
+}
+
+clock_ms_t ClockNow(void)
+{
+	clock_ms_t ans = cachedNow;
+
+	if (!cacheValid)
+	{
+		/* still initialising, before the event loop has started */
+		ans = ReadClock();
+	}
+
+	return ans;
+}
+
+#if defined(WIN32)
+static clock_ms_t ReadClock(void)
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	QueryPerformanceCounter(&counter);
+	return (clock_ms_t)(counter.QuadPart / (frequency.QuadPart / 1000));
+}
+#elif defined(__VAX)
+static clock_ms_t ReadClock(void)
+{
+	/* VAXELN has no monotonic clock, fall back to the system time */
+	time_t now;
+	time(&now);
+	return SECS_TO_MS(now);
+}
+#else
+static clock_ms_t ReadClock(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SECS_TO_MS(now.tv_sec) + now.tv_nsec / 1000000;
+}
+#endif
@@ -57,5 +57,8 @@
 
 #define NSP_SEGMENT_SIZE 1459
 
+#define RECEIVE_BUDGET 16 /* default number of packets read from a circuit before moving on to the next circuit with work to do */
+#define EGRESS_QUEUE_LIMIT 64 /* default number of packets each egress class may hold before the circuit is treated as congested */
+
 #define CONSTANTS_H
 #endif
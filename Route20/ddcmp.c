@@ -36,12 +36,6 @@ in this Software without prior written authorization from the author.
 
 #define MAX_STATE_TABLE_ACTIONS 6
 
-/* The transmit queue length needs to be fairly high because once a circuit signals
-   that it has data, all data from it is read and processed. This can fill the DDCMP
-   transmit queue before all the processing is complete. This leads to slow
-   transfers, and overrun errors in file copies. */
-#define MAX_TRANSMIT_QUEUE_LEN 20
-
 #define ENQ 5u
 #define SOH 129u
 #define DLE 144u
@@ -52,6 +46,8 @@ in this Software without prior written authorization from the author.
 #define CONTROL_STRT  0x06
 #define CONTROL_STACK 0x07
 
+#define CONTROL_MESSAGE_LENGTH 6 /* not counting the CRC */
+
 #define NAKHeaderBlockCheckError         1
 #define NAKDataFieldBlockCheckError      2
 #define NAKRepResponse                   3
@@ -121,19 +117,27 @@ typedef struct transmit_queue_entry
 	int                          slotNumber;
 	buffer_t                     buffer;
 	int                          slotInUse;
-	byte                         header[8];
-	byte                         data[MAX_DDCMP_DATA_LENGTH];
+	byte                        *frame; /* header, data and block check, allocated when first used */
+	int                          frameSize;
 } transmit_queue_entry_t;
 
 typedef struct
 {
-	transmit_queue_entry_t transmitQueue[MAX_TRANSMIT_QUEUE_LEN];
+	transmit_queue_entry_t *transmitQueue;
+	int                     transmitQueueLength; /* one entry per message in the transmit window */
 	transmit_queue_entry_t *firstUnacknowledgedTransmitQueueEntry; /* transmit queue entry for the first transmit unacknowledged queue entry that needs to be transmitted */
 	transmit_queue_entry_t *lastAllocatedTransmitQueueEntry; /* last transmit queue entry that was allocated */
 } transmit_queue_ctrl_t;
 
 #pragma pack(pop)
 
+typedef struct send_backlog_entry
+{
+	struct send_backlog_entry *next;
+	byte                      *data;
+	int                        length;
+} send_backlog_entry_t;
+
 #pragma warning( disable : 4820 )
 typedef struct
 {
@@ -148,10 +152,27 @@ typedef struct
 	byte NAKReason;
 	buffer_t *currentMessage;
 	void *replyTimerHandle;
-	byte partialBufferData[MAX_DDCMP_BUFFER_LENGTH];
-	buffer_t partialBuffer;
-	int partialBufferIsSynchronized;
+	void *ackTimerHandle;
+	byte lastAckSent; /* value of R last sent in an ACK, NAK or data message */
+	clock_ms_t sendTime[256]; /* when each data message number was first sent */
+	byte sendCount[256]; /* how many times each data message number has been sent, only messages sent once give a round trip sample */
+	int rttMeasured;
+	int smoothedRtt; /* milliseconds */
+	int rttVariation; /* milliseconds */
+	int replyTimeout; /* current reply timer, in milliseconds */
+	int blockSize; /* data length that buffers are sized for */
+	byte *receiveRing; /* allocated when the line starts and freed when it halts, like the transmit frames */
+	int receiveRingSize;
+	int receiveRingStart;
+	int receiveRingCount;
+	int receiveIsSynchronized;
+	byte *receiveFrame; /* for messages that wrap around the end of the receive ring, same size as the ring */
+	int receiveProcessing; /* received data is being framed, so buffers must not be freed yet */
+	int releasePending;
 	transmit_queue_ctrl_t transmitQueueCtrl;
+	send_backlog_entry_t *sendBacklogHead;
+	send_backlog_entry_t *sendBacklogTail;
+	int sendBacklogDepth;
 } ddcmp_line_control_block_t;
 
 typedef struct
@@ -166,41 +187,54 @@ typedef struct
 
 static void InitialiseBuffer(buffer_t *buffer, byte *data, int length, int maxLength);
 static void ResetBuffer(buffer_t *buffer);
-static int BufferFromSegment(buffer_t *buffer, int length, buffer_t *newBuffer);
-static int ExtendBuffer(buffer_t *originalBuffer, buffer_t *buffer, int length);
 static byte CurrentByte(buffer_t *buffer);
 static void MoveToNextByte(buffer_t *buffer);
 static byte ByteAt(buffer_t *buffer, int position);
-static void AdvanceBufferPostion(buffer_t *buffer, int count);
-static int BufferStillHasData(buffer_t *buffer);
 static int RemainingBytesInBuffer(buffer_t *buffer);
 static int CurrentBufferPosition(buffer_t *buffer);
 static void SetBufferPosition(buffer_t *buffer, int position);
-static int AppendBuffer(buffer_t *dst, buffer_t *src);
-static void TruncateUsedBufferPortion(buffer_t *buffer);
+static int AppendToReceiveRing(ddcmp_line_control_block_t *cb, byte *data, int length);
+static byte ReceiveRingByteAt(ddcmp_line_control_block_t *cb, int offset);
+static byte *GetReceiveRingFrame(ddcmp_line_control_block_t *cb, int length);
+static void ConsumeReceiveRing(ddcmp_line_control_block_t *cb, int length);
 static void LogBuffer(ddcmp_line_t *line, LogLevel level, buffer_t *buffer);
 static void LogFullBuffer(ddcmp_line_t *line, LogLevel level, buffer_t *buffer);
 
-static void InitialiseTransmitQueue(transmit_queue_ctrl_t *transmitQueueCtrl);
+static void InitialiseTransmitQueue(transmit_queue_ctrl_t *transmitQueueCtrl, int length);
+static void FreeTransmitQueue(transmit_queue_ctrl_t *transmitQueueCtrl);
 static transmit_queue_entry_t *AllocateNextTransmitQueueEntry(transmit_queue_ctrl_t *transmitQueueCtrl);
 static transmit_queue_entry_t *GetTransmitQueueEntry(transmit_queue_ctrl_t *transmitQueueCtrl, int n);
 static transmit_queue_entry_t *GetFirstUnacknowledgedTransmitQueueEntry(transmit_queue_ctrl_t *transmitQueueCtrl);
 static void FreeTransmitQueueEntry(transmit_queue_ctrl_t *transmitQueueCtrl);
 
+static int TransmitDataMessage(ddcmp_line_t *ddcmpLine, byte *data, int length);
+static void AddToSendBacklog(ddcmp_line_control_block_t *cb, byte *data, int length);
+static void DrainSendBacklog(ddcmp_line_t *ddcmpLine);
+static void FlushSendBacklog(ddcmp_line_t *ddcmpLine);
+
 static ddcmp_line_control_block_t *GetControlBlock(ddcmp_line_t *ddcmpLine);
-static int Mod256Cmp(byte a, byte b);
-static uint16 Crc16(uint16 crc, buffer_t *buffer);
+static int Mod256Cmp(byte base, byte a, byte b);
+static int TransmitOffset(ddcmp_line_control_block_t *cb);
+static void InitialiseCrc16Tables(void);
 static void AddCrc16ToBuffer(byte *data, int length);
 static void DoIdle(ddcmp_line_t *ddcmpLine);
 static void DoIdleRetransmit(ddcmp_line_t *ddcmpLine);
-static int SynchronizeMessageFrame(ddcmp_line_t *ddcmpLine, buffer_t *buffer);
-static ExtractBufferResult ExtractMessage(ddcmp_line_t *ddcmpLine, buffer_t *buffer);
+static void FrameReceivedMessages(ddcmp_line_t *ddcmpLine);
+static int SynchronizeMessageFrame(ddcmp_line_t *ddcmpLine);
+static void ResizeReceiveRing(ddcmp_line_control_block_t *cb, int size);
+static void ReleaseLineBuffers(ddcmp_line_t *ddcmpLine);
+static ExtractBufferResult ExtractMessage(ddcmp_line_t *ddcmpLine);
 static int SendMessageAddingCrc16(ddcmp_line_t *ddcmpLine, byte *data, int length);
 static int SendRawMessage(ddcmp_line_t *ddcmpLine, byte *data, int length);
 static void ReplyTimerHandler(void *timerContext);
-static void StartTimer(ddcmp_line_t *ddcmpLine, int seconds);
+static void StartTimer(ddcmp_line_t *ddcmpLine, int milliseconds);
+static void UpdateReplyTimeout(ddcmp_line_t *ddcmpLine, int rtt);
+static void BackOffReplyTimeout(ddcmp_line_t *ddcmpLine);
 static void StopTimer(ddcmp_line_t *ddcmpLine);
 static int IsTimerRunning(ddcmp_line_t *ddcmpLine);
+static void AckTimerHandler(void *timerContext);
+static void StartAckTimer(ddcmp_line_t *ddcmpLine);
+static void StopAckTimer(ddcmp_line_t *ddcmpLine);
 static void ProcessEvent(ddcmp_line_t *ddcmpLine, DdcmpEvent evt);
 static void ProcessControlMessage(ddcmp_line_t *ddcmpLine);
 static void ProcessDataMessage(ddcmp_line_t *ddcmpLine);
@@ -247,7 +281,6 @@ static int CheckAckWaitTimerAction(ddcmp_line_t *ddcmpLine);
 static int SetSrepAction(ddcmp_line_t *ddcmpLine);
 static int CompleteMessageAction(ddcmp_line_t *ddcmpLine);
 
-static int messageReadyToRead;
 
 static byte station = 1;
 
@@ -320,15 +353,50 @@ static state_table_entry_t stateTable[] =
 	{ Undefined,                          DdcmpLineAny,      DdcmpLineAny,      NULL }
 };
 
-/* crc16 polynomial x^16 + x^15 + x^2 + 1 (0xA001) CCITT LSB */
-static uint16 crc16_nibble[16] = {
-	0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
-	0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400,
-};
+/* crc16 polynomial x^16 + x^15 + x^2 + 1 (0xA001) CCITT LSB.
+   The tables are for slicing-by-8: crc16Table[0] is the usual byte-at-a-time table and
+   crc16Table[k] gives the effect of a byte followed by k zero bytes, so 8 bytes can be
+   folded into the CRC with independent table lookups. */
+#define CRC16_POLYNOMIAL 0xA001
+static uint16 crc16Table[8][256];
+static int crc16TablesInitialised = 0;
+
+void DdcmpInitialiseOptions(ddcmp_options_t *options)
+{
+	options->windowSize = DDCMP_DEFAULT_WINDOW;
+	options->backlogLimit = DDCMP_DEFAULT_BACKLOG;
+	options->ackDelay = 0;
+	options->replyTimerMin = DDCMP_DEFAULT_REPLY_TIMER_MIN;
+	options->replyTimerMax = DDCMP_DEFAULT_REPLY_TIMER_MAX;
+	options->tcpPolicy = DdcmpTcpNoDelay;
+	options->udpPort = 0;
+}
 
 void DdcmpStart(ddcmp_line_t *ddcmpLine)
 {
 	ddcmp_line_control_block_t *cb;
+	ddcmp_line_control_block_t saved;
+
+	if (ddcmpLine->options.windowSize < 1 || ddcmpLine->options.windowSize > DDCMP_MAX_WINDOW)
+	{
+		ddcmpLine->options.windowSize = DDCMP_DEFAULT_WINDOW;
+	}
+
+	if (ddcmpLine->options.replyTimerMin < 1)
+	{
+		ddcmpLine->options.replyTimerMin = DDCMP_DEFAULT_REPLY_TIMER_MIN;
+	}
+
+	if (ddcmpLine->options.replyTimerMax < 1)
+	{
+		ddcmpLine->options.replyTimerMax = DDCMP_DEFAULT_REPLY_TIMER_MAX;
+	}
+
+	if (ddcmpLine->options.replyTimerMax < ddcmpLine->options.replyTimerMin)
+	{
+		ddcmpLine->options.replyTimerMax = ddcmpLine->options.replyTimerMin;
+	}
+
 	if (ddcmpLine->controlBlock == NULL)
 	{
 		ddcmpLine->controlBlock = (ddcmp_line_control_block_t *)calloc(1, sizeof(ddcmp_line_control_block_t));
@@ -336,116 +404,112 @@ void DdcmpStart(ddcmp_line_t *ddcmpLine)
 	else
 	{
         StopTimer(ddcmpLine); /* in case timer was running from last attempt at starting the line */
+		StopAckTimer(ddcmpLine);
+		FlushSendBacklog(ddcmpLine);
+		saved = *GetControlBlock(ddcmpLine); /* keep any buffers across a restart */
 		memset(ddcmpLine->controlBlock, 0, sizeof(ddcmp_line_control_block_t));
+		GetControlBlock(ddcmpLine)->transmitQueueCtrl = saved.transmitQueueCtrl;
+		GetControlBlock(ddcmpLine)->receiveRing = saved.receiveRing;
+		GetControlBlock(ddcmpLine)->receiveFrame = saved.receiveFrame;
+		GetControlBlock(ddcmpLine)->receiveRingSize = saved.receiveRingSize;
 	}
 
 	cb = GetControlBlock(ddcmpLine);
-	InitialiseTransmitQueue(&cb->transmitQueueCtrl);
+	cb->blockSize = DDCMP_INITIAL_BLOCK_SIZE;
+	InitialiseTransmitQueue(&cb->transmitQueueCtrl, ddcmpLine->options.windowSize);
+	if (cb->receiveRing == NULL)
+	{
+		ResizeReceiveRing(cb, 2 * (8 + cb->blockSize + 2));
+	}
 	cb->state = DdcmpLineHalted;
 	cb->SACKNAK = NotSet;
-	InitialiseBuffer(&cb->partialBuffer, cb->partialBufferData, 0, sizeof(cb->partialBufferData));
+	cb->replyTimeout = (ddcmpLine->Now != NULL) ? DDCMP_INITIAL_REPLY_TIMER : ddcmpLine->options.replyTimerMax;
+	UpdateReplyTimeout(ddcmpLine, -1);
 	ProcessEvent(ddcmpLine, UserRequestsStartup);
 }
 
 void DdcmpHalt(ddcmp_line_t *ddcmpLine)
 {
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
 	ProcessEvent(ddcmpLine, UserRequestsHalt);
+
+	/* A halted line keeps only its control block, the buffers are allocated again when it restarts */
+	if (cb->receiveProcessing)
+	{
+		cb->releasePending = 1;
+	}
+	else
+	{
+		ReleaseLineBuffers(ddcmpLine);
+	}
 }
 
-void DdcmpProcessReceivedData(ddcmp_line_t *ddcmpLine, byte *data, int length)
+void DdcmpSetBlockSize(ddcmp_line_t *ddcmpLine, int blockSize)
 {
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
-	buffer_t incomingBuffer;
-	buffer_t extractedBuffer;
-	int droppedData = 0;
+	int ringSize;
 
-	InitialiseBuffer(&incomingBuffer, data, length, length);
-	droppedData = !AppendBuffer(&cb->partialBuffer, &incomingBuffer);
-	if (droppedData)
+	if (cb != NULL && blockSize > 0)
 	{
-		ddcmpLine->Log(LogWarning, "Partial buffer overflow, data lost\n");
+		cb->blockSize = (blockSize <= MAX_DDCMP_DATA_LENGTH) ? blockSize : MAX_DDCMP_DATA_LENGTH;
+		ringSize = 2 * (8 + cb->blockSize + 2);
+		if (cb->receiveRing != NULL && cb->receiveRingSize < ringSize)
+		{
+			ResizeReceiveRing(cb, ringSize);
+		}
+
+		ddcmpLine->Log(LogDetail, "Block size for %s is %d\n", ddcmpLine->name, cb->blockSize);
 	}
-	//ddcmpLine->Log(LogFatal, "Partial(Pos:%d of %d): ", cb->partialBuffer.position, cb->partialBuffer.length);
-	//LogBuffer(ddcmpLine, LogFatal, &cb->partialBuffer);
-	//ddcmpLine->Log(LogFatal, "\n");
+}
 
-	messageReadyToRead = 0;
+void DdcmpProcessReceivedData(ddcmp_line_t *ddcmpLine, byte *data, int length)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+	int copied;
 
-	/* to avoid overrunning the single-message buffer, stop the loop if a message is ready to be read */
-	while(BufferStillHasData(&cb->partialBuffer) && !messageReadyToRead)
+	if (cb == NULL || cb->receiveRing == NULL)
 	{
-		if (!cb->partialBufferIsSynchronized)
+		ddcmpLine->Log(LogVerbose, "Discarding %d bytes received while %s is halted\n", length, ddcmpLine->name);
+	}
+	else
+	{
+		cb->receiveProcessing = 1;
+
+		/* Frame every complete message after each append, so a read that carries several messages delivers them all */
+		do
 		{
-			cb->partialBufferIsSynchronized = SynchronizeMessageFrame(ddcmpLine, &cb->partialBuffer);
-			TruncateUsedBufferPortion(&cb->partialBuffer);
+			copied = AppendToReceiveRing(cb, data, length);
+			data += copied;
+			length -= copied;
+			FrameReceivedMessages(ddcmpLine);
 		}
+		while (length > 0 && !cb->releasePending);
 
-		if (cb->partialBufferIsSynchronized)
+		cb->receiveProcessing = 0;
+		if (cb->releasePending)
 		{
-			ExtractBufferResult extractResult;
-			cb->currentMessage = &extractedBuffer; /* set up location to store buffer to */
-			extractResult = ExtractMessage(ddcmpLine, &cb->partialBuffer);
-			if (extractResult == CompleteGood)
-			{
-                switch (CurrentByte(cb->currentMessage))
-				{
-				case ENQ:
-					{
-						ProcessControlMessage(ddcmpLine);
-						break;
-					}
-
-				case SOH:
-					{
-						ProcessDataMessage(ddcmpLine);
-						break;
-					}
-				case DLE:
-					{
-						ddcmpLine->Log(LogError, "Maintenance message received, halting as maintenance mode is not supported\n");
-						ProcessEvent(ddcmpLine, ReceiveMaintenanceMessage);
-						break;
-					}
-
-				default:
-					{
-						ddcmpLine->Log(LogWarning, "Unknown message category\n");
-						break;
-					}
-				}
-			}
-			else if (extractResult == CompleteBad)
-			{
-				if (CurrentByte(cb->currentMessage) == SOH)
-				{
-				    ProcessEvent(ddcmpLine, ReceiveMessageInError); /* NAK reason has been set up in ExtractMessage */
-				}
-
-				cb->partialBufferIsSynchronized = 0;
-			}
-
-			if (extractResult == Incomplete)
-			{
-				if (droppedData)
-				{
-					if (CurrentByte(cb->currentMessage) == SOH)
-					{
-						cb->NAKReason = NAKMessageTooLong;
-						ProcessEvent(ddcmpLine, ReceiveMessageInError); /* NAK reason has been set up in ExtractMessage */
-					}
-
-				    cb->partialBufferIsSynchronized = 0;
-				}
-				break;
-			}
-			else
-			{
-				TruncateUsedBufferPortion(&cb->partialBuffer);
-			}
+			ReleaseLineBuffers(ddcmpLine);
+		}
+		else
+		{
+			DoIdle(ddcmpLine);
 		}
 	}
+}
 
-	DoIdle(ddcmpLine);
+/* For datagram transports, where data holds exactly one message. Whatever cannot be framed from it, such as
+   the start of a truncated message, is discarded rather than joined to the next datagram. */
+void DdcmpProcessReceivedMessage(ddcmp_line_t *ddcmpLine, byte *data, int length)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+
+	DdcmpProcessReceivedData(ddcmpLine, data, length);
+	if (cb != NULL && cb->receiveRingCount > 0)
+	{
+		ddcmpLine->Log(LogWarning, "Discarding %d bytes of incomplete message received on %s\n", cb->receiveRingCount, ddcmpLine->name);
+		ConsumeReceiveRing(cb, cb->receiveRingCount);
+		cb->receiveIsSynchronized = 0;
+	}
 }
 
 int DdcmpSendDataMessage(ddcmp_line_t *ddcmpLine, byte *data, int length)
@@ -461,48 +525,21 @@ int DdcmpSendDataMessage(ddcmp_line_t *ddcmpLine, byte *data, int length)
 	{
         DoIdleRetransmit(ddcmpLine);
 
-        if (cb->T == ((cb->N + (byte)1) & 0xFF) && cb->SACKNAK != SNAK && !cb->SREP)
+		/* nothing may overtake messages already waiting in the backlog */
+		if (cb->sendBacklogHead == NULL && TransmitDataMessage(ddcmpLine, data, length))
 		{
-			transmit_queue_entry_t *entry = AllocateNextTransmitQueueEntry(&cb->transmitQueueCtrl);
-			if (entry != NULL)
-			{
-				entry->header[0] = SOH;
-				entry->header[1] = length & 0xFF;
-				entry->header[2] = (length >> 8) & 0x3F;
-				entry->header[3] = cb->R;
-				entry->header[4] = cb->N + (byte)1;
-				entry->header[5] = station;
-				AddCrc16ToBuffer(entry->header, 6);
-				memcpy(entry->data, data, length);
-				AddCrc16ToBuffer(entry->data, length);
-				InitialiseBuffer(&entry->buffer, entry->header, 8 + length + 2, sizeof(entry->header) + sizeof(entry->data));
-				cb->currentMessage = &entry->buffer;
-				ProcessEvent(ddcmpLine, UserRequestsDataSendAndReadyToSend);
-				ans = 1;
-			}
-			else
-			{
-				ddcmpLine->Log(LogWarning, "Request to send message rejected because no transmit buffers available\n");
-			}
+			ans = 1;
+		}
+		else if (cb->sendBacklogDepth < ddcmpLine->options.backlogLimit)
+		{
+			AddToSendBacklog(cb, data, length);
+			ddcmpLine->Log(LogDetail, "Message added to send backlog, backlog depth is %d\n", cb->sendBacklogDepth);
+			ans = 1;
 		}
 		else
 		{
-			ddcmpLine->Log(LogWarning, "Request to send message rejected because line is not ready");
-			ddcmpLine->Log(LogDetail, ". Reason:");
-			if (cb->T != ((cb->N + (byte)1) & 0xFF))
-			{
-			     ddcmpLine->Log(LogDetail, " T <> N + 1 (T=%d, N = %d)", cb->T, cb->N);
-			}
-			if (cb->SACKNAK == SNAK)
-			{
-			     ddcmpLine->Log(LogDetail, " SACKNAK  is SNAK");
-			}
-			if (cb->SREP)
-			{
-			     ddcmpLine->Log(LogDetail, " SREP is set");
-			}
-
-			ddcmpLine->Log(LogWarning, "\n", length);
+			/* failing the send lets the forwarding process treat this as congestion */
+			ddcmpLine->Log(LogWarning, "Request to send message rejected because the transmit window and send backlog are full (A=%d, N=%d, window %d, backlog %d)\n", cb->A, cb->N, ddcmpLine->options.windowSize, cb->sendBacklogDepth);
 		}
 	}
 	else
@@ -526,34 +563,6 @@ static void ResetBuffer(buffer_t *buffer)
 	buffer->position = 0;
 }
 
-static int BufferFromSegment(buffer_t *buffer, int length, buffer_t *newBuffer)
-{
-	int ans = 0;
-	if (RemainingBytesInBuffer(buffer) >= length)
-	{
-		newBuffer->data = &buffer->data[buffer->position];
-		newBuffer->length = length;
-		newBuffer->position = 0;
-		AdvanceBufferPostion(buffer, length);
-		ans = 1;
-	}
-
-	return ans;
-}
-
-static int ExtendBuffer(buffer_t *originalBuffer, buffer_t *buffer, int length)
-{
-	int ans = 0;
-	if (RemainingBytesInBuffer(originalBuffer) >= length)
-	{
-		buffer->length += length;
-		AdvanceBufferPostion(originalBuffer, length);
-		ans = 1;
-	}
-
-	return ans;
-}
-
 static byte CurrentByte(buffer_t *buffer)
 {
 	return buffer->data[buffer->position];
@@ -569,16 +578,6 @@ static byte ByteAt(buffer_t *buffer, int position)
 	return buffer->data[position];
 }
 
-static void AdvanceBufferPostion(buffer_t *buffer, int count)
-{
-	buffer->position += count;
-}
-
-static int BufferStillHasData(buffer_t *buffer)
-{
-	return RemainingBytesInBuffer(buffer) > 0;
-}
-
 static int RemainingBytesInBuffer(buffer_t *buffer)
 {
 	return buffer->length - buffer->position;
@@ -594,28 +593,108 @@ static void SetBufferPosition(buffer_t *buffer, int position)
 	buffer->position = position;
 }
 
-static int AppendBuffer(buffer_t *dst, buffer_t *src)
+/* The receive ring holds two messages of the block size. Everything complete is framed out of it after each append
+   so less than one message is ever left behind, which guarantees that a full read always finds room. The ring
+   grows to twice the length of any longer message that arrives. */
+static int AppendToReceiveRing(ddcmp_line_control_block_t *cb, byte *data, int length)
+{
+	int available = cb->receiveRingSize - cb->receiveRingCount;
+	int toCopy = length <= available ? length : available;
+	int end = (cb->receiveRingStart + cb->receiveRingCount) % cb->receiveRingSize;
+	int firstPart = cb->receiveRingSize - end;
+
+	if (firstPart > toCopy)
+	{
+		firstPart = toCopy;
+	}
+
+	memcpy(&cb->receiveRing[end], data, firstPart);
+	memcpy(cb->receiveRing, data + firstPart, toCopy - firstPart);
+	cb->receiveRingCount += toCopy;
+
+	return toCopy;
+}
+
+static byte ReceiveRingByteAt(ddcmp_line_control_block_t *cb, int offset)
 {
-	int len = RemainingBytesInBuffer(src);
-	int available = dst->maxLength - dst->length;
-	int toCopy = len <= available ? len : available;
+	return cb->receiveRing[(cb->receiveRingStart + offset) % cb->receiveRingSize];
+}
 
-	if (toCopy > 0)
+/* Returns the first length bytes of the ring as a contiguous message, only copying if it wraps */
+static byte *GetReceiveRingFrame(ddcmp_line_control_block_t *cb, int length)
+{
+	byte *ans;
+	int firstPart = cb->receiveRingSize - cb->receiveRingStart;
+
+	if (length <= firstPart)
 	{
-		memcpy(&dst->data[dst->length], &src->data[src->position], toCopy);
-		dst->length += toCopy;
-		AdvanceBufferPostion(src, toCopy);
+		ans = &cb->receiveRing[cb->receiveRingStart];
+	}
+	else
+	{
+		memcpy(cb->receiveFrame, &cb->receiveRing[cb->receiveRingStart], firstPart);
+		memcpy(cb->receiveFrame + firstPart, cb->receiveRing, length - firstPart);
+		ans = cb->receiveFrame;
 	}
 
-	return len == 0 || len <= available;
+	return ans;
 }
 
-static void TruncateUsedBufferPortion(buffer_t *buffer)
+/* Moves the ring contents into a new ring of the given size, which must be large enough to hold them */
+static void ResizeReceiveRing(ddcmp_line_control_block_t *cb, int size)
 {
-	int len = RemainingBytesInBuffer(buffer);
-	memmove(buffer->data, buffer->data + buffer->position, len);
-	buffer->length = len;
-	buffer->position = 0;
+	byte *newRing = (byte *)malloc(size);
+	int firstPart = cb->receiveRingSize - cb->receiveRingStart;
+
+	if (firstPart > cb->receiveRingCount)
+	{
+		firstPart = cb->receiveRingCount;
+	}
+
+	if (cb->receiveRingCount > 0)
+	{
+		memcpy(newRing, &cb->receiveRing[cb->receiveRingStart], firstPart);
+		memcpy(newRing + firstPart, cb->receiveRing, cb->receiveRingCount - firstPart);
+	}
+
+	free(cb->receiveRing);
+	free(cb->receiveFrame);
+	cb->receiveRing = newRing;
+	cb->receiveFrame = (byte *)malloc(size);
+	cb->receiveRingSize = size;
+	cb->receiveRingStart = 0;
+}
+
+static void ReleaseLineBuffers(ddcmp_line_t *ddcmpLine)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+
+	StopAckTimer(ddcmpLine);
+	FlushSendBacklog(ddcmpLine);
+	FreeTransmitQueue(&cb->transmitQueueCtrl);
+	free(cb->receiveRing);
+	free(cb->receiveFrame);
+	cb->receiveRing = NULL;
+	cb->receiveFrame = NULL;
+	cb->receiveRingSize = 0;
+	cb->receiveRingStart = 0;
+	cb->receiveRingCount = 0;
+	cb->releasePending = 0;
+
+	/* nothing is left to acknowledge or retransmit */
+	cb->SACKNAK = NotSet;
+	cb->SREP = 0;
+	cb->T = cb->N + (byte)1;
+}
+
+static void ConsumeReceiveRing(ddcmp_line_control_block_t *cb, int length)
+{
+	cb->receiveRingStart = (cb->receiveRingStart + length) % cb->receiveRingSize;
+	cb->receiveRingCount -= length;
+	if (cb->receiveRingCount == 0)
+	{
+		cb->receiveRingStart = 0;
+	}
 }
 
 static void LogBuffer(ddcmp_line_t *line, LogLevel level, buffer_t *buffer)
@@ -637,16 +716,24 @@ static void LogFullBuffer(ddcmp_line_t *line, LogLevel level, buffer_t *buffer)
 	SetBufferPosition(buffer, savePos);
 }
 
-static void InitialiseTransmitQueue(transmit_queue_ctrl_t *transmitQueueCtrl)
+static void InitialiseTransmitQueue(transmit_queue_ctrl_t *transmitQueueCtrl, int length)
 {
 	int i;
+
+	if (transmitQueueCtrl->transmitQueueLength != length)
+	{
+		FreeTransmitQueue(transmitQueueCtrl);
+		transmitQueueCtrl->transmitQueue = (transmit_queue_entry_t *)calloc(length, sizeof(transmit_queue_entry_t));
+		transmitQueueCtrl->transmitQueueLength = length;
+	}
+
 	transmitQueueCtrl->lastAllocatedTransmitQueueEntry = NULL;
 	transmitQueueCtrl->firstUnacknowledgedTransmitQueueEntry = &transmitQueueCtrl->transmitQueue[0];
-	for (i = 0; i < MAX_TRANSMIT_QUEUE_LEN; i++)
+	for (i = 0; i < length; i++)
 	{
 		transmitQueueCtrl->transmitQueue[i].slotNumber = i;
 		transmitQueueCtrl->transmitQueue[i].slotInUse = 0;
-		if (i + 1 < MAX_TRANSMIT_QUEUE_LEN)
+		if (i + 1 < length)
 		{
 			transmitQueueCtrl->transmitQueue[i].next = &transmitQueueCtrl->transmitQueue[i + 1];
 		}
@@ -657,6 +744,22 @@ static void InitialiseTransmitQueue(transmit_queue_ctrl_t *transmitQueueCtrl)
 	}
 }
 
+static void FreeTransmitQueue(transmit_queue_ctrl_t *transmitQueueCtrl)
+{
+	int i;
+
+	for (i = 0; i < transmitQueueCtrl->transmitQueueLength; i++)
+	{
+		free(transmitQueueCtrl->transmitQueue[i].frame);
+	}
+
+	free(transmitQueueCtrl->transmitQueue);
+	transmitQueueCtrl->transmitQueue = NULL;
+	transmitQueueCtrl->transmitQueueLength = 0;
+	transmitQueueCtrl->firstUnacknowledgedTransmitQueueEntry = NULL;
+	transmitQueueCtrl->lastAllocatedTransmitQueueEntry = NULL;
+}
+
 static transmit_queue_entry_t *AllocateNextTransmitQueueEntry(transmit_queue_ctrl_t *transmitQueueCtrl)
 {
 	transmit_queue_entry_t *ans = NULL;
@@ -706,7 +809,7 @@ static transmit_queue_entry_t *GetTransmitQueueEntry(transmit_queue_ctrl_t *tran
 	transmit_queue_entry_t *ans = NULL;
 	transmit_queue_entry_t *temp = transmitQueueCtrl->firstUnacknowledgedTransmitQueueEntry;
 
-	while (temp->slotInUse)
+	while (temp != NULL && temp->slotInUse)
 	{
 		if (n == GetMessageNum(&temp->buffer))
 		{
@@ -733,22 +836,153 @@ static void FreeTransmitQueueEntry(transmit_queue_ctrl_t *transmitQueueCtrl)
 	}
 }
 
+/* Puts a data message into the transmit window, returns false if the window has no room for it */
+static int TransmitDataMessage(ddcmp_line_t *ddcmpLine, byte *data, int length)
+{
+	int ans = 0;
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+
+	if ((byte)(cb->N - cb->A) < ddcmpLine->options.windowSize)
+	{
+		transmit_queue_entry_t *entry = AllocateNextTransmitQueueEntry(&cb->transmitQueueCtrl);
+		if (entry != NULL)
+		{
+			uint16 crc16;
+			byte *header;
+			byte *messageData;
+
+			/* frames start out at the block size and only grow for a longer message */
+			if (entry->frameSize < 8 + length + 2)
+			{
+				free(entry->frame);
+				entry->frameSize = 8 + ((length > cb->blockSize) ? length : cb->blockSize) + 2;
+				entry->frame = (byte *)malloc(entry->frameSize);
+			}
+
+			header = entry->frame;
+			messageData = entry->frame + 8;
+			header[0] = SOH;
+			header[1] = length & 0xFF;
+			header[2] = (length >> 8) & 0x3F;
+			header[3] = cb->R;
+			header[4] = cb->N + (byte)1;
+			header[5] = station;
+			AddCrc16ToBuffer(header, 6);
+			crc16 = DdcmpCrc16Copy(0, messageData, data, length);
+			messageData[length] = crc16 & 0xFF;
+			messageData[length + 1] = crc16 >> 8;
+			InitialiseBuffer(&entry->buffer, entry->frame, 8 + length + 2, entry->frameSize);
+			cb->sendCount[header[4]] = 0;
+			if (cb->T == (byte)(cb->N + 1) && cb->SACKNAK != SNAK && !cb->SREP)
+			{
+				cb->currentMessage = &entry->buffer;
+				ProcessEvent(ddcmpLine, UserRequestsDataSendAndReadyToSend);
+			}
+			else
+			{
+				/* A retransmission, NAK or REP is outstanding, the message takes the next number in the window and
+				   goes out after the messages being retransmitted, as T catches up with N */
+				ddcmpLine->Log(LogDetail, "Message %d queued behind retransmission (T=%d, N=%d)\n", (byte)(cb->N + 1), cb->T, cb->N);
+				cb->N = cb->N + (byte)1;
+				DoIdleRetransmit(ddcmpLine);
+			}
+
+			ans = 1;
+		}
+		else
+		{
+			ddcmpLine->Log(LogWarning, "No transmit buffers available\n");
+		}
+	}
+	else
+	{
+		ddcmpLine->Log(LogDetail, "Transmit window is full (A=%d, N=%d, window %d)\n", cb->A, cb->N, ddcmpLine->options.windowSize);
+	}
+
+	return ans;
+}
+
+static void AddToSendBacklog(ddcmp_line_control_block_t *cb, byte *data, int length)
+{
+	send_backlog_entry_t *entry = (send_backlog_entry_t *)malloc(sizeof(send_backlog_entry_t));
+
+	entry->data = (byte *)malloc(length);
+	memcpy(entry->data, data, length);
+	entry->length = length;
+	entry->next = NULL;
+
+	if (cb->sendBacklogTail != NULL)
+	{
+		cb->sendBacklogTail->next = entry;
+	}
+	else
+	{
+		cb->sendBacklogHead = entry;
+	}
+
+	cb->sendBacklogTail = entry;
+	cb->sendBacklogDepth++;
+}
+
+/* Moves backlogged messages into the transmit window for as long as there is room */
+static void DrainSendBacklog(ddcmp_line_t *ddcmpLine)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+
+	while (cb->state == DdcmpLineRunning && cb->sendBacklogHead != NULL && TransmitDataMessage(ddcmpLine, cb->sendBacklogHead->data, cb->sendBacklogHead->length))
+	{
+		send_backlog_entry_t *entry = cb->sendBacklogHead;
+		cb->sendBacklogHead = entry->next;
+		if (cb->sendBacklogHead == NULL)
+		{
+			cb->sendBacklogTail = NULL;
+		}
+
+		cb->sendBacklogDepth--;
+		free(entry->data);
+		free(entry);
+	}
+}
+
+static void FlushSendBacklog(ddcmp_line_t *ddcmpLine)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+
+	if (cb->sendBacklogDepth > 0)
+	{
+		ddcmpLine->Log(LogWarning, "Discarding %d messages from the send backlog of %s\n", cb->sendBacklogDepth, ddcmpLine->name);
+	}
+
+	while (cb->sendBacklogHead != NULL)
+	{
+		send_backlog_entry_t *entry = cb->sendBacklogHead;
+		cb->sendBacklogHead = entry->next;
+		free(entry->data);
+		free(entry);
+	}
+
+	cb->sendBacklogTail = NULL;
+	cb->sendBacklogDepth = 0;
+}
+
 static ddcmp_line_control_block_t *GetControlBlock(ddcmp_line_t *ddcmpLine)
 {
 	return (ddcmp_line_control_block_t *)ddcmpLine->controlBlock;
 }
 
-static int Mod256Cmp(byte a, byte b)
+/* Compares two sequence numbers by their distance forward from base, normally A, which is correct for any window
+   of up to 255 outstanding messages. Returns -1, 0 or 1 as a is before, the same as or after b. */
+static int Mod256Cmp(byte base, byte a, byte b)
 {
 	int ans;
-	int abdiff = b - a;
-	int badiff = a - b;
+	byte aOffset = a - base;
+	byte bOffset = b - base;
 
-	if (abdiff == 0)
+	if (aOffset == bOffset)
 	{
 		ans = 0;
 	}
-	else if (abdiff < 0)
+	else if (aOffset < bOffset)
 	{
 		ans = -1;
 	}
@@ -757,35 +991,117 @@ static int Mod256Cmp(byte a, byte b)
 		ans = 1;
 	}
 
-	if (abs(badiff) <= MAX_TRANSMIT_QUEUE_LEN)
+	return ans;
+}
+
+/* Returns the offset of T from A. T runs from A + 1 to N + 1, so with all 255 messages of a full window outstanding
+   N + 1 wraps round to A and T == A is an offset of 256, which no byte comparison against N + 1 can express. */
+static int TransmitOffset(ddcmp_line_control_block_t *cb)
+{
+	int ans = (byte)(cb->T - cb->A);
+
+	if (ans == 0 && (byte)(cb->N - cb->A) == 255)
 	{
-		ans = -1 * ans;
+		ans = 256;
 	}
 
 	return ans;
 }
 
-static uint16 Crc16(uint16 crc, buffer_t *buffer)
+uint16 DdcmpCrc16(uint16 crc, byte *data, int length)
 {
-	int savePos = CurrentBufferPosition(buffer);
+	if (!crc16TablesInitialised)
+	{
+		InitialiseCrc16Tables();
+	}
+
+	while (length >= 8)
+	{
+		crc = crc16Table[7][(data[0] ^ crc) & 0xFF] ^
+			  crc16Table[6][(data[1] ^ (crc >> 8)) & 0xFF] ^
+			  crc16Table[5][data[2]] ^
+			  crc16Table[4][data[3]] ^
+			  crc16Table[3][data[4]] ^
+			  crc16Table[2][data[5]] ^
+			  crc16Table[1][data[6]] ^
+			  crc16Table[0][data[7]];
+		data += 8;
+		length -= 8;
+	}
 
-	while(BufferStillHasData(buffer)) {
-		byte b = CurrentByte(buffer);
-		crc = (crc>>4) ^ crc16_nibble[(b ^ crc) & 0xF];
-		crc = (crc>>4) ^ crc16_nibble[(b>>4 ^ crc) & 0xF];
-		MoveToNextByte(buffer);
-	};
+	while (length-- > 0)
+	{
+		crc = (crc >> 8) ^ crc16Table[0][(*data++ ^ crc) & 0xFF];
+	}
+
+	return crc;
+}
+
+uint16 DdcmpCrc16Copy(uint16 crc, byte *dst, byte *src, int length)
+{
+	if (!crc16TablesInitialised)
+	{
+		InitialiseCrc16Tables();
+	}
+
+	while (length >= 8)
+	{
+		memcpy(dst, src, 8);
+		crc = crc16Table[7][(src[0] ^ crc) & 0xFF] ^
+			  crc16Table[6][(src[1] ^ (crc >> 8)) & 0xFF] ^
+			  crc16Table[5][src[2]] ^
+			  crc16Table[4][src[3]] ^
+			  crc16Table[3][src[4]] ^
+			  crc16Table[2][src[5]] ^
+			  crc16Table[1][src[6]] ^
+			  crc16Table[0][src[7]];
+		src += 8;
+		dst += 8;
+		length -= 8;
+	}
+
+	while (length-- > 0)
+	{
+		*dst = *src++;
+		crc = (crc >> 8) ^ crc16Table[0][(*dst++ ^ crc) & 0xFF];
+	}
 
-	SetBufferPosition(buffer, savePos);
 	return crc;
 }
 
+static void InitialiseCrc16Tables(void)
+{
+	int i;
+	int j;
+	int k;
+
+	for (i = 0; i < 256; i++)
+	{
+		uint16 crc = (uint16)i;
+		for (j = 0; j < 8; j++)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ CRC16_POLYNOMIAL : crc >> 1;
+		}
+
+		crc16Table[0][i] = crc;
+	}
+
+	for (k = 1; k < 8; k++)
+	{
+		for (i = 0; i < 256; i++)
+		{
+			uint16 prev = crc16Table[k - 1][i];
+			crc16Table[k][i] = (prev >> 8) ^ crc16Table[0][prev & 0xFF];
+		}
+	}
+
+	crc16TablesInitialised = 1;
+}
+
 static void AddCrc16ToBuffer(byte *data, int length)
 {
-	buffer_t buf;
 	uint16 crc16;
-	InitialiseBuffer(&buf, data, length, length);
-	crc16 = Crc16(0, &buf);
+	crc16 = DdcmpCrc16(0, data, length);
 	data[length] = crc16 & 0xFF;
 	data[length + 1] = crc16 >> 8;
 }
@@ -807,10 +1123,21 @@ static void DoIdle(ddcmp_line_t *ddcmpLine)
 	}
 
 	DoIdleRetransmit(ddcmpLine);
+	DrainSendBacklog(ddcmpLine); /* acknowledgements may have made room in the window */
 
 	if (cb->SACKNAK == SACK)
 	{
-		SendAck(ddcmpLine);
+		/* With a delay configured the ACK is held back so that data sent in the meantime can carry it, unless half
+		   the window has been received without being acknowledged */
+		int ackThreshold = ddcmpLine->options.windowSize / 2;
+		if (ddcmpLine->options.ackDelay <= 0 || (byte)(cb->R - cb->lastAckSent) >= (ackThreshold > 0 ? ackThreshold : 1))
+		{
+			SendAck(ddcmpLine);
+		}
+		else
+		{
+			StartAckTimer(ddcmpLine);
+		}
 	}
 }
 
@@ -819,7 +1146,7 @@ static void DoIdleRetransmit(ddcmp_line_t *ddcmpLine)
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
     transmit_queue_entry_t *entry = NULL;
 
-	while (cb->SACKNAK != SNAK && !cb->SREP && Mod256Cmp(cb->T, (cb->N + (byte)1)) < 0 /* && !IsTimerRunning(ddcmpLine)*/)
+	while (cb->SACKNAK != SNAK && !cb->SREP && TransmitOffset(cb) <= (byte)(cb->N - cb->A) /* && !IsTimerRunning(ddcmpLine)*/)
 	{
     	entry = GetTransmitQueueEntry(&cb->transmitQueueCtrl, cb->T);
 		if (entry != NULL)
@@ -827,35 +1154,95 @@ static void DoIdleRetransmit(ddcmp_line_t *ddcmpLine)
 			cb->currentMessage = &entry->buffer;
 			ProcessEvent(ddcmpLine, ReadyToRetransmitMsg);
 		}
+		else
+		{
+			ddcmpLine->Log(LogError, "Message %d to retransmit is not in the transmit queue for %s\n", cb->T, ddcmpLine->name);
+			break;
+		}
 	}
 }
 
-static int SynchronizeMessageFrame(ddcmp_line_t *ddcmpLine, buffer_t *buffer)
+static void FrameReceivedMessages(ddcmp_line_t *ddcmpLine)
 {
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+	buffer_t extractedBuffer;
+	ExtractBufferResult extractResult = CompleteGood;
+
+	while (cb->receiveRingCount > 0 && extractResult != Incomplete)
+	{
+		if (!cb->receiveIsSynchronized)
+		{
+			cb->receiveIsSynchronized = SynchronizeMessageFrame(ddcmpLine);
+		}
+
+		if (cb->receiveIsSynchronized)
+		{
+			cb->currentMessage = &extractedBuffer; /* set up location to store buffer to */
+			extractResult = ExtractMessage(ddcmpLine);
+			if (extractResult == CompleteGood)
+			{
+                switch (CurrentByte(cb->currentMessage))
+				{
+				case ENQ:
+					{
+						ProcessControlMessage(ddcmpLine);
+						break;
+					}
+
+				case SOH:
+					{
+						ProcessDataMessage(ddcmpLine);
+						break;
+					}
+				case DLE:
+					{
+						ddcmpLine->Log(LogError, "Maintenance message received, halting as maintenance mode is not supported\n");
+						ProcessEvent(ddcmpLine, ReceiveMaintenanceMessage);
+						break;
+					}
+
+				default:
+					{
+						ddcmpLine->Log(LogWarning, "Unknown message category\n");
+						break;
+					}
+				}
+			}
+			else if (extractResult == CompleteBad)
+			{
+				if (CurrentByte(cb->currentMessage) == SOH)
+				{
+				    ProcessEvent(ddcmpLine, ReceiveMessageInError); /* NAK reason has been set up in ExtractMessage */
+				}
+
+				cb->receiveIsSynchronized = 0;
+			}
+		}
+	}
+}
+
+static int SynchronizeMessageFrame(ddcmp_line_t *ddcmpLine)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
 	int ans = 0;
 	int skipCount = 0;
 
 	ddcmpLine->Log(LogDetail, "Synchronizing message frame on %s\n", ddcmpLine->name);
 
-	while (BufferStillHasData(buffer))
+	while (skipCount < cb->receiveRingCount)
 	{
-		byte next = CurrentByte(buffer);
+		byte next = ReceiveRingByteAt(cb, skipCount);
 		if (next == ENQ || next == SOH || next == DLE)
 		{
 			ans = 1;
-		}
-
-		if (ans)
-		{
 			break;
 		}
-		else
-		{
-			MoveToNextByte(buffer);
-			skipCount++;
-		}
+
+		skipCount++;
 	}
 
+	ConsumeReceiveRing(cb, skipCount);
+
 	if (skipCount > 0)
 	{
 		ddcmpLine->Log(LogVerbose, "Synch skipped %d bytes\n", skipCount);
@@ -864,18 +1251,24 @@ static int SynchronizeMessageFrame(ddcmp_line_t *ddcmpLine, buffer_t *buffer)
 	return ans;
 }
 
-static ExtractBufferResult ExtractMessage(ddcmp_line_t *ddcmpLine, buffer_t *buffer)
+/* Frames the message at the start of the receive ring into cb->currentMessage and consumes it from the ring,
+   unless it is incomplete in which case the ring is left untouched. */
+static ExtractBufferResult ExtractMessage(ddcmp_line_t *ddcmpLine)
 {
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
 	ExtractBufferResult ans = Incomplete;
-	int savePos = CurrentBufferPosition(buffer);
-	switch (CurrentByte(buffer))
+	byte *frame;
+
+	if (cb->receiveRingCount >= 8)
 	{
-	case ENQ:
+		frame = GetReceiveRingFrame(cb, 8);
+		InitialiseBuffer(cb->currentMessage, frame, 8, 8);
+		switch (frame[0])
 		{
-			if (BufferFromSegment(buffer, 8, cb->currentMessage))
+		case ENQ:
 			{
-				if (Crc16(0, cb->currentMessage) == 0)
+				ConsumeReceiveRing(cb, 8);
+				if (DdcmpCrc16(0, frame, 8) == 0)
 				{
 					ans = CompleteGood;
 				}
@@ -885,87 +1278,81 @@ static ExtractBufferResult ExtractMessage(ddcmp_line_t *ddcmpLine, buffer_t *buf
 					ddcmpLine->Log(LogWarning, "CRC error on received message: ");
 					LogFullBuffer(ddcmpLine, LogWarning, cb->currentMessage);
 				}
+				break;
 			}
-			else
-			{
-				ans = Incomplete;
-			}
-			break;
-		}
 
-	case SOH:
-	case DLE:
-		{
-			if (BufferFromSegment(buffer, 8, cb->currentMessage))
+		case SOH:
+		case DLE:
 			{
-				if (Crc16(0, cb->currentMessage) == 0)
+				if (DdcmpCrc16(0, frame, 8) == 0)
 				{
 					unsigned int count = GetDataMessageCount(cb->currentMessage);
-					SetBufferPosition(cb->currentMessage, 8);
+					int total = 8 + count + 2;
 
-					if (ExtendBuffer(buffer, cb->currentMessage, count + 2))
+					if (total > MAX_DDCMP_BUFFER_LENGTH)
+					{
+						ConsumeReceiveRing(cb, 8);
+						ans = CompleteBad;
+						cb->NAKReason = NAKMessageTooLong;
+						ddcmpLine->Log(LogWarning, "Received message too long, data length is %u\n", count);
+					}
+					else if (total > cb->receiveRingSize)
 					{
-						if (Crc16( 0, cb->currentMessage) == 0)
+						/* longer than the block size, make room for it and wait for the rest */
+						ddcmpLine->Log(LogDetail, "Receive ring for %s grown for a message of %u bytes\n", ddcmpLine->name, count);
+						ResizeReceiveRing(cb, 2 * total);
+					}
+					else if (cb->receiveRingCount >= total)
+					{
+						frame = GetReceiveRingFrame(cb, total);
+						InitialiseBuffer(cb->currentMessage, frame, total, total);
+						ConsumeReceiveRing(cb, total);
+						if (DdcmpCrc16(0, frame + 8, count + 2) == 0)
 						{
-							ResetBuffer(cb->currentMessage);
 							ans = CompleteGood;
 						}
 						else
 						{
-							ResetBuffer(cb->currentMessage);
 							ans = CompleteBad;
 							cb->NAKReason = NAKDataFieldBlockCheckError;
 							ddcmpLine->Log(LogWarning, "CRC error on received data block: ");
-					        LogFullBuffer(ddcmpLine, LogWarning, cb->currentMessage);
+							LogFullBuffer(ddcmpLine, LogWarning, cb->currentMessage);
 						}
 					}
-					else
-					{
-						ans = Incomplete;
-					}
 				}
 				else
 				{
+					ConsumeReceiveRing(cb, 8);
 					ans = CompleteBad;
 					cb->NAKReason = NAKHeaderBlockCheckError;
 					ddcmpLine->Log(LogWarning, "CRC error on received message header: ");
 					LogFullBuffer(ddcmpLine, LogWarning, cb->currentMessage);
 				}
+				break;
 			}
-			else
+
+		default:
 			{
-				ans = Incomplete;
+				ans = CompleteBad;
+				break;
 			}
-			break;
-		}
-
-	default:
-		{
-			ans = CompleteBad;
-			break;
 		}
 	}
 
-	if (ans == Incomplete)
-	{
-		SetBufferPosition(buffer, savePos);
-	}
-
 	return ans;
 }
 
+/* The message and its CRC go to SendData together, so that a datagram transport carries the whole message */
 static int SendMessageAddingCrc16(ddcmp_line_t *ddcmpLine, byte *data, int length)
 {
-	byte crc[2];
+	byte frame[CONTROL_MESSAGE_LENGTH + 2];
 	uint16 crc16;
-	buffer_t msgBuf;
 
-	InitialiseBuffer(&msgBuf, data, length, length);
-	crc16 = Crc16 (0, &msgBuf);
-	crc[0] = crc16 & 0xFF;
-	crc[1] = crc16 >> 8;
-	ddcmpLine->SendData(ddcmpLine->context, data, length);
-	ddcmpLine->SendData(ddcmpLine->context, crc, 2);
+	crc16 = DdcmpCrc16(0, data, length);
+	memcpy(frame, data, length);
+	frame[length] = crc16 & 0xFF;
+	frame[length + 1] = crc16 >> 8;
+	ddcmpLine->SendData(ddcmpLine->context, frame, length + 2);
 
 	return 1;
 }
@@ -982,18 +1369,80 @@ static void ReplyTimerHandler(void *timerContext)
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
 	cb->replyTimerHandle = NULL;
 	ddcmpLine->Log(LogVerbose, "Processing timer expiry\n");
+	if (cb->state == DdcmpLineRunning)
+	{
+		BackOffReplyTimeout(ddcmpLine);
+	}
 	ProcessEvent(ddcmpLine, TimerExpires);
 	DoIdle(ddcmpLine);
 }
 
-static void StartTimer(ddcmp_line_t *ddcmpLine, int seconds)
+static void StartTimer(ddcmp_line_t *ddcmpLine, int milliseconds)
 {
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
 	if (cb->replyTimerHandle == NULL)
 	{
-		ddcmpLine->Log(LogVerbose, "Starting timer for %d seconds\n", seconds);
-		cb->replyTimerHandle = ddcmpLine->CreateOneShotTimer(ddcmpLine, "Reply timer", seconds, ReplyTimerHandler);
+		ddcmpLine->Log(LogVerbose, "Starting timer for %d ms\n", milliseconds);
+		cb->replyTimerHandle = ddcmpLine->CreateOneShotTimer(ddcmpLine, "Reply timer", milliseconds, ReplyTimerHandler);
+	}
+}
+
+/* Round trip estimation as for TCP (RFC 6298): the reply timer is the smoothed round trip time
+   plus four times its mean deviation, kept within the configured limits. An rtt of -1 just
+   reapplies the limits. */
+static void UpdateReplyTimeout(ddcmp_line_t *ddcmpLine, int rtt)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+	int timeout = cb->replyTimeout;
+
+	if (rtt >= 0)
+	{
+		if (!cb->rttMeasured)
+		{
+			cb->smoothedRtt = rtt;
+			cb->rttVariation = rtt / 2;
+			cb->rttMeasured = 1;
+		}
+		else
+		{
+			int delta = cb->smoothedRtt - rtt;
+			if (delta < 0)
+			{
+				delta = -delta;
+			}
+
+			cb->rttVariation += (delta - cb->rttVariation) / 4;
+			cb->smoothedRtt += (rtt - cb->smoothedRtt) / 8;
+		}
+
+		timeout = cb->smoothedRtt + 4 * cb->rttVariation;
+	}
+
+	if (timeout < ddcmpLine->options.replyTimerMin)
+	{
+		timeout = ddcmpLine->options.replyTimerMin;
+	}
+	else if (timeout > ddcmpLine->options.replyTimerMax)
+	{
+		timeout = ddcmpLine->options.replyTimerMax;
+	}
+
+	cb->replyTimeout = timeout;
+}
+
+static void BackOffReplyTimeout(ddcmp_line_t *ddcmpLine)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+	if (cb->replyTimeout < ddcmpLine->options.replyTimerMax / 2)
+	{
+		cb->replyTimeout *= 2;
 	}
+	else
+	{
+		cb->replyTimeout = ddcmpLine->options.replyTimerMax;
+	}
+
+	ddcmpLine->Log(LogDetail, "Reply timer expired for %s, backing off to %d ms\n", ddcmpLine->name, cb->replyTimeout);
 }
 
 static void StopTimer(ddcmp_line_t *ddcmpLine)
@@ -1013,6 +1462,37 @@ static int IsTimerRunning(ddcmp_line_t *ddcmpLine)
 	return cb->replyTimerHandle != NULL;
 }
 
+static void AckTimerHandler(void *timerContext)
+{
+	ddcmp_line_t *ddcmpLine = (ddcmp_line_t *)timerContext;
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+	cb->ackTimerHandle = NULL;
+	if (cb->state == DdcmpLineRunning && cb->SACKNAK == SACK)
+	{
+		ddcmpLine->Log(LogVerbose, "Delayed ACK timer expired, no data to carry the ACK\n");
+		SendAck(ddcmpLine);
+	}
+}
+
+static void StartAckTimer(ddcmp_line_t *ddcmpLine)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+	if (cb->ackTimerHandle == NULL)
+	{
+		cb->ackTimerHandle = ddcmpLine->CreateOneShotTimer(ddcmpLine, "ACK delay timer", ddcmpLine->options.ackDelay, AckTimerHandler);
+	}
+}
+
+static void StopAckTimer(ddcmp_line_t *ddcmpLine)
+{
+	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
+	if (cb->ackTimerHandle != NULL)
+	{
+		ddcmpLine->CancelOneShotTimer(cb->ackTimerHandle);
+		cb->ackTimerHandle = NULL;
+	}
+}
+
 static void ProcessEvent(ddcmp_line_t *ddcmpLine, DdcmpEvent evt)
 {
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
@@ -1237,7 +1717,7 @@ static void CheckAndProcessAckData(ddcmp_line_t *ddcmpLine)
 
     resp = GetMessageResp(cb->currentMessage);
 
-    if (Mod256Cmp(cb->A, resp) < 0 && Mod256Cmp(resp, cb->N) <= 0)
+    if (Mod256Cmp(cb->A, cb->A, resp) < 0 && Mod256Cmp(cb->A, resp, cb->N) <= 0)
     {
         ProcessEvent(ddcmpLine, ReceiveAckForOutstandingMsg);
     }
@@ -1264,7 +1744,7 @@ static void ProcessNakMessage(ddcmp_line_t *ddcmpLine)
 	if (valid)
 	{
 		ddcmpLine->Log(LogDetail, "Received %s message from %s. Flags=%s%s, Reason=%d, R=%d, Addr=%d\n", msgName, ddcmpLine->name, LOGFLAGS(flags), reason, resp, addr);
-		if (Mod256Cmp(cb->A, resp) <= 0 || Mod256Cmp(resp, cb->N) > 0)
+		if (Mod256Cmp(cb->A, resp, cb->N) <= 0)
 		{
 			ProcessEvent(ddcmpLine, ReceiveNakForOutstandingMsg);
 		}
@@ -1356,6 +1836,7 @@ static byte GetMessageResp(buffer_t *message)
 static void UpdateTransmitHeader(buffer_t *message, ddcmp_line_control_block_t *cb)
 {
 	message->data[3] = cb->R;
+	cb->lastAckSent = cb->R;
 	AddCrc16ToBuffer(message->data, 6);
 }
 
@@ -1368,6 +1849,8 @@ static void SendAck(ddcmp_line_t *ddcmpLine)
 	ddcmpLine->Log(LogDetail, "Sending ACK to %s. Num=%d\n", ddcmpLine->name, cb->R);
 	SendMessageAddingCrc16(ddcmpLine, ack, sizeof(ack));
 	cb->SACKNAK = NotSet;
+	cb->lastAckSent = cb->R;
+	StopAckTimer(ddcmpLine);
 }
 
 static void SendNak(ddcmp_line_t *ddcmpLine)
@@ -1380,6 +1863,8 @@ static void SendNak(ddcmp_line_t *ddcmpLine)
 	ddcmpLine->Log(LogDetail, "Sending NAK to %s. Num=%d, Reason=%d\n", ddcmpLine->name, cb->R, cb->NAKReason);
 	SendMessageAddingCrc16(ddcmpLine, nak, sizeof(nak));
 	cb->SACKNAK = NotSet;
+	cb->lastAckSent = cb->R;
+	StopAckTimer(ddcmpLine);
 }
 
 static void SendRep(ddcmp_line_t *ddcmpLine)
@@ -1391,7 +1876,7 @@ static void SendRep(ddcmp_line_t *ddcmpLine)
 	ddcmpLine->Log(LogDetail, "Sending REP to %s. Num=%d\n", ddcmpLine->name, cb->N);
 	SendMessageAddingCrc16(ddcmpLine, rep, sizeof(rep));
 	cb->SREP = 0;
-	StartTimer(ddcmpLine, 15);
+	StartTimer(ddcmpLine, cb->replyTimeout);
 }
 
 static int StopTimerAction(ddcmp_line_t *ddcmpLine)
@@ -1404,7 +1889,7 @@ static int StopTimerAction(ddcmp_line_t *ddcmpLine)
 static int StartTimerAction(ddcmp_line_t *ddcmpLine)
 {
 	ddcmpLine->Log(LogVerbose, "Start timer action for %s\n", ddcmpLine->name);
-	StartTimer(ddcmpLine, 3);
+	StartTimer(ddcmpLine, 3000);
 	return 1;
 }
 
@@ -1490,6 +1975,7 @@ static int ClearSackSnakAction(ddcmp_line_t *ddcmpLine)
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
 	ddcmpLine->Log(LogVerbose, "Clear SACK/SNAK action for %s\n", ddcmpLine->name);
 	cb->SACKNAK = NotSet;
+	StopAckTimer(ddcmpLine); /* the message being sent carries the acknowledgement */
 	return 1;
 }
 
@@ -1520,10 +2006,6 @@ static int GiveMessageToUserAction(ddcmp_line_t *ddcmpLine)
 		cb->SACKNAK = SNAK;
 		ans = 0;
 	}
-	else
-	{
-		messageReadyToRead = 1;
-	}
 
 	return ans;
 }
@@ -1538,6 +2020,16 @@ static int SendMessageAction(ddcmp_line_t *ddcmpLine)
 	resp = GetMessageResp(cb->currentMessage);
 	ddcmpLine->Log(LogVerbose, "Send next message action for %s\n", ddcmpLine->name);
 	ddcmpLine->Log(LogDetail, "Sending Data to %s. Len=%d, N=%d, R=%d\n", ddcmpLine->name, cb->currentMessage->length, num, resp);
+	if (cb->sendCount[num] < 255)
+	{
+		cb->sendCount[num]++;
+	}
+
+	if (cb->sendCount[num] == 1 && ddcmpLine->Now != NULL)
+	{
+		cb->sendTime[num] = ddcmpLine->Now();
+	}
+
 	SendRawMessage(ddcmpLine, cb->currentMessage->data, cb->currentMessage->length);
 	return 1;
 }
@@ -1578,7 +2070,7 @@ static int SetTVarFromAckAction(ddcmp_line_t *ddcmpLine)
 {
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
 	ddcmpLine->Log(LogVerbose, "Set T variable from ack action for %s\n", ddcmpLine->name);
-	if (Mod256Cmp(cb->T, cb->A) <= 0)
+	if (TransmitOffset(cb) == 0 || TransmitOffset(cb) > (byte)(cb->N - cb->A) + 1)
 	{
 		cb->T = cb-> A + (byte)1;
 	}
@@ -1606,9 +2098,9 @@ static int CheckAckWaitTimerAction(ddcmp_line_t *ddcmpLine)
 {
 	ddcmp_line_control_block_t *cb = GetControlBlock(ddcmpLine);
 	ddcmpLine->Log(LogVerbose, "Check ack wait timer action for %s\n", ddcmpLine->name);
-	if (cb->A < cb->X)
+	if (Mod256Cmp(cb->A, cb->A, cb->X) < 0)
 	{
-		StartTimer(ddcmpLine, 15);
+		StartTimer(ddcmpLine, cb->replyTimeout);
 	}
 	else
 	{
@@ -1632,6 +2124,20 @@ static int CompleteMessageAction(ddcmp_line_t *ddcmpLine)
 	byte resp = GetMessageResp(cb->currentMessage);
 	ddcmpLine->Log(LogVerbose, "Complete message action for %s\n", ddcmpLine->name);
 
+	if (resp != cb->A && Mod256Cmp(cb->A, resp, cb->N) <= 0)
+	{
+		/* New data acknowledged, only a message that was not retransmitted gives an unambiguous round trip sample */
+		if (cb->sendCount[resp] == 1 && ddcmpLine->Now != NULL)
+		{
+			int rtt = (int)(ddcmpLine->Now() - cb->sendTime[resp]);
+			UpdateReplyTimeout(ddcmpLine, rtt);
+			ddcmpLine->Log(LogVerbose, "Round trip for %s is %d ms, smoothed %d ms, reply timer %d ms\n", ddcmpLine->name, rtt, cb->smoothedRtt, cb->replyTimeout);
+		}
+
+		/* Restart the reply timer for the messages still outstanding */
+		StopTimer(ddcmpLine);
+	}
+
 	while (1)
 	{
 		transmit_queue_entry_t *entry = GetFirstUnacknowledgedTransmitQueueEntry(&cb->transmitQueueCtrl);
@@ -1642,7 +2148,7 @@ static int CompleteMessageAction(ddcmp_line_t *ddcmpLine)
 		else
 		{
 			byte N = GetMessageNum(&entry->buffer);
-			if (Mod256Cmp(N, resp) <= 0)
+			if (Mod256Cmp(cb->A, N, resp) <= 0)
 			{
 				FreeTransmitQueueEntry(&cb->transmitQueueCtrl);
 			}
@@ -27,21 +27,66 @@
   ------------------------------------------------------------------------------*/
 
 #include "basictypes.h"
+#include "clock.h"
 
 #if !defined(DDCMP_H)
 
 #define MAX_DDCMP_BUFFER_LENGTH 8192
 #define MAX_DDCMP_DATA_LENGTH (MAX_DDCMP_BUFFER_LENGTH - 10)
 
+/* The transmit window needs to be fairly high because once a circuit signals
+   that it has data, all data from it is read and processed. This can fill the DDCMP
+   transmit queue before all the processing is complete. This leads to slow
+   transfers, and overrun errors in file copies. Links with a long round trip
+   time need a larger window still, up to the 255 messages that the 8 bit
+   sequence numbers allow. */
+#define DDCMP_DEFAULT_WINDOW 20
+#define DDCMP_MAX_WINDOW 255
+
+/* Data length that buffers are sized for until the routing layer has negotiated the block size. Longer
+   messages are still handled, the buffers grow to fit them. */
+#define DDCMP_INITIAL_BLOCK_SIZE 576
+
+/* Messages that do not fit in the transmit window wait in the send backlog until acknowledgements make room */
+#define DDCMP_DEFAULT_BACKLOG 64
+
+/* The reply timer adapts to the measured round trip time, between these limits in milliseconds.
+   The initial value is used until the first round trip has been measured. */
+#define DDCMP_DEFAULT_REPLY_TIMER_MIN 200
+#define DDCMP_DEFAULT_REPLY_TIMER_MAX 15000
+#define DDCMP_INITIAL_REPLY_TIMER 3000
+
+/* How a line carried over TCP treats the Nagle algorithm. The socket line already gathers the messages
+   written in one pass of the event loop into a single write, so by default Nagle is turned off. */
+typedef enum
+{
+	DdcmpTcpNoDelay,
+	DdcmpTcpNagle,
+	DdcmpTcpCork
+} DdcmpTcpPolicy;
+
+typedef struct ddcmp_options
+{
+	int windowSize; /* maximum number of unacknowledged data messages */
+	int backlogLimit; /* maximum number of messages waiting for space in the window, 0 to reject them instead */
+	int ackDelay; /* milliseconds to hold back an ACK in the hope that data will carry it, 0 to send ACKs at once */
+	int replyTimerMin; /* floor for the adaptive reply timer, in milliseconds */
+	int replyTimerMax; /* ceiling for the adaptive reply timer, in milliseconds */
+	DdcmpTcpPolicy tcpPolicy; /* only used by lines carried over TCP */
+	uint16 udpPort; /* local port to carry the line over UDP instead of TCP, 0 for TCP */
+} ddcmp_options_t;
+
 typedef struct ddcmp_line
 {
 	void *context; /* for callbacks */
     char *name;
 
 	void *controlBlock;
+	ddcmp_options_t options;
 
-	void *(*CreateOneShotTimer)(void *timerContext, char *name, int seconds, void (*timerHandler)(void *timerContext));
+	void *(*CreateOneShotTimer)(void *timerContext, char *name, int milliseconds, void (*timerHandler)(void *timerContext));
 	void (*CancelOneShotTimer)(void *timerHandle);
+	clock_ms_t (*Now)(void); /* for round trip time measurement, NULL to keep the reply timer at its maximum */
 	void (*SendData)(void *context, byte *data, int length);
 	void (*NotifyHalt)(void *context);
 	void (*NotifyRunning)(void *context);
@@ -49,10 +94,18 @@ typedef struct ddcmp_line
     void (*Log)(LogLevel level, char *format, ...);
 } ddcmp_line_t;
 
+void DdcmpInitialiseOptions(ddcmp_options_t *options);
 void DdcmpStart(ddcmp_line_t *ddcmpLine);
 void DdcmpHalt(ddcmp_line_t *ddcmpLine);
+void DdcmpSetBlockSize(ddcmp_line_t *ddcmpLine, int blockSize);
 void DdcmpProcessReceivedData(ddcmp_line_t *ddcmpLine, byte *data, int length);
+void DdcmpProcessReceivedMessage(ddcmp_line_t *ddcmpLine, byte *data, int length);
 int  DdcmpSendDataMessage(ddcmp_line_t *ddcmpLine, byte *data, int length);
 
+/* CRC-16 as used for DDCMP block checks, over a raw byte range. DdcmpCrc16Copy also copies
+   the range to dst so that a message can be checksummed while it is being built. */
+uint16 DdcmpCrc16(uint16 crc, byte *data, int length);
+uint16 DdcmpCrc16Copy(uint16 crc, byte *dst, byte *src, int length);
+
 #define DDCMP_H
 #endif
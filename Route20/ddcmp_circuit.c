@@ -44,11 +44,11 @@ static void HandleHelloAndTestTimer(rtimer_t *timer, char *name, void *context);
 static void StopTimerIfRunning(ddcmp_circuit_t *ddcmpCircuit);
 static void StartTimer(ddcmp_circuit_t *ddcmpCircuit);
 
-ddcmp_circuit_t *DdcmpCircuitCreateSocket(circuit_t *circuit, char *destinationHostName, uint16 destinationPort, int connectPoll)
+ddcmp_circuit_t *DdcmpCircuitCreateSocket(circuit_t *circuit, char *destinationHostName, uint16 destinationPort, int connectPoll, struct ddcmp_options *options)
 {
 	ddcmp_circuit_t *ans = (ddcmp_circuit_t *)calloc(1, sizeof(ddcmp_circuit_t));
 	line_t *line = (line_t *)malloc(sizeof(line_t));
-    LineCreateDdcmpSocket(line, circuit->name, destinationHostName, destinationPort, connectPoll, circuit, HandleLineNotifyData);
+    LineCreateDdcmpSocket(line, circuit->name, destinationHostName, destinationPort, connectPoll, options, circuit, HandleLineNotifyData);
 
 	ans->circuit = circuit;
 	circuit->line = line;
@@ -163,8 +163,7 @@ static void StopTimerIfRunning(ddcmp_circuit_t *ddcmpCircuit)
 
 static void StartTimer(ddcmp_circuit_t *ddcmpCircuit)
 {
-    time_t now;
-    time(&now);
+    clock_ms_t now = ClockNow();
     StopTimerIfRunning(ddcmpCircuit);
-    ddcmpCircuit->circuit->helloTimer = CreateTimer("HelloAndTest", now, T3, ddcmpCircuit->circuit, HandleHelloAndTestTimer);
+    ddcmpCircuit->circuit->helloTimer = CreateTimer("HelloAndTest", now, SECS_TO_MS(T3), ddcmpCircuit->circuit, HandleHelloAndTestTimer);
 }
@@ -85,6 +85,8 @@ static void HandleLineNotifyStateChange(line_t *line);
 static socket_t * TcpAcceptCallback(sockaddr_t *receivedFrom);
 static void TcpConnectCallback(socket_t *sock);
 static void TcpDisconnectCallback(socket_t *sock);
+static void OpenLine(ddcmp_circuit_t *ddcmpCircuit);
+static void OpenDatagramLine(line_t *line);
 static ddcmp_circuit_t *FindCircuit(socket_t *sock);
 static ddcmp_circuit_t *GetDdcmpCircuitFromCircuit(circuit_t *circuit);
 static line_t *GetLineFromDdcmpCircuit(ddcmp_circuit_t *ddcmpCircuit);
@@ -256,8 +258,9 @@ int DdcmpInitLayerStart(circuit_t circuits[], int circuitCount)
 
             line->LineNotifyStateChange = HandleLineNotifyStateChange;
 
-            ans &= circuit->Start(circuit); // TODO: should start lines, when lines open then should open circuit.
            	sockContext = (ddcmp_sock_t *)line->lineContext; // TODO: Why does the init layer know about ddcmp_sock at all? This is badly layered.
+            sockContext->NotifyOpen = OpenDatagramLine; /* nothing to connect for UDP, the line is open as soon as its socket is */
+            ans &= circuit->Start(circuit); // TODO: should start lines, when lines open then should open circuit.
             sockContext->line.NotifyRunning = DdcmpInitNotifyRunning; // TODO: this looks like it needs to be rationalised, ie line within a line.
             sockContext->line.NotifyHalt = DdcmpInitNotifyHalt;
 		    ddcmpCircuits[ddcmpCircuitCount++] = &circuits[i];
@@ -355,6 +358,7 @@ void DdcmpInitProcessInitializationMessage(circuit_t *circuit, initialization_ms
 	if (valid)
 	{
 		memcpy( &circuit->adjacentNode, &from, sizeof(decnet_address_t)); 
+		DdcmpSetBlockSize(&GetDdcmpSockFromDdcmpCircuit(ddcmpCircuit)->line, msg->blksize);
 	}
 
     at = GetAdjacencyType(msg->tiinfo);
@@ -473,7 +477,7 @@ static socket_t * TcpAcceptCallback(sockaddr_t *receivedFrom)
 
 		sockaddr_in_t *destinationAddressIn = (sockaddr_in_t *)&ddcmpSock->destinationAddress;
 
-		if (memcmp(&receivedFromIn->sin_addr, &destinationAddressIn->sin_addr, sizeof(struct in_addr)) == 0)
+		if (GetLineFromDdcmpCircuit(ddcmpCircuit)->lineType == DDCMPSockLineType && memcmp(&receivedFromIn->sin_addr, &destinationAddressIn->sin_addr, sizeof(struct in_addr)) == 0)
 		{
 		    ans = &ddcmpSock->socket;
 			break;
@@ -490,10 +494,7 @@ static void TcpConnectCallback(socket_t *sock)
     {
         line_t *line = GetLineFromDdcmpCircuit(ddcmpCircuit);
         line->waitHandle = sock->waitHandle;
-        Log(LogDdcmpInit, LogDetail, "DDCMP line %s has been opened\n", ddcmpCircuit->circuit->name);
-        line->LineOpen(line);
-        RegisterEventHandler(line->waitHandle, "DDCMP Circuit", line, line->LineWaitEventHandler);
-        ProcessEvent(ddcmpCircuit, DdcmpInitOPOEvent);
+        OpenLine(ddcmpCircuit);
 	}
     else
     {
@@ -514,6 +515,20 @@ static void TcpDisconnectCallback(socket_t *sock)
     }
 }
 
+static void OpenLine(ddcmp_circuit_t *ddcmpCircuit)
+{
+    line_t *line = GetLineFromDdcmpCircuit(ddcmpCircuit);
+    Log(LogDdcmpInit, LogDetail, "DDCMP line %s has been opened\n", ddcmpCircuit->circuit->name);
+    line->LineOpen(line);
+    RegisterEventHandler(line->waitHandle, "DDCMP Circuit", line, line->LineWaitEventHandler);
+    ProcessEvent(ddcmpCircuit, DdcmpInitOPOEvent);
+}
+
+static void OpenDatagramLine(line_t *line)
+{
+    OpenLine(GetDdcmpCircuitForLine(line));
+}
+
 static ddcmp_circuit_t *FindCircuit(socket_t *sock)
 {
     ddcmp_circuit_t * ans = NULL;
@@ -625,7 +640,7 @@ static void HandleRecallTimer(rtimer_t *timer, char *name, void *context)
 
 static int IssueReinitializeCommandAndStartRecallTimerAction(circuit_t *circuit)
 {
-	time_t now;
+	clock_ms_t now;
     ddcmp_circuit_t *ddcmpCircuit = GetDdcmpCircuitFromCircuit(circuit);
     ddcmp_sock_t *ddcmpSock = GetDdcmpSockFromDdcmpCircuit(ddcmpCircuit);
 
@@ -634,8 +649,8 @@ static int IssueReinitializeCommandAndStartRecallTimerAction(circuit_t *circuit)
 		Log(LogDdcmpInit, LogDetail, "Starting DDCMP line %s\n", ddcmpCircuit->circuit->name);
 		DdcmpStart(&ddcmpSock->line);
 
-		time(&now);
-		ddcmpCircuit->recallTimer = CreateTimer("Recall timer", now + RECALL_TIMER, 0, ddcmpCircuit, HandleRecallTimer);
+		now = ClockNow();
+		ddcmpCircuit->recallTimer = CreateTimer("Recall timer", now + SECS_TO_MS(RECALL_TIMER), 0, ddcmpCircuit, HandleRecallTimer);
 	}
 	else
 	{
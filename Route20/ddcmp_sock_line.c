@@ -51,11 +51,23 @@ static void StopConnectPollTimer(ddcmp_sock_t *ddcmpSock);
 static void ProcessConnectPollTimer(rtimer_t *timer, char *name, void *context);
 static int  CheckSourceAddress(sockaddr_t *receivedFrom, ddcmp_sock_t *context);
 static void DdcmpTimerHandler(rtimer_t *timer, char *name, void *context);
-static void *DdcmpCreateOneShotTimer(void *timerContext, char *name, int seconds, void (*timerHandler)(void *timerContext));
+static void *DdcmpCreateOneShotTimer(void *timerContext, char *name, int milliseconds, void (*timerHandler)(void *timerContext));
 static void DdcmpCancelOneShotTimer(void *timerHandle);
 static void DdcmpSendData(void *context, byte *data, int length);
+static void FlushOutput(void *context);
+static void ConsumeOutput(ddcmp_sock_t *sockContext, int written);
+static void DiscardOutput(ddcmp_sock_t *sockContext);
+static void ReleaseConnectionBuffers(ddcmp_sock_t *sockContext);
+static void ResizeMessageQueue(ddcmp_sock_message_t **queue, int *size, int *head, int newSize);
+static void FreeMessageQueue(ddcmp_sock_message_t **queue, int *size);
+static void GrowReceiveQueue(ddcmp_sock_t *sockContext);
 static int  DdcmpNotifyDataMessage(void *context, byte *data, int length);
 static void DdcmpLog(LogLevel level, char *format, ...);
+static int  PrepareLine(line_t *line);
+static packet_t *NextReceivedPacket(line_t *line);
+static void DdcmpUdpSendData(void *context, byte *data, int length);
+static int  OpenDatagramSocket(line_t *line);
+static void NotifyDatagramLineOpen(void *context);
 
 int DdcmpSockLineStart(line_t *line)
 {
@@ -65,44 +77,12 @@ int DdcmpSockLineStart(line_t *line)
 
 	int ans = 1;
 	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
-	sockaddr_t *destinationAddress;
 
     Log(LogDdcmpSock, LogDetail, "Starting DDCMP socket line %s\n", sockContext->destinationHostName);
 
-	sockContext->bufferLength = 0;
-	sockContext->bufferInUse = 0;
-
-	memset(&sockContext->line, 0, sizeof(sockContext->line));
-	sockContext->line.context = line;
-    sockContext->line.name = sockContext->destinationHostName;
-	sockContext->line.CreateOneShotTimer = DdcmpCreateOneShotTimer;
-	sockContext->line.CancelOneShotTimer = DdcmpCancelOneShotTimer;
-	sockContext->line.SendData = DdcmpSendData;
-	sockContext->line.NotifyDataMessage = DdcmpNotifyDataMessage;
-	sockContext->line.Log = DdcmpLog;
-
-    InitialiseSocket(&sockContext->socket, line->name);
-
-	destinationAddress = GetSocketAddressFromName(sockContext->destinationHostName, sockContext->destinationPort);
-	if (destinationAddress != NULL)
-	{
-		memcpy(&sockContext->destinationAddress, destinationAddress, sizeof(sockContext->destinationAddress));
-        if (IsActiveOutbound(sockContext))
-        {
-            StartConnectPollTimer(sockContext);
-        }
-	}
-	else
-	{
-		Log(LogDdcmpSock, LogError, "Cannot resolve address for %s, line will not start until DNS can resolve the address.\n", sockContext->destinationHostName);
-	}
-
-	if (DnsConfig.dnsConfigured)
+	if (PrepareLine(line) && IsActiveOutbound(sockContext))
 	{
-		time_t now;
-
-		time(&now);
-		CreateTimer("DNS", now + DnsConfig.pollPeriod, DnsConfig.pollPeriod, line, ProcessDnsTimer);
+		StartConnectPollTimer(sockContext);
 	}
 
     if (!ans)
@@ -122,6 +102,33 @@ int DdcmpSockLineOpen(line_t *line)
         StopConnectPollTimer(sockContext);
     }
 
+	DiscardOutput(sockContext);
+	sockContext->cork = 0;
+	switch (sockContext->options.tcpPolicy)
+	{
+	case DdcmpTcpNagle:
+		{
+			SetTcpNoDelay(&sockContext->socket, 0);
+			break;
+		}
+	case DdcmpTcpCork:
+		{
+			/* corked only while a flush is writing, Nagle is off so that uncorking sends the last partial segment at once */
+			SetTcpNoDelay(&sockContext->socket, 1);
+			sockContext->cork = SetTcpCork(&sockContext->socket, 0);
+			if (!sockContext->cork)
+			{
+				Log(LogDdcmpSock, LogWarning, "TCP_CORK is not available for %s, turning off Nagle instead\n", sockContext->destinationHostName);
+			}
+			break;
+		}
+	default:
+		{
+			SetTcpNoDelay(&sockContext->socket, 1);
+			break;
+		}
+	}
+
     return 1;
 }
 
@@ -129,6 +136,7 @@ void DdcmpSockLineClosed(line_t *line)
 {
 	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
     Log(LogDdcmpSock, LogDetail, "DDCMP socket line %s is closed\n", sockContext->destinationHostName);
+	ReleaseConnectionBuffers(sockContext);
     if (IsActiveOutbound(sockContext))
     {
         StartConnectPollTimer(sockContext);
@@ -138,40 +146,31 @@ void DdcmpSockLineClosed(line_t *line)
 void DdcmpSockLineStop(line_t *line)
 {
 	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+	ReleaseConnectionBuffers(sockContext);
 	CloseSocket(&sockContext->socket);
     Log(LogDdcmpSock, LogDetail, "DDCMP socket line %s is stopped\n", sockContext->destinationHostName);
 }
 
 packet_t *DdcmpSockLineReadPacket(line_t *line)
 {
-	static packet_t sockPacket;
 	byte buffer[MAX_DDCMP_BUFFER_LENGTH];
 	int bufferLength;
 	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
-	packet_t *packet = NULL;
-
-	bufferLength = ReadFromStreamSocket(&sockContext->socket, buffer, MAX_DDCMP_BUFFER_LENGTH);
 
-	if (bufferLength > 0)
+	/* Only go back to the socket once every message framed from the previous read has been delivered */
+	if (sockContext->receiveQueueCount == 0)
 	{
-		Log(LogDdcmpSock, LogDetail, "Read %d bytes from DDCMP socket %s\n", bufferLength, sockContext->destinationHostName);
-		LogBytes(LogDdcmpSock, LogVerbose, buffer, bufferLength);
-		DdcmpProcessReceivedData(&sockContext->line, buffer, bufferLength);
+		bufferLength = ReadFromStreamSocket(&sockContext->socket, buffer, MAX_DDCMP_BUFFER_LENGTH);
 
-		if (sockContext->bufferInUse)
+		if (bufferLength > 0)
 		{
-			sockPacket.rawData = sockContext->buffer;
-			sockPacket.rawLen = sockContext->bufferLength;
-			sockPacket.payload = sockContext->buffer;
-			sockPacket.payloadLen = sockContext->bufferLength;
-			sockPacket.IsDecnet = DdcmpSockIsDecnet;
-			packet = &sockPacket;
-			sockContext->bufferInUse = 0;
-            line->stats.validPacketsReceived++;
-        }
+			Log(LogDdcmpSock, LogDetail, "Read %d bytes from DDCMP socket %s\n", bufferLength, sockContext->destinationHostName);
+			LogBytes(LogDdcmpSock, LogVerbose, buffer, bufferLength);
+			DdcmpProcessReceivedData(&sockContext->line, buffer, bufferLength);
+		}
 	}
 
-	return packet;
+	return NextReceivedPacket(line);
 }
 
 int DdcmpSockLineWritePacket(line_t *line, packet_t *packet)
@@ -186,6 +185,89 @@ int DdcmpSockLineWritePacket(line_t *line, packet_t *packet)
 	return ans;
 }
 
+int DdcmpUdpLineStart(line_t *line)
+{
+	/* There is no connection to wait for, the socket is opened as soon as the peer address is known and the init layer
+	   then opens the line. Datagrams are only accepted from the configured address and port. If the address cannot be
+	   resolved yet the socket is opened when DNS resolves it. */
+
+	int ans = 1;
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+
+    Log(LogDdcmpSock, LogDetail, "Starting DDCMP UDP line %s, local port %d\n", sockContext->destinationHostName, sockContext->options.udpPort);
+
+	sockContext->waitingForAddress = !PrepareLine(line);
+	sockContext->line.SendData = DdcmpUdpSendData;
+
+	if (!sockContext->waitingForAddress)
+	{
+		ans = OpenDatagramSocket(line);
+	}
+
+	return ans;
+}
+
+int DdcmpUdpLineOpen(line_t *line)
+{
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+    Log(LogDdcmpSock, LogDetail, "DDCMP UDP line %s is open\n", sockContext->destinationHostName);
+
+    return 1;
+}
+
+void DdcmpUdpLineClosed(line_t *line)
+{
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+    Log(LogDdcmpSock, LogDetail, "DDCMP UDP line %s is closed\n", sockContext->destinationHostName);
+	ReleaseConnectionBuffers(sockContext);
+}
+
+void DdcmpUdpLineStop(line_t *line)
+{
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+	ReleaseConnectionBuffers(sockContext);
+	sockContext->waitingForAddress = 0;
+
+	/* the socket may never have opened, or been stopped before the init layer registered the line's event handler */
+	if (sockContext->datagramLineOpen)
+	{
+		sockContext->datagramLineOpen = 0;
+		DeregisterEventHandler(line->waitHandle);
+	}
+
+	if (sockContext->socket.socket != INVALID_SOCKET)
+	{
+		CloseSocket(&sockContext->socket);
+	}
+
+    Log(LogDdcmpSock, LogDetail, "DDCMP UDP line %s is stopped\n", sockContext->destinationHostName);
+}
+
+packet_t *DdcmpUdpLineReadPacket(line_t *line)
+{
+	packet_t datagram;
+	sockaddr_t receivedFrom;
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+
+	/* Each datagram is one DDCMP message, keep reading until one yields data for the circuit or the socket is empty */
+	while (sockContext->receiveQueueCount == 0 && ReadFromDatagramSocket(&sockContext->socket, &datagram, &receivedFrom))
+	{
+		if (CheckSourceAddress(&receivedFrom, sockContext))
+		{
+			Log(LogDdcmpSock, LogDetail, "Read %d byte datagram from DDCMP UDP line %s\n", datagram.rawLen, sockContext->destinationHostName);
+			LogBytes(LogDdcmpSock, LogVerbose, datagram.rawData, datagram.rawLen);
+			DdcmpProcessReceivedMessage(&sockContext->line, datagram.rawData, datagram.rawLen);
+		}
+		else
+		{
+			Log(LogDdcmpSock, LogWarning, "Dropping datagram from unrecognised source for DDCMP UDP line %s\n", sockContext->destinationHostName);
+			line->stats.invalidPacketsReceived++;
+		}
+	}
+
+	return NextReceivedPacket(line);
+}
+
 static void ProcessDnsTimer(rtimer_t *timer, char *name, void *context)
 {
 	line_t *line = (line_t *)context;
@@ -198,13 +280,20 @@ static void ProcessDnsResponse(byte *address, void *context)
 {
 	line_t *line = (line_t *)context;
 	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
-	sockaddr_t *newAddress = GetSocketAddressFromIpAddress(address, 0);
+	sockaddr_t *newAddress = GetSocketAddressFromIpAddress(address, sockContext->destinationPort);
 
 	if (memcmp(&sockContext->destinationAddress, newAddress, sizeof(sockaddr_t)) != 0)
 	{
 	    Log(LogDdcmpSock, LogInfo, "Changed IP address for %s\n", line->name);
 	    memcpy(&sockContext->destinationAddress, newAddress, sizeof(sockContext->destinationAddress));
 	}
+
+	if (sockContext->waitingForAddress)
+	{
+		/* a UDP line whose address could not be resolved when it started */
+		sockContext->waitingForAddress = 0;
+		OpenDatagramSocket(line);
+	}
 }
 
 static int  IsActiveOutbound(ddcmp_sock_t *ddcmpSock)
@@ -214,23 +303,23 @@ static int  IsActiveOutbound(ddcmp_sock_t *ddcmpSock)
 
 static void StartConnectPollTimer(ddcmp_sock_t *ddcmpSock)
 {
-    time_t now;
-    time_t nextPollTime;
+    clock_ms_t now;
+    clock_ms_t nextPollTime;
 
     Log(LogDdcmpSock, LogVerbose, "Starting connect poll timer for %s\n", ddcmpSock->destinationHostName);
 
-    time(&now);
-    if (difftime(now, ddcmpSock->lastConnectAttempt) > ddcmpSock->connectPoll)
+    now = ClockNow();
+    if (now - ddcmpSock->lastConnectAttempt > SECS_TO_MS(ddcmpSock->connectPoll))
     {
         nextPollTime = now;
     }
     else
     {
-        nextPollTime = ddcmpSock->lastConnectAttempt + ddcmpSock->connectPoll;
+        nextPollTime = ddcmpSock->lastConnectAttempt + SECS_TO_MS(ddcmpSock->connectPoll);
     }
 
-    ddcmpSock->connectPollTimer = CreateTimer(ddcmpSock->destinationHostName, nextPollTime, ddcmpSock->connectPoll, ddcmpSock, ProcessConnectPollTimer);
-    Log(LogDdcmpSock, LogVerbose, "Handle for connect poll timer is %u, now is %llu, next poll %llu, interval %d\n", ddcmpSock->connectPollTimer, now, nextPollTime, ddcmpSock->connectPoll);
+    ddcmpSock->connectPollTimer = CreateTimer(ddcmpSock->destinationHostName, nextPollTime, SECS_TO_MS(ddcmpSock->connectPoll), ddcmpSock, ProcessConnectPollTimer);
+    Log(LogDdcmpSock, LogVerbose, "Handle for connect poll timer is %u, next poll in %d ms, interval %d\n", ddcmpSock->connectPollTimer, (int)(nextPollTime - now), ddcmpSock->connectPoll);
 }
 
 static void StopConnectPollTimer(ddcmp_sock_t *ddcmpSock)
@@ -244,7 +333,7 @@ static void ProcessConnectPollTimer(rtimer_t *timer, char *name, void *context)
 {
     ddcmp_sock_t *ddcmpSock = (ddcmp_sock_t *)context;
     Log(LogDdcmpSock, LogVerbose, "Processing connect poll timer %u for %s\n", ddcmpSock->connectPollTimer, ddcmpSock->destinationHostName);
-    time(&ddcmpSock->lastConnectAttempt);
+    ddcmpSock->lastConnectAttempt = ClockNow();
     OpenTcpSocketOutbound(&ddcmpSock->socket, &ddcmpSock->destinationAddress);
 }
 
@@ -270,18 +359,18 @@ static void DdcmpTimerHandler(rtimer_t *timer, char *name, void *context)
 	free(sockTimerContext);
 }
 
-static void *DdcmpCreateOneShotTimer(void *timerContext, char *name, int seconds, void (*timerHandler)(void *timerContext))
+static void *DdcmpCreateOneShotTimer(void *timerContext, char *name, int milliseconds, void (*timerHandler)(void *timerContext))
 {
     ddcmp_sock_timer_t *sockTimerContext;
-    time_t now;
+    clock_ms_t now;
 	
-	time(&now);
+	now = ClockNow();
 
 	sockTimerContext = (ddcmp_sock_timer_t *)malloc(sizeof(ddcmp_sock_timer_t));
 	sockTimerContext->timerContext = timerContext;
 	sockTimerContext->timerHandler = timerHandler;
 
-	sockTimerContext->timer = CreateTimer(name, now + seconds, 0, sockTimerContext, DdcmpTimerHandler);
+	sockTimerContext->timer = CreateTimer(name, now + milliseconds, 0, sockTimerContext, DdcmpTimerHandler);
 
 	return (void *)sockTimerContext;
 }
@@ -297,7 +386,201 @@ static void DdcmpSendData(void *context, byte *data, int length)
 {
     line_t *line = (line_t *)context;
 	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
-	WriteToStreamSocket(&sockContext->socket, data, length);
+	ddcmp_sock_message_t *frame;
+
+	if (sockContext->outputQueueCount >= sockContext->outputQueueSize)
+	{
+		int newSize = (sockContext->outputQueueSize > 0) ? 2 * sockContext->outputQueueSize : DDCMP_SOCK_OUTPUT_QUEUE_LEN;
+		ResizeMessageQueue(&sockContext->outputQueue, &sockContext->outputQueueSize, &sockContext->outputQueueHead, newSize);
+	}
+
+	/* messages, ACKs and NAKs sent during one pass of the event loop go out in a single write */
+	frame = &sockContext->outputQueue[(sockContext->outputQueueHead + sockContext->outputQueueCount) % sockContext->outputQueueSize];
+	if (frame->size < length)
+	{
+		free(frame->data);
+		frame->data = (byte *)malloc(length);
+		frame->size = length;
+	}
+
+	memcpy(frame->data, data, length);
+	frame->length = length;
+	sockContext->outputQueueCount++;
+	sockContext->outputLength += length;
+
+	if (!sockContext->outputWaitingForWrite)
+	{
+		if (sockContext->outputLength >= DDCMP_SOCK_OUTPUT_FLUSH_LEN)
+		{
+			FlushOutput(line);
+		}
+		else if (!sockContext->outputFlushQueued)
+		{
+			sockContext->outputFlushQueued = 1;
+			QueueImmediate(line, FlushOutput);
+		}
+	}
+}
+
+/* Also the write handler while the socket buffer is full */
+static void FlushOutput(void *context)
+{
+    line_t *line = (line_t *)context;
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+	stream_buffer_t buffers[STREAM_WRITE_MAX_BUFFERS];
+	int count;
+	int offered;
+	int written;
+	int more = 1;
+	int corked = sockContext->cork && sockContext->outputQueueCount > 0;
+	int i;
+
+	sockContext->outputFlushQueued = 0;
+	if (corked)
+	{
+		SetTcpCork(&sockContext->socket, 1);
+	}
+
+	/* carry on while the socket takes everything offered, there are only more writes if the queue is longer than one write can gather */
+	while (more && sockContext->outputQueueCount > 0)
+	{
+		count = (sockContext->outputQueueCount < STREAM_WRITE_MAX_BUFFERS) ? sockContext->outputQueueCount : STREAM_WRITE_MAX_BUFFERS;
+		offered = 0;
+		for (i = 0; i < count; i++)
+		{
+			ddcmp_sock_message_t *frame = &sockContext->outputQueue[(sockContext->outputQueueHead + i) % sockContext->outputQueueSize];
+			buffers[i].data = frame->data;
+			buffers[i].length = frame->length;
+			offered += frame->length;
+		}
+
+		buffers[0].data += sockContext->outputOffset;
+		buffers[0].length -= sockContext->outputOffset;
+		offered -= sockContext->outputOffset;
+
+		written = WriteBuffersToStreamSocketNonBlocking(&sockContext->socket, buffers, count);
+		if (written < 0)
+		{
+			DiscardOutput(sockContext);
+			more = 0;
+		}
+		else
+		{
+			ConsumeOutput(sockContext, written);
+			more = written == offered;
+		}
+	}
+
+	if (corked)
+	{
+		SetTcpCork(&sockContext->socket, 0);
+	}
+
+	if (sockContext->outputQueueCount > 0 && !sockContext->outputWaitingForWrite)
+	{
+		/* The socket buffer is full, write the rest when it has room again rather than block the event loop */
+		sockContext->outputWaitingForWrite = 1;
+		RegisterWriteHandler(sockContext->socket.waitHandle, line, FlushOutput);
+	}
+	else if (sockContext->outputQueueCount == 0 && sockContext->outputWaitingForWrite)
+	{
+		sockContext->outputWaitingForWrite = 0;
+		DeregisterWriteHandler(sockContext->socket.waitHandle);
+	}
+}
+
+/* Removes written bytes from the front of the output queue, the write may have ended part way through a frame */
+static void ConsumeOutput(ddcmp_sock_t *sockContext, int written)
+{
+	int remaining = sockContext->outputOffset + written;
+
+	while (sockContext->outputQueueCount > 0 && remaining >= sockContext->outputQueue[sockContext->outputQueueHead].length)
+	{
+		remaining -= sockContext->outputQueue[sockContext->outputQueueHead].length;
+		sockContext->outputQueueHead = (sockContext->outputQueueHead + 1) % sockContext->outputQueueSize;
+		sockContext->outputQueueCount--;
+	}
+
+	sockContext->outputOffset = remaining;
+	sockContext->outputLength -= written;
+}
+
+static void DiscardOutput(ddcmp_sock_t *sockContext)
+{
+	sockContext->outputQueueHead = 0;
+	sockContext->outputQueueCount = 0;
+	sockContext->outputOffset = 0;
+	sockContext->outputLength = 0;
+	if (sockContext->outputWaitingForWrite)
+	{
+		sockContext->outputWaitingForWrite = 0;
+		DeregisterWriteHandler(sockContext->socket.waitHandle);
+	}
+}
+
+/* Frees the buffers that are only needed while the peer is connected, so an idle line costs next to nothing */
+static void ReleaseConnectionBuffers(ddcmp_sock_t *sockContext)
+{
+	DiscardOutput(sockContext);
+	FreeMessageQueue(&sockContext->outputQueue, &sockContext->outputQueueSize);
+	FreeMessageQueue(&sockContext->receiveQueue, &sockContext->receiveQueueSize);
+	sockContext->receiveQueueHead = 0;
+	sockContext->receiveQueueCount = 0;
+}
+
+/* Moves the queue into one of newSize entries, keeping the order of the messages and starting from its first entry */
+static void ResizeMessageQueue(ddcmp_sock_message_t **queue, int *size, int *head, int newSize)
+{
+	int i;
+	ddcmp_sock_message_t *newQueue = (ddcmp_sock_message_t *)calloc(newSize, sizeof(ddcmp_sock_message_t));
+
+	/* the buffers of the free entries move across too, so that they are reused rather than leaked */
+	for (i = 0; i < *size; i++)
+	{
+		newQueue[i] = (*queue)[(*head + i) % *size];
+	}
+
+	free(*queue);
+	*queue = newQueue;
+	*size = newSize;
+	*head = 0;
+}
+
+static void FreeMessageQueue(ddcmp_sock_message_t **queue, int *size)
+{
+	int i;
+
+	if (*queue != NULL)
+	{
+		for (i = 0; i < *size; i++)
+		{
+			free((*queue)[i].data);
+		}
+
+		free(*queue);
+		*queue = NULL;
+	}
+
+	*size = 0;
+}
+
+/* The queue starts out the size of the transmit window and doubles whenever a read frames more messages than it
+   holds, which happens when the peer uses a larger window. The peer cannot have more than DDCMP_MAX_WINDOW messages
+   unacknowledged, so that is the most a single read can carry and the queue never needs to grow beyond it. */
+static void GrowReceiveQueue(ddcmp_sock_t *sockContext)
+{
+	int newSize = (sockContext->receiveQueueSize > 0) ? 2 * sockContext->receiveQueueSize : sockContext->line.options.windowSize;
+
+	if (newSize > DDCMP_MAX_WINDOW)
+	{
+		newSize = DDCMP_MAX_WINDOW;
+	}
+
+	if (newSize > sockContext->receiveQueueSize)
+	{
+		ResizeMessageQueue(&sockContext->receiveQueue, &sockContext->receiveQueueSize, &sockContext->receiveQueueHead, newSize);
+		Log(LogDdcmpSock, LogDetail, "Receive queue for %s grown to %d messages\n", sockContext->destinationHostName, newSize);
+	}
 }
 
 static int DdcmpNotifyDataMessage(void *context, byte *data, int length)
@@ -305,21 +588,148 @@ static int DdcmpNotifyDataMessage(void *context, byte *data, int length)
     line_t *line = (line_t *)context;
 	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
 	int ans = 0;
-	if (sockContext->bufferInUse)
+
+	if (sockContext->receiveQueueCount >= sockContext->receiveQueueSize)
+	{
+		GrowReceiveQueue(sockContext);
+	}
+
+	if (sockContext->receiveQueueCount >= sockContext->receiveQueueSize)
 	{
-		Log(LogDdcmpSock, LogError, "DDCMP overrun, previous message not read before next one delivered for line %s\n", line->name);
+		Log(LogDdcmpSock, LogError, "DDCMP overrun, receive queue full for line %s\n", line->name);
 	}
 	else
 	{
-		sockContext->bufferLength = (length <= MAX_DDCMP_DATA_LENGTH) ? length : MAX_DDCMP_DATA_LENGTH;
-		memcpy(sockContext->buffer, data, sockContext->bufferLength);
-		sockContext->bufferInUse = 1;
+		ddcmp_sock_message_t *message = &sockContext->receiveQueue[(sockContext->receiveQueueHead + sockContext->receiveQueueCount) % sockContext->receiveQueueSize];
+		message->length = (length <= MAX_DDCMP_DATA_LENGTH) ? length : MAX_DDCMP_DATA_LENGTH;
+		if (message->size < message->length)
+		{
+			free(message->data);
+			message->data = (byte *)malloc(message->length);
+			message->size = message->length;
+		}
+
+		memcpy(message->data, data, message->length);
+		sockContext->receiveQueueCount++;
 		ans = 1;
 	}
 
 	return ans;
 }
 
+/* Sets up the DDCMP protocol line and the peer address, common to TCP and UDP. Returns false if the peer
+   address cannot be resolved yet, in which case the DNS timer will fill it in later. */
+static int PrepareLine(line_t *line)
+{
+	int ans = 0;
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+	sockaddr_t *destinationAddress;
+
+	ReleaseConnectionBuffers(sockContext);
+
+	memset(&sockContext->line, 0, sizeof(sockContext->line));
+	sockContext->line.context = line;
+    sockContext->line.name = sockContext->destinationHostName;
+	sockContext->line.CreateOneShotTimer = DdcmpCreateOneShotTimer;
+	sockContext->line.CancelOneShotTimer = DdcmpCancelOneShotTimer;
+	sockContext->line.Now = ClockNow;
+	sockContext->line.SendData = DdcmpSendData;
+	sockContext->line.NotifyDataMessage = DdcmpNotifyDataMessage;
+	sockContext->line.Log = DdcmpLog;
+	sockContext->line.options = sockContext->options;
+
+    InitialiseSocket(&sockContext->socket, line->name);
+
+	destinationAddress = GetSocketAddressFromName(sockContext->destinationHostName, sockContext->destinationPort);
+	if (destinationAddress != NULL)
+	{
+		memcpy(&sockContext->destinationAddress, destinationAddress, sizeof(sockContext->destinationAddress));
+		ans = 1;
+	}
+	else
+	{
+		Log(LogDdcmpSock, LogError, "Cannot resolve address for %s, line will not start until DNS can resolve the address.\n", sockContext->destinationHostName);
+	}
+
+	if (DnsConfig.dnsConfigured)
+	{
+		clock_ms_t now;
+
+		now = ClockNow();
+		CreateTimer("DNS", now + SECS_TO_MS(DnsConfig.pollPeriod), SECS_TO_MS(DnsConfig.pollPeriod), line, ProcessDnsTimer);
+	}
+
+	return ans;
+}
+
+/* Hands out the next data message framed from the socket, NULL if there are none */
+static packet_t *NextReceivedPacket(line_t *line)
+{
+	static packet_t sockPacket;
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+	packet_t *packet = NULL;
+
+	if (sockContext->receiveQueueCount > 0)
+	{
+		ddcmp_sock_message_t *message = &sockContext->receiveQueue[sockContext->receiveQueueHead];
+		sockPacket.rawData = message->data;
+		sockPacket.rawLen = message->length;
+		sockPacket.payload = message->data;
+		sockPacket.payloadLen = message->length;
+		sockPacket.IsDecnet = DdcmpSockIsDecnet;
+		packet = &sockPacket;
+		sockContext->receiveQueueHead = (sockContext->receiveQueueHead + 1) % sockContext->receiveQueueSize;
+		sockContext->receiveQueueCount--;
+		line->stats.validPacketsReceived++;
+	}
+
+	return packet;
+}
+
+/* No coalescing here, every DDCMP message goes in a datagram of its own so that a lost datagram costs only that message */
+static void DdcmpUdpSendData(void *context, byte *data, int length)
+{
+    line_t *line = (line_t *)context;
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+	packet_t packet;
+
+	packet.rawData = data;
+	packet.rawLen = length;
+	SendToSocket(&sockContext->socket, &sockContext->destinationAddress, &packet);
+}
+
+static int OpenDatagramSocket(line_t *line)
+{
+	int ans;
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+
+	ans = OpenUdpSocket(&sockContext->socket, sockContext->options.udpPort);
+	if (ans)
+	{
+		line->waitHandle = sockContext->socket.waitHandle;
+		QueueImmediate(line, NotifyDatagramLineOpen);
+	}
+	else
+	{
+		Log(LogDdcmpSock, LogError, "Could not open UDP port %d for %s\n", sockContext->options.udpPort, sockContext->destinationHostName);
+	}
+
+	return ans;
+}
+
+static void NotifyDatagramLineOpen(void *context)
+{
+    line_t *line = (line_t *)context;
+	ddcmp_sock_t *sockContext = (ddcmp_sock_t *)line->lineContext;
+
+	/* the line may have been stopped since the socket opened */
+	if (sockContext->NotifyOpen != NULL && sockContext->socket.socket != INVALID_SOCKET)
+	{
+		sockContext->datagramLineOpen = 1;
+		sockContext->NotifyOpen(line);
+	}
+}
+
 static void DdcmpLog(LogLevel level, char *format, ...)
 {
 	va_list va;
@@ -27,12 +27,25 @@
   ------------------------------------------------------------------------------*/
 
 #include "packet.h"
+#include "clock.h"
 #include "socket.h"
 #include "ddcmp.h"
 #include "ddcmp_circuit.h"
 
 #if !defined(DDCMP_SOCK_LINE_H)
 
+/* Messages sent during one pass of the event loop are queued as separate frames and written together with one
+   gathered write. The queue doubles as needed, anything the socket does not take waits until it is writable. */
+#define DDCMP_SOCK_OUTPUT_QUEUE_LEN 64
+#define DDCMP_SOCK_OUTPUT_FLUSH_LEN 65536 /* write straight away once this much is waiting */
+
+typedef struct
+{
+	int length;
+	int size;
+	byte *data; /* grown to the longest message it has held */
+} ddcmp_sock_message_t;
+
 typedef struct
 {
 	socket_t socket;
@@ -40,12 +53,26 @@ typedef struct
 	uint16 destinationPort;
 	sockaddr_t destinationAddress;
 	ddcmp_line_t line;
-	byte buffer[MAX_DDCMP_DATA_LENGTH];
-	int bufferLength;
-	int bufferInUse;
+	ddcmp_options_t options;
+	ddcmp_sock_message_t *receiveQueue; /* data messages framed from one socket read, allocated while the line is connected */
+	int receiveQueueSize;
+	int receiveQueueHead;
+	int receiveQueueCount;
+	ddcmp_sock_message_t *outputQueue; /* frames waiting to be written, allocated while the line is connected */
+	int outputQueueSize;
+	int outputQueueHead;
+	int outputQueueCount;
+	int outputOffset; /* bytes of the frame at the head of the queue already written */
+	int outputLength; /* bytes waiting to be written */
+	int outputFlushQueued;
+	int outputWaitingForWrite; /* the socket buffer is full and a write handler is registered */
+	int cork; /* TcpMode is Cork and TCP_CORK is available, the socket is corked while FlushOutput writes */
     int connectPoll;
     rtimer_t *connectPollTimer;
-    time_t lastConnectAttempt;
+    clock_ms_t lastConnectAttempt;
+	int waitingForAddress; /* UDP only, the socket is not opened until DNS resolves the peer address */
+	void (*NotifyOpen)(line_t *line); /* UDP only, set by the init layer and called once the socket is open */
+	int datagramLineOpen; /* UDP only, NotifyOpen has been called and the init layer has registered the line's event handler */
 } ddcmp_sock_t;
 
 int DdcmpSockLineStart(line_t *line);
@@ -55,5 +82,12 @@ void DdcmpSockLineStop(line_t *line);
 packet_t *DdcmpSockLineReadPacket(line_t *line);
 int DdcmpSockLineWritePacket(line_t *line, packet_t *packet);
 
+/* The same line carried over UDP, one DDCMP message per datagram. It writes with DdcmpSockLineWritePacket. */
+int DdcmpUdpLineStart(line_t *line);
+int DdcmpUdpLineOpen(line_t *line);
+void DdcmpUdpLineClosed(line_t *line);
+void DdcmpUdpLineStop(line_t *line);
+packet_t *DdcmpUdpLineReadPacket(line_t *line);
+
 #define DDCMP_SOCK_LINE_H
 #endif
@@ -61,7 +61,7 @@ static void Check(char *detail);
 
 void InitialiseDecisionProcess(void)
 {
-	time_t now;
+	clock_ms_t now;
 	InitRoutingDatabase();
 	InitAreaForwardingDatabase();
 	if (nodeInfo.level == 2)
@@ -76,10 +76,10 @@ void InitialiseDecisionProcess(void)
 		ARoutes(1, NA);
 	}
 
-	time(&now);
-	CreateTimer("T1 Timer", now + T1, T1, NULL, T1TimerProcess);
-	CreateTimer("BCT1 Timer", now + BCT1, BCT1, NULL, BCT1TimerProcess);
-	//CreateTimer("Dump Timer", now + 60, 600, NULL, DumpTimer);
+	now = ClockNow();
+	CreateTimer("T1 Timer", now + SECS_TO_MS(T1), SECS_TO_MS(T1), NULL, T1TimerProcess);
+	CreateTimer("BCT1 Timer", now + SECS_TO_MS(BCT1), SECS_TO_MS(BCT1), NULL, BCT1TimerProcess);
+	//CreateTimer("Dump Timer", now + SECS_TO_MS(60), SECS_TO_MS(600), NULL, DumpTimer);
 }
 
 void ProcessAdjacencyStateChange(adjacency_t *adjacency)
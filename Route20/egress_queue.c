@@ -0,0 +1,214 @@
+/* egress_queue.c: Circuit egress queue
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+
+#include <stdlib.h>
+#include <memory.h>
+#include "egress_queue.h"
+
+static void RefillTokens(egress_queue_t *queue);
+
+void InitialiseEgressQueue(egress_queue_t *queue, int queueLimit, long rateLimit, long burstSize)
+{
+	int i;
+
+	for (i = 0; i < EgressClassCount; i++)
+	{
+		queue->fifo[i].head = NULL;
+		queue->fifo[i].tail = NULL;
+		queue->fifo[i].depth = 0;
+	}
+
+	queue->queueLimit = queueLimit;
+	queue->rateLimit = rateLimit;
+	queue->burstSize = (burstSize > 0) ? burstSize : rateLimit;
+	queue->tokens = queue->burstSize;
+	queue->tokenFraction = 0;
+	queue->lastRefill = ClockNow();
+	queue->drainTimer = NULL;
+}
+
+void FlushEgressQueue(egress_queue_t *queue)
+{
+	egress_queue_entry_t *entry;
+
+	while ((entry = DequeueFromEgressQueue(queue)) != NULL)
+	{
+		FreeEgressQueueEntry(entry);
+	}
+}
+
+int IsEgressQueueEmpty(egress_queue_t *queue)
+{
+	return CanSendWithoutQueueing(queue, EgressClassCount - 1);
+}
+
+int IsEgressQueueFull(egress_queue_t *queue, EgressClass class)
+{
+	return queue->fifo[class].depth >= queue->queueLimit;
+}
+
+int CanSendWithoutQueueing(egress_queue_t *queue, EgressClass class)
+{
+	/* strict priority, so a packet can only overtake packets of a lower priority class */
+	int ans = 1;
+	int i;
+
+	for (i = 0; i <= (int)class; i++)
+	{
+		if (queue->fifo[i].head != NULL)
+		{
+			ans = 0;
+			break;
+		}
+	}
+
+	return ans;
+}
+
+int EgressQueueHasTokens(egress_queue_t *queue)
+{
+	int ans = 1;
+
+	if (queue->rateLimit > 0)
+	{
+		RefillTokens(queue);
+		ans = queue->tokens > 0;
+	}
+
+	return ans;
+}
+
+void EgressQueueChargeTokens(egress_queue_t *queue, int length)
+{
+	if (queue->rateLimit > 0)
+	{
+		queue->tokens -= length;
+	}
+}
+
+clock_ms_t EgressQueueTimeUntilTokens(egress_queue_t *queue)
+{
+	clock_ms_t ans = 0;
+
+	if (queue->rateLimit > 0 && queue->tokens <= 0)
+	{
+		ans = ((clock_ms_t)(1 - queue->tokens) * 1000 + queue->rateLimit - 1) / queue->rateLimit;
+	}
+
+	return ans;
+}
+
+void EnqueueToEgressQueue(egress_queue_t *queue, EgressClass class, decnet_address_t *from, decnet_address_t *to, byte *data, int dataLength, int isHello)
+{
+	egress_fifo_t *fifo = &queue->fifo[class];
+	egress_queue_entry_t *entry = (egress_queue_entry_t *)malloc(sizeof(egress_queue_entry_t));
+
+	memset(entry, 0, sizeof(egress_queue_entry_t));
+	if (from != NULL)
+	{
+		memcpy(&entry->from, from, sizeof(decnet_address_t));
+		entry->hasFrom = 1;
+	}
+	if (to != NULL)
+	{
+		memcpy(&entry->to, to, sizeof(decnet_address_t));
+		entry->hasTo = 1;
+	}
+	entry->isHello = isHello;
+	entry->data = (byte *)malloc(dataLength);
+	memcpy(entry->data, data, dataLength);
+	entry->dataLength = dataLength;
+	entry->next = NULL;
+
+	if (fifo->tail != NULL)
+	{
+		fifo->tail->next = entry;
+	}
+
+	fifo->tail = entry;
+
+	if (fifo->head == NULL)
+	{
+		fifo->head = entry;
+	}
+
+	fifo->depth++;
+}
+
+egress_queue_entry_t *DequeueFromEgressQueue(egress_queue_t *queue)
+{
+	egress_queue_entry_t *ans = NULL;
+	int i;
+
+	for (i = 0; i < EgressClassCount; i++)
+	{
+		egress_fifo_t *fifo = &queue->fifo[i];
+		if (fifo->head != NULL)
+		{
+			ans = fifo->head;
+			fifo->head = ans->next;
+			if (fifo->head == NULL)
+			{
+				fifo->tail = NULL;
+			}
+
+			fifo->depth--;
+			ans->next = NULL;
+			break;
+		}
+	}
+
+	return ans;
+}
+
+void FreeEgressQueueEntry(egress_queue_entry_t *entry)
+{
+	free(entry->data);
+	free(entry);
+}
+
+static void RefillTokens(egress_queue_t *queue)
+{
+	/* work in thousandths of a token and carry the fraction over, so that rates that do not divide 1000 exactly are not overshot */
+	clock_ms_t now = ClockNow();
+	clock_ms_t milliTokens = (now - queue->lastRefill) * queue->rateLimit + queue->tokenFraction;
+	long refill = (long)(milliTokens / 1000);
+
+	queue->lastRefill = now;
+	if (queue->tokens + refill >= queue->burstSize)
+	{
+		queue->tokens = queue->burstSize;
+		queue->tokenFraction = 0;
+	}
+	else
+	{
+		queue->tokens += refill;
+		queue->tokenFraction = (long)(milliTokens - (clock_ms_t)refill * 1000);
+	}
+}
@@ -0,0 +1,90 @@
+/* egress_queue.h: Circuit egress queue
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+
+#include "basictypes.h"
+#include "clock.h"
+#include "decnet.h"
+#include "timer.h"
+
+#if !defined(EGRESS_QUEUE_H)
+
+typedef enum
+{
+	EgressClassControl, /* routing, hello and other control messages, always sent first */
+	EgressClassData,
+	EgressClassCount
+} EgressClass;
+
+typedef struct egress_queue_entry *egress_queue_entry_ptr;
+
+typedef struct egress_queue_entry
+{
+	decnet_address_t        from;
+	decnet_address_t        to;
+	int                     hasFrom;
+	int                     hasTo;
+	int                     isHello;
+	byte                   *data;
+	int                     dataLength;
+	egress_queue_entry_ptr  next; /* points to the next entry towards the tail */
+} egress_queue_entry_t;
+
+typedef struct
+{
+	egress_queue_entry_ptr head;
+	egress_queue_entry_ptr tail;
+	int                    depth;
+} egress_fifo_t;
+
+typedef struct
+{
+	egress_fifo_t  fifo[EgressClassCount];
+	int            queueLimit; /* maximum depth of each class */
+	long           rateLimit;  /* bytes per second, 0 for no limit */
+	long           burstSize;  /* bytes */
+	long           tokens;     /* may go negative so that a packet larger than the burst size can still be sent */
+	long           tokenFraction; /* thousandths of a token not yet added to tokens */
+	clock_ms_t     lastRefill;
+	rtimer_t      *drainTimer;
+} egress_queue_t;
+
+void InitialiseEgressQueue(egress_queue_t *queue, int queueLimit, long rateLimit, long burstSize);
+void FlushEgressQueue(egress_queue_t *queue);
+int  IsEgressQueueEmpty(egress_queue_t *queue);
+int  IsEgressQueueFull(egress_queue_t *queue, EgressClass class);
+int  CanSendWithoutQueueing(egress_queue_t *queue, EgressClass class);
+int  EgressQueueHasTokens(egress_queue_t *queue);
+clock_ms_t EgressQueueTimeUntilTokens(egress_queue_t *queue);
+void EgressQueueChargeTokens(egress_queue_t *queue, int length);
+void EnqueueToEgressQueue(egress_queue_t *queue, EgressClass class, decnet_address_t *from, decnet_address_t *to, byte *data, int dataLength, int isHello);
+egress_queue_entry_t *DequeueFromEgressQueue(egress_queue_t *queue);
+void FreeEgressQueueEntry(egress_queue_entry_t *entry);
+
+#define EGRESS_QUEUE_H
+#endif
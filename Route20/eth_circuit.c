@@ -43,12 +43,14 @@ static void HandleLineNotifyData(line_t *line);
 static void HandleHelloTimer(rtimer_t* timer, char* name, void* context);
 static void HandleLevel2HelloTimer(rtimer_t* timer, char* name, void* context);
 static int IsAddressedToThisNode(packet_t * packet);
+static void FramePacket(packet_t *frame, decnet_address_t *from, decnet_address_t *to, packet_t *packet);
+static void BuildRouterHelloFrame(eth_circuit_t *ethCircuit);
 
-eth_circuit_t *EthCircuitCreatePcap(circuit_t *circuit)
+eth_circuit_t *EthCircuitCreatePcap(circuit_t *circuit, struct eth_pcap_options *options)
 {
 	eth_circuit_t *ans = (eth_circuit_t *)calloc(1, sizeof(eth_circuit_t));
 	line_t *line = (line_t *)calloc(1, sizeof(line_t));
-    LineCreateEthernetPcap(line, circuit->name, circuit, HandleLineNotifyData);
+    LineCreateEthernetPcap(line, circuit->name, options, circuit, HandleLineNotifyData);
 
 	ans->circuit = circuit;
 	circuit->line = line;
@@ -56,6 +58,48 @@ eth_circuit_t *EthCircuitCreatePcap(circuit_t *circuit)
 	return ans;
 }
 
+#if defined(USE_PACKET_RING)
+eth_circuit_t *EthCircuitCreatePacket(circuit_t *circuit)
+{
+	eth_circuit_t *ans = (eth_circuit_t *)calloc(1, sizeof(eth_circuit_t));
+	line_t *line = (line_t *)calloc(1, sizeof(line_t));
+    LineCreateEthernetPacket(line, circuit->name, circuit, HandleLineNotifyData);
+
+	ans->circuit = circuit;
+	circuit->line = line;
+
+	return ans;
+}
+#endif
+
+#if defined(USE_XDP)
+eth_circuit_t *EthCircuitCreateXdp(circuit_t *circuit, int queueId)
+{
+	eth_circuit_t *ans = (eth_circuit_t *)calloc(1, sizeof(eth_circuit_t));
+	line_t *line = (line_t *)calloc(1, sizeof(line_t));
+    LineCreateEthernetXdp(line, circuit->name, queueId, circuit, HandleLineNotifyData);
+
+	ans->circuit = circuit;
+	circuit->line = line;
+
+	return ans;
+}
+#endif
+
+#if defined(USE_TAP)
+eth_circuit_t *EthCircuitCreateTap(circuit_t *circuit, int queueCount)
+{
+	eth_circuit_t *ans = (eth_circuit_t *)calloc(1, sizeof(eth_circuit_t));
+	line_t *line = (line_t *)calloc(1, sizeof(line_t));
+    LineCreateEthernetTap(line, circuit->name, queueCount, circuit, HandleLineNotifyData);
+
+	ans->circuit = circuit;
+	circuit->line = line;
+
+	return ans;
+}
+#endif
+
 eth_circuit_t *EthCircuitCreateSocket(circuit_t *circuit, uint16 receivePort, char *destinationHostName, uint16 destinationPort)
 {
 	eth_circuit_t *ans = (eth_circuit_t *)calloc(1, sizeof(eth_circuit_t));
@@ -76,13 +120,12 @@ int EthCircuitStart(circuit_t *circuit)
 
 void EthCircuitUp(circuit_t *circuit)
 {
-	time_t now;
-	time(&now);
-	circuit->helloTimer = CreateTimer("AllRoutersHello", now, T3, circuit, HandleHelloTimer);
+	clock_ms_t now = ClockNow();
+	circuit->helloTimer = CreateTimer("AllRoutersHello", now, SECS_TO_MS(T3), circuit, HandleHelloTimer);
 
 	if (nodeInfo.level == 2)
 	{
-		circuit->level2HelloTimer = CreateTimer("AllLevel2RoutersHello", now, T3, circuit, HandleLevel2HelloTimer);
+		circuit->level2HelloTimer = CreateTimer("AllLevel2RoutersHello", now, SECS_TO_MS(T3), circuit, HandleLevel2HelloTimer);
 	}
 }
 
@@ -149,28 +192,49 @@ packet_t *EthCircuitReadPacket(circuit_t *circuit)
 int EthCircuitWritePacket(circuit_t *circuit, decnet_address_t *from, decnet_address_t *to, packet_t *packet, int isHello)
 {
 	int ans;
-	int len;
+	eth_circuit_t *ethCircuit = (eth_circuit_t *)circuit->context;
     line_t *line = GetLineFromCircuit(circuit);
 	packet_t toSend;
 
-	toSend.rawLen = packet->payloadLen + 16;
-	toSend.rawData = (byte *)malloc(toSend.rawLen);
-	toSend.payloadLen = packet->payloadLen;
-	toSend.payload = toSend.rawData + 16;
+	if (ethCircuit->helloFrame.rawData != NULL && packet->payload == ethCircuit->helloFrame.payload)
+	{
+		/* the cached router hello, already framed, only the destination changes */
+		SetDecnetAddress((decnet_eth_address_t *)ethCircuit->helloFrame.rawData, *to);
+		ans = line->LineWritePacket(line, &ethCircuit->helloFrame);
+	}
+	else
+	{
+		toSend.rawData = (byte *)malloc(packet->payloadLen + 16);
+		FramePacket(&toSend, from, to, packet);
+		ans = line->LineWritePacket(line, &toSend);
+		free(toSend.rawData);
+	}
 
-	SetDecnetAddress((decnet_eth_address_t *)toSend.rawData, *to);
-	SetDecnetAddress((decnet_eth_address_t *)&toSend.rawData[6], *from);
-	toSend.rawData[12] = 0x60;
-	toSend.rawData[13] = 0x03;
-	len = Uint16ToLittleEndian((uint16)packet->payloadLen);
-	memcpy(&toSend.rawData[14], &len, 2);
-	memcpy(toSend.payload, packet->payload, packet->payloadLen);
-	ans = line->LineWritePacket(line, &toSend);
-	free(toSend.rawData);
 	circuit->stats.packetsSent++;
 	return ans;
 }
 
+int EthCircuitWriteRouterHello(circuit_t *circuit, decnet_address_t *to)
+{
+	eth_circuit_t *ethCircuit = (eth_circuit_t *)circuit->context;
+	packet_t hello;
+
+	if (ethCircuit->helloFrame.rawData == NULL || ethCircuit->helloFrameGeneration != GetRouterListGeneration())
+	{
+		BuildRouterHelloFrame(ethCircuit);
+	}
+
+	/* goes through the egress queue like any other control message, EthCircuitWritePacket recognises the
+	   cached payload and sends the prebuilt frame, a hello that has to wait in the queue is a copy and gets framed again */
+	memset(&hello, 0, sizeof(packet_t));
+	hello.rawData = ethCircuit->helloFrame.payload;
+	hello.rawLen = ethCircuit->helloFrame.payloadLen;
+	hello.payload = ethCircuit->helloFrame.payload;
+	hello.payloadLen = ethCircuit->helloFrame.payloadLen;
+
+	return circuit->WritePacket(circuit, &nodeInfo.address, to, &hello, 1);
+}
+
 void EthCircuitStop(circuit_t *circuit)
 {
     line_t *line = GetLineFromCircuit(circuit);
@@ -185,22 +249,48 @@ static void HandleLineNotifyData(line_t *line)
 
 static void HandleHelloTimer(rtimer_t* timer, char* name, void* context) // TODO: This should probably move to the init layer.
 {
-	packet_t* packet;
-
 	circuit_t* circuit = (circuit_t*)context;
 	Log(LogEthCircuit, LogVerbose, "Sending Ethernet Hello to All Routers %s\n", circuit->name);
-	packet = CreateEthernetHello(nodeInfo.address);
-	circuit->WritePacket(circuit, &nodeInfo.address, &AllRoutersAddress, packet, 1);
+	EthCircuitWriteRouterHello(circuit, &AllRoutersAddress);
 }
 
 static void HandleLevel2HelloTimer(rtimer_t* timer, char* name, void* context) // TODO: This should probably move to the init layer.
 {
-	packet_t* packet;
-
 	circuit_t* circuit = (circuit_t*)context;
 	Log(LogEthCircuit, LogVerbose, "Sending Ethernet Hello to All Level 2 Routers %s\n", circuit->name);
+	EthCircuitWriteRouterHello(circuit, &AllLevel2RoutersAddress);
+}
+
+static void FramePacket(packet_t *frame, decnet_address_t *from, decnet_address_t *to, packet_t *packet)
+{
+	int len;
+
+	frame->rawLen = packet->payloadLen + 16;
+	frame->payloadLen = packet->payloadLen;
+	frame->payload = frame->rawData + 16;
+
+	SetDecnetAddress((decnet_eth_address_t *)frame->rawData, *to);
+	SetDecnetAddress((decnet_eth_address_t *)&frame->rawData[6], *from);
+	frame->rawData[12] = 0x60;
+	frame->rawData[13] = 0x03;
+	len = Uint16ToLittleEndian((uint16)packet->payloadLen);
+	memcpy(&frame->rawData[14], &len, 2);
+	memcpy(frame->payload, packet->payload, packet->payloadLen);
+}
+
+static void BuildRouterHelloFrame(eth_circuit_t *ethCircuit)
+{
+	packet_t *packet;
+
+	Log(LogEthCircuit, LogDetail, "Rebuilding Ethernet Hello for %s\n", ethCircuit->circuit->name);
+	if (ethCircuit->helloFrame.rawData == NULL)
+	{
+		ethCircuit->helloFrame.rawData = (byte *)malloc(sizeof(ethernet_router_hello_t) + 16);
+	}
+
+	ethCircuit->helloFrameGeneration = GetRouterListGeneration();
 	packet = CreateEthernetHello(nodeInfo.address);
-	circuit->WritePacket(circuit, &nodeInfo.address, &AllLevel2RoutersAddress, packet, 1);
+	FramePacket(&ethCircuit->helloFrame, &nodeInfo.address, &AllRoutersAddress, packet);
 }
 
 static int IsAddressedToThisNode(packet_t * packet)
@@ -32,14 +32,23 @@
 #if !defined(ETH_CIRCUIT_H)
 
 typedef struct eth_circuit *eth_circuit_ptr;
+struct eth_pcap_options;
 
 typedef struct eth_circuit
 {
-	circuit_t *circuit;
-	int        isDesignatedRouter;
+	circuit_t        *circuit;
+	int               isDesignatedRouter;
+	int               hasDrCandidate; /* highest ranking router in this area competing to be designated router, maintained by the init layer */
+	decnet_address_t  drCandidate;
+	byte              drCandidatePriority;
+	packet_t          helloFrame; /* prebuilt Ethernet Router Hello frame, destination is filled in when sent */
+	unsigned int      helloFrameGeneration; /* router list generation the hello frame was built from */
 } eth_circuit_t;
 
-eth_circuit_ptr EthCircuitCreatePcap(circuit_t *circuit);
+eth_circuit_ptr EthCircuitCreatePcap(circuit_t *circuit, struct eth_pcap_options *options);
+eth_circuit_ptr EthCircuitCreatePacket(circuit_t *circuit);
+eth_circuit_ptr EthCircuitCreateXdp(circuit_t *circuit, int queueId);
+eth_circuit_ptr EthCircuitCreateTap(circuit_t *circuit, int queueCount);
 eth_circuit_ptr EthCircuitCreateSocket(circuit_t *circuit, uint16 receivePort, char *destinationHostName, uint16 destinationPort);
 
 int EthCircuitStart(circuit_ptr circuit);
@@ -47,6 +56,7 @@ void EthCircuitUp(circuit_ptr circuit);
 void EthCircuitDown(circuit_ptr circuit);
 packet_t *EthCircuitReadPacket(circuit_ptr circuit);
 int EthCircuitWritePacket(circuit_ptr circuit, decnet_address_t *from, decnet_address_t *to, packet_t *, int isHello);
+int EthCircuitWriteRouterHello(circuit_ptr circuit, decnet_address_t *to);
 void EthCircuitStop(circuit_ptr circuit);
 
 #define ETH_CIRCUIT_H
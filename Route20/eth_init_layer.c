@@ -27,6 +27,7 @@ in this Software without prior written authorization from the author.
 ------------------------------------------------------------------------------*/
 
 #include <stdlib.h>
+#include <memory.h>
 #include "constants.h"
 #include "decnet.h"
 #include "eth_init_layer.h"
@@ -40,18 +41,15 @@ in this Software without prior written authorization from the author.
 static circuit_t * ethCircuits[NC];
 static int ethCircuitCount;
 
-typedef struct
-{
-	circuit_t *circuit;
-	time_t lastUpdate;
-	int couldBeDesignatedRouter;
-} check_designated_router_t;
-
 static int drDelayExpired;
-static time_t startTime;
+static clock_ms_t startTime;
 static void HandleDesignatedRouterTimer(rtimer_t *timer, char *name, void *context);
 static void HandleDesignatedRouterHelloTimer(rtimer_t *timer, char *name, void *context);
-static int CheckDesignatedRouterCallback(adjacency_t *adjacency, void *context);
+static void CheckCircuitDesignatedRouter(circuit_t *circuit);
+static int IsDrCandidate(adjacency_t *adjacency, circuit_t *circuit);
+static int Outranks(byte priority1, decnet_address_t *id1, byte priority2, decnet_address_t *id2);
+static void SetDrCandidate(eth_circuit_t *ethCircuit, adjacency_t *adjacency);
+static int FindDrCandidateCallback(adjacency_t *adjacency, void *context);
 static void HandleLineNotifyStateChange(line_t *line);
 
 int EthInitLayerStart(circuit_t circuits[], int circuitCount)
@@ -73,11 +71,11 @@ int EthInitLayerStart(circuit_t circuits[], int circuitCount)
 		}
 	}
 
-	time(&startTime);
+	startTime = ClockNow();
 	drDelayExpired = 0;
 	if (ans && ethCircuitCount > 0)
     {
-        CreateTimer("DesignatedRouter", startTime + DRDELAY, 0, NULL, HandleDesignatedRouterTimer);
+        CreateTimer("DesignatedRouter", startTime + SECS_TO_MS(DRDELAY), 0, NULL, HandleDesignatedRouterTimer);
     }
 
     return ans;
@@ -86,7 +84,6 @@ int EthInitLayerStart(circuit_t circuits[], int circuitCount)
 void EthInitLayerStop(void)
 {
 	int i;
-	packet_t *packet;
 
 	StopAllAdjacencies(EthernetCircuit);
 
@@ -94,13 +91,12 @@ void EthInitLayerStop(void)
 	{
 		circuit_t *circuit = ethCircuits[i];
 	    Log(LogEthInit, LogVerbose, "Sending Ethernet Hello to stop all adjacencies to All Routers %s\n", circuit->name);
-		packet = CreateEthernetHello(nodeInfo.address);
-		circuit->WritePacket(circuit, &nodeInfo.address, &AllRoutersAddress, packet, 1);
+		EthCircuitWriteRouterHello(circuit, &AllRoutersAddress);
 
 		if (nodeInfo.level == 2)
 		{
 			Log(LogEthInit, LogVerbose, "Sending Ethernet Hello to stop all adjacencies to All Level 2 Routers %s\n", circuit->name);
-			circuit->WritePacket(circuit, &nodeInfo.address, &AllLevel2RoutersAddress, packet, 1);
+			EthCircuitWriteRouterHello(circuit, &AllLevel2RoutersAddress);
 		}
 
 		CircuitDown(circuit);
@@ -131,37 +127,61 @@ void EthInitLayerAdjacencyDownComplete(adjacency_t *adjacency)
 void EthInitCheckDesignatedRouter(void)
 {
 	int i;
-	check_designated_router_t checkdr;
-	eth_circuit_t *ethCircuit;
 
 	for(i = 0; i < ethCircuitCount; i++)
 	{
-		checkdr.circuit = ethCircuits[i];
-		checkdr.lastUpdate = 0;
-		checkdr.couldBeDesignatedRouter = 1;
+		CheckCircuitDesignatedRouter(ethCircuits[i]);
+	}
+}
 
-		ethCircuit = (eth_circuit_t *)checkdr.circuit->context;
+void EthInitRouterAdjacencyChanged(adjacency_t *adjacency)
+{
+	circuit_t *circuit = adjacency->circuit;
+	eth_circuit_t *ethCircuit;
 
-		ProcessRouterAdjacencies(CheckDesignatedRouterCallback, &checkdr);
+	if (circuit->circuitType == EthernetCircuit)
+	{
+		ethCircuit = (eth_circuit_t *)circuit->context;
 
-		if (drDelayExpired && ethCircuit->isDesignatedRouter != checkdr.couldBeDesignatedRouter)
+		if (ethCircuit->hasDrCandidate && CompareDecnetAddress(&ethCircuit->drCandidate, &adjacency->id))
 		{
-			ethCircuit->isDesignatedRouter = checkdr.couldBeDesignatedRouter;
-
-			if (ethCircuit->isDesignatedRouter)
+			if (adjacency->priority < ethCircuit->drCandidatePriority)
 			{
-				time_t now;
-
-				Log(LogEthInit, LogInfo, "Now the designated router on circuit %s\n", checkdr.circuit->name);
-				time(&now);
-
-    			CreateTimer("AllEndNodesHello", now, T3, checkdr.circuit, HandleDesignatedRouterHelloTimer);
+				/* the current candidate has dropped its priority, so another router may now outrank it */
+				ethCircuit->hasDrCandidate = 0;
+				ProcessRouterAdjacencies(FindDrCandidateCallback, circuit);
 			}
 			else
 			{
-				Log(LogEthInit, LogInfo, "No longer the designated router on circuit %s\n", checkdr.circuit->name);
+				ethCircuit->drCandidatePriority = adjacency->priority;
+			}
+		}
+		else if (IsDrCandidate(adjacency, circuit))
+		{
+			if (!ethCircuit->hasDrCandidate || Outranks(adjacency->priority, &adjacency->id, ethCircuit->drCandidatePriority, &ethCircuit->drCandidate))
+			{
+				SetDrCandidate(ethCircuit, adjacency);
 			}
 		}
+
+		CheckCircuitDesignatedRouter(circuit);
+	}
+}
+
+void EthInitRouterAdjacencyRemoved(circuit_ptr circuit, decnet_address_t *id)
+{
+	eth_circuit_t *ethCircuit;
+
+	if (circuit->circuitType == EthernetCircuit)
+	{
+		ethCircuit = (eth_circuit_t *)circuit->context;
+
+		if (ethCircuit->hasDrCandidate && CompareDecnetAddress(&ethCircuit->drCandidate, id))
+		{
+			ethCircuit->hasDrCandidate = 0;
+			ProcessRouterAdjacencies(FindDrCandidateCallback, circuit);
+			CheckCircuitDesignatedRouter(circuit);
+		}
 	}
 }
 
@@ -173,17 +193,13 @@ static void HandleDesignatedRouterTimer(rtimer_t *timer, char *name, void *conte
 
 static void HandleDesignatedRouterHelloTimer(rtimer_t * timer, char *name, void *context)
 {
-	packet_t *packet;
-	time_t now;
 	circuit_t *circuit = (circuit_t *)context;
 	eth_circuit_t *ethCircuit = (eth_circuit_t *)circuit->context;
 
 	if (ethCircuit->isDesignatedRouter)
 	{
-		time(&now);
 	    Log(LogEthInit, LogVerbose, "Sending Ethernet Hello to All End Nodes %s\n", circuit->name);
-		packet = CreateEthernetHello(nodeInfo.address);
-		circuit->WritePacket(circuit, &nodeInfo.address, &AllEndNodesAddress, packet, 1);
+		EthCircuitWriteRouterHello(circuit, &AllEndNodesAddress);
 	}
 	else
 	{
@@ -191,31 +207,65 @@ static void HandleDesignatedRouterHelloTimer(rtimer_t * timer, char *name, void
 	}
 }
 
-static int CheckDesignatedRouterCallback(adjacency_t *adjacency, void *context)
+static void CheckCircuitDesignatedRouter(circuit_t *circuit)
 {
-	check_designated_router_t *checkdr = (check_designated_router_t *)context;
+	eth_circuit_t *ethCircuit = (eth_circuit_t *)circuit->context;
+	int couldBeDesignatedRouter;
+
+	couldBeDesignatedRouter = !ethCircuit->hasDrCandidate || Outranks(nodeInfo.priority, &nodeInfo.address, ethCircuit->drCandidatePriority, &ethCircuit->drCandidate);
 
-	if (adjacency->circuit == checkdr->circuit)
+	if (drDelayExpired && ethCircuit->isDesignatedRouter != couldBeDesignatedRouter)
 	{
-		if (adjacency->lastHeardFrom > checkdr->lastUpdate)
+		ethCircuit->isDesignatedRouter = couldBeDesignatedRouter;
+
+		if (ethCircuit->isDesignatedRouter)
+		{
+			clock_ms_t now;
+
+			Log(LogEthInit, LogInfo, "Now the designated router on circuit %s\n", circuit->name);
+			now = ClockNow();
+
+			CreateTimer("AllEndNodesHello", now, SECS_TO_MS(T3), circuit, HandleDesignatedRouterHelloTimer);
+		}
+		else
 		{
-			checkdr->lastUpdate = adjacency->lastHeardFrom;
+			Log(LogEthInit, LogInfo, "No longer the designated router on circuit %s\n", circuit->name);
 		}
+	}
+}
+
+static int IsDrCandidate(adjacency_t *adjacency, circuit_t *circuit)
+{
+	return adjacency->circuit == circuit && IsBroadcastRouterAdjacency(adjacency) && adjacency->id.area == nodeInfo.address.area;
+}
+
+static int Outranks(byte priority1, decnet_address_t *id1, byte priority2, decnet_address_t *id2)
+{
+	/* the higher priority wins, a tie is broken by the higher node id */
+	return priority1 > priority2 || (priority1 == priority2 && id1->node > id2->node);
+}
+
+static void SetDrCandidate(eth_circuit_t *ethCircuit, adjacency_t *adjacency)
+{
+	Log(LogEthInit, LogVerbose, "Designated router candidate on circuit %s is now ", ethCircuit->circuit->name);
+	LogDecnetAddress(LogEthInit, LogVerbose, &adjacency->id);
+	Log(LogEthInit, LogVerbose, ", priority %d\n", adjacency->priority);
 
-		if (adjacency->id.area == nodeInfo.address.area)
+	ethCircuit->hasDrCandidate = 1;
+	memcpy(&ethCircuit->drCandidate, &adjacency->id, sizeof(decnet_address_t));
+	ethCircuit->drCandidatePriority = adjacency->priority;
+}
+
+static int FindDrCandidateCallback(adjacency_t *adjacency, void *context)
+{
+	circuit_t *circuit = (circuit_t *)context;
+	eth_circuit_t *ethCircuit = (eth_circuit_t *)circuit->context;
+
+	if (IsDrCandidate(adjacency, circuit))
+	{
+		if (!ethCircuit->hasDrCandidate || Outranks(adjacency->priority, &adjacency->id, ethCircuit->drCandidatePriority, &ethCircuit->drCandidate))
 		{
-			if (adjacency->priority < nodeInfo.priority)
-			{
-				checkdr->couldBeDesignatedRouter = 1;
-			}
-			else if (adjacency->priority == nodeInfo.priority)
-			{
-				checkdr->couldBeDesignatedRouter = adjacency->id.node < nodeInfo.address.node;
-			}
-			else
-			{
-				checkdr->couldBeDesignatedRouter = 0;
-			}
+			SetDrCandidate(ethCircuit, adjacency);
 		}
 	}
 
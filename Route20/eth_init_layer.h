@@ -38,6 +38,8 @@ void EthInitLayerCircuitDownComplete(circuit_ptr circuit);
 void EthInitLayerAdjacencyUpComplete(adjacency_t *adjacency);
 void EthInitLayerAdjacencyDownComplete(adjacency_t *adjacency);
 void EthInitCheckDesignatedRouter(void);
+void EthInitRouterAdjacencyChanged(adjacency_t *adjacency);
+void EthInitRouterAdjacencyRemoved(circuit_ptr circuit, decnet_address_t *id);
 
 #define ETH_INIT_LAYER_H
 #endif
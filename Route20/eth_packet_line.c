@@ -0,0 +1,414 @@
+/* eth_packet_line.c: Ethernet line using Linux AF_PACKET rings
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+#include "platform.h"
+
+#if defined(USE_PACKET_RING)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#include "route20.h"
+#include "timer.h"
+#include "eth_decnet.h"
+#include "eth_line.h"
+#include "eth_packet_line.h"
+
+/* Frames are received into a TPACKET_V3 ring, which the kernel fills a block at a time, and are handed to the
+   circuit straight from the mapped block. A block is given back to the kernel once every frame in it has been
+   handed out. Transmitted frames are written into a TPACKET_V3 transmit ring and the kernel is told to send
+   them once per pass of the event loop, so a burst of writes costs a single system call. */
+
+#define PACKET_RX_BLOCK_SIZE    (1 << 16)
+#define PACKET_RX_BLOCK_COUNT   16
+#define PACKET_RX_BLOCK_TIMEOUT 1 /* ms before the kernel hands over a part filled block */
+#define PACKET_FRAME_SIZE       2048
+#define PACKET_TX_FRAME_COUNT   64
+#define PACKET_MIN_FRAME_SIZE   60
+
+static int SetupRings(line_t *line, eth_packet_t *packetContext);
+static int AttachDecnetFilter(int sock);
+static void KickTransmit(void *context);
+static struct tpacket_block_desc *RxBlock(eth_packet_t *packetContext, int block);
+static struct tpacket3_hdr *TxFrame(eth_packet_t *packetContext, int frame);
+static void LogDrops(line_t *line, eth_packet_t *packetContext);
+
+int EthPacketLineStart(line_t *line)
+{
+	int ans = 0;
+	eth_packet_t *packetContext = (eth_packet_t *)line->lineContext;
+	int ifIndex;
+	struct packet_mreq mreq;
+	struct sockaddr_ll addr;
+	int version = TPACKET_V3;
+
+	Log(LogEthPacketLine, LogInfo, "Starting line %s\n", line->name);
+
+	packetContext->socket = -1;
+	packetContext->ring = MAP_FAILED;
+	ifIndex = if_nametoindex(line->name);
+
+	if (ifIndex == 0)
+	{
+		Log(LogEthPacketLine, LogError, "Unknown interface %s\n", line->name);
+	}
+	else if ((packetContext->socket = socket(AF_PACKET, SOCK_RAW, 0)) == -1)
+	{
+		Log(LogEthPacketLine, LogError, "Error creating packet socket: %s\n", strerror(errno));
+	}
+	else if (!AttachDecnetFilter(packetContext->socket))
+	{
+		Log(LogEthPacketLine, LogError, "Error attaching filter: %s\n", strerror(errno));
+	}
+	else if (setsockopt(packetContext->socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+	{
+		Log(LogEthPacketLine, LogError, "Error selecting TPACKET_V3: %s\n", strerror(errno));
+	}
+	else if (SetupRings(line, packetContext))
+	{
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = htons(ETH_P_ALL);
+		addr.sll_ifindex = ifIndex;
+
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.mr_ifindex = ifIndex;
+		mreq.mr_type = PACKET_MR_PROMISC;
+
+		if (bind(packetContext->socket, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		{
+			Log(LogEthPacketLine, LogError, "Error binding to %s: %s\n", line->name, strerror(errno));
+		}
+		else if (setsockopt(packetContext->socket, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+		{
+			Log(LogEthPacketLine, LogError, "Error setting promiscuous mode: %s\n", strerror(errno));
+		}
+		else
+		{
+			line->waitHandle = packetContext->socket;
+			RegisterEventHandler(line->waitHandle, "EthPacket Line", line, line->LineWaitEventHandler);
+			QueueImmediate(line, (void (*)(void *))(line->LineUp));
+			ans = 1;
+		}
+	}
+
+	if (!ans)
+	{
+		Log(LogEthPacketLine, LogError, "Could not open circuit for %s\n", line->name);
+		EthPacketLineStop(line);
+	}
+
+	return ans;
+}
+
+void EthPacketLineStop(line_t *line)
+{
+	eth_packet_t *packetContext = (eth_packet_t *)line->lineContext;
+
+	if (packetContext->socket != -1)
+	{
+		KickTransmit(line);
+		if (packetContext->txWaitingForWrite)
+		{
+			packetContext->txWaitingForWrite = 0;
+			DeregisterWriteHandler(line->waitHandle);
+		}
+
+		if (line->waitHandle == packetContext->socket)
+		{
+			DeregisterEventHandler(line->waitHandle);
+		}
+
+		if (packetContext->ring != MAP_FAILED)
+		{
+			munmap(packetContext->ring, packetContext->ringSize);
+			packetContext->ring = MAP_FAILED;
+		}
+
+		close(packetContext->socket);
+		packetContext->socket = -1;
+	}
+}
+
+packet_t *EthPacketLineReadPacket(line_t *line)
+{
+	eth_packet_t *packetContext = (eth_packet_t *)line->lineContext;
+	static packet_t packet;
+	packet_t *ans = NULL;
+	struct tpacket_block_desc *block;
+	struct tpacket3_hdr *frame;
+	int blockReady = 1;
+
+	packet.IsDecnet = EthPcapIsDecnet;
+
+	while (ans == NULL && blockReady)
+	{
+		block = RxBlock(packetContext, packetContext->rxBlock);
+		if (packetContext->rxPacketsLeft < 0)
+		{
+			blockReady = (block->hdr.bh1.block_status & TP_STATUS_USER) != 0;
+			if (blockReady)
+			{
+				LogDrops(line, packetContext);
+				packetContext->rxPacketsLeft = block->hdr.bh1.num_pkts;
+				packetContext->rxNextPacket = (byte *)block + block->hdr.bh1.offset_to_first_pkt;
+			}
+		}
+		else if (packetContext->rxPacketsLeft == 0)
+		{
+			/* the last frame handed out from this block has been processed, so the kernel can have it back */
+			block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+			packetContext->rxBlock = (packetContext->rxBlock + 1) % PACKET_RX_BLOCK_COUNT;
+			packetContext->rxPacketsLeft = -1;
+		}
+		else
+		{
+			frame = (struct tpacket3_hdr *)packetContext->rxNextPacket;
+			packetContext->rxNextPacket += frame->tp_next_offset;
+			packetContext->rxPacketsLeft--;
+
+			packet.rawData = (byte *)frame + frame->tp_mac;
+			packet.rawLen = frame->tp_snaplen;
+			if (EthValidPacket(&packet))
+			{
+				if (packet.IsDecnet(&packet))
+				{
+					GetDecnetAddress((decnet_eth_address_t *)&packet.rawData[0], &packet.to);
+					GetDecnetAddress((decnet_eth_address_t *)&packet.rawData[6], &packet.from);
+					if (IsLoggable(LogEthPacketLine, LogVerbose))
+					{
+						Log(LogEthPacketLine, LogVerbose, "Packet from : "); LogDecnetAddress(LogEthPacketLine, LogVerbose, &packet.from); Log(LogEthPacketLine, LogVerbose, " received on line %s\n", line->name);
+					}
+					line->stats.validPacketsReceived++;
+					EthSetPayload(&packet);
+					ans = &packet;
+				}
+				else
+				{
+					Log(LogEthPacketLine, LogVerbose, "Discarding valid non-DECnet Ethernet packet from %s\n", line->name);
+				}
+			}
+			else
+			{
+				Log(LogEthPacketLine, LogWarning, "Discarding invalid Ethernet packet from %s\n", line->name);
+				line->stats.invalidPacketsReceived++;
+			}
+		}
+	}
+
+	return ans;
+}
+
+int EthPacketLineWritePacket(line_t *line, packet_t *packet)
+{
+	int ans = 0;
+	eth_packet_t *packetContext = (eth_packet_t *)line->lineContext;
+	struct tpacket3_hdr *frame = TxFrame(packetContext, packetContext->txFrame);
+	byte *data = (byte *)frame + TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+	int len = packet->rawLen;
+
+	if (len > PACKET_FRAME_SIZE - (int)TPACKET3_HDRLEN)
+	{
+		Log(LogEthPacketLine, LogError, "Packet of %d bytes too large to write to %s\n", len, line->name);
+	}
+	else if (frame->tp_status != TP_STATUS_AVAILABLE)
+	{
+		/* every frame in the ring is still waiting to go, send what is there and let the circuit retry */
+		Log(LogEthPacketLine, LogWarning, "Transmit ring full on %s\n", line->name);
+		KickTransmit(line);
+	}
+	else
+	{
+		memcpy(data, packet->rawData, len);
+		if (len < PACKET_MIN_FRAME_SIZE)
+		{
+			memset(data + len, 0, PACKET_MIN_FRAME_SIZE - len);
+			len = PACKET_MIN_FRAME_SIZE;
+		}
+
+		frame->tp_len = len;
+		frame->tp_next_offset = 0;
+		frame->tp_status = TP_STATUS_SEND_REQUEST;
+		packetContext->txFrame = (packetContext->txFrame + 1) % PACKET_TX_FRAME_COUNT;
+		packetContext->txPending++;
+		ans = 1;
+
+		if (packetContext->txPending >= PACKET_TX_FRAME_COUNT / 2)
+		{
+			KickTransmit(line);
+		}
+		else if (!packetContext->txKickQueued)
+		{
+			packetContext->txKickQueued = 1;
+			QueueImmediate(line, KickTransmit);
+		}
+	}
+
+	return ans;
+}
+
+static int SetupRings(line_t *line, eth_packet_t *packetContext)
+{
+	int ans = 0;
+	struct tpacket_req3 rxReq;
+	struct tpacket_req3 txReq;
+	size_t rxSize;
+
+	memset(&rxReq, 0, sizeof(rxReq));
+	rxReq.tp_block_size = PACKET_RX_BLOCK_SIZE;
+	rxReq.tp_block_nr = PACKET_RX_BLOCK_COUNT;
+	rxReq.tp_frame_size = PACKET_FRAME_SIZE;
+	rxReq.tp_frame_nr = (PACKET_RX_BLOCK_SIZE / PACKET_FRAME_SIZE) * PACKET_RX_BLOCK_COUNT;
+	rxReq.tp_retire_blk_tov = PACKET_RX_BLOCK_TIMEOUT;
+
+	/* the kernel does not support block based transmit, so the transmit ring is simply fixed size frames */
+	memset(&txReq, 0, sizeof(txReq));
+	txReq.tp_block_size = PACKET_FRAME_SIZE * PACKET_TX_FRAME_COUNT;
+	txReq.tp_block_nr = 1;
+	txReq.tp_frame_size = PACKET_FRAME_SIZE;
+	txReq.tp_frame_nr = PACKET_TX_FRAME_COUNT;
+
+	rxSize = (size_t)rxReq.tp_block_size * rxReq.tp_block_nr;
+	packetContext->ringSize = rxSize + (size_t)txReq.tp_block_size * txReq.tp_block_nr;
+
+	if (setsockopt(packetContext->socket, SOL_PACKET, PACKET_RX_RING, &rxReq, sizeof(rxReq)) == -1)
+	{
+		Log(LogEthPacketLine, LogError, "Error creating receive ring: %s\n", strerror(errno));
+	}
+	else if (setsockopt(packetContext->socket, SOL_PACKET, PACKET_TX_RING, &txReq, sizeof(txReq)) == -1)
+	{
+		Log(LogEthPacketLine, LogError, "Error creating transmit ring: %s\n", strerror(errno));
+	}
+	else if ((packetContext->ring = mmap(NULL, packetContext->ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, packetContext->socket, 0)) == MAP_FAILED
+		  && (packetContext->ring = mmap(NULL, packetContext->ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, packetContext->socket, 0)) == MAP_FAILED)
+	{
+		Log(LogEthPacketLine, LogError, "Error mapping rings: %s\n", strerror(errno));
+	}
+	else
+	{
+		Log(LogEthPacketLine, LogInfo, "Mapped %d receive blocks of %d bytes and %d transmit frames for %s\n", PACKET_RX_BLOCK_COUNT, PACKET_RX_BLOCK_SIZE, PACKET_TX_FRAME_COUNT, line->name);
+		packetContext->rxBlock = 0;
+		packetContext->rxPacketsLeft = -1;
+		packetContext->txFrame = 0;
+		packetContext->txPending = 0;
+		ans = 1;
+	}
+
+	return ans;
+}
+
+static int AttachDecnetFilter(int sock)
+{
+	/* accept incoming DECnet frames only, frames this host sends are seen by packet sockets too */
+	static struct sock_filter code[] =
+	{
+		{ 0x28, 0, 0, 12 },                              /* ldh [12] */
+		{ 0x15, 0, 3, ETHERTYPE_DECnet },                /* jeq #0x6003, next, drop */
+		{ 0x20, 0, 0, SKF_AD_OFF + SKF_AD_PKTTYPE },     /* ld pkttype */
+		{ 0x15, 1, 0, PACKET_OUTGOING },                 /* jeq #outgoing, drop, next */
+		{ 0x06, 0, 0, 0x0000FFFF },                      /* ret #65535 */
+		{ 0x06, 0, 0, 0 }                                /* drop: ret #0 */
+	};
+	struct sock_fprog program;
+
+	program.len = sizeof(code) / sizeof(code[0]);
+	program.filter = code;
+
+	return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == 0;
+}
+
+/* Also the write handler while the socket cannot take the frames, they stay marked for sending until a kick succeeds */
+static void KickTransmit(void *context)
+{
+	line_t *line = (line_t *)context;
+	eth_packet_t *packetContext = (eth_packet_t *)line->lineContext;
+	int busy = 0;
+
+	packetContext->txKickQueued = 0;
+	if (packetContext->txPending > 0 && packetContext->socket != -1)
+	{
+		if (sendto(packetContext->socket, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1)
+		{
+			busy = errno == EAGAIN || errno == ENOBUFS;
+			if (!busy)
+			{
+				Log(LogEthPacketLine, LogError, "Error sending on %s: %s\n", line->name, strerror(errno));
+			}
+		}
+
+		if (!busy)
+		{
+			packetContext->txPending = 0;
+		}
+	}
+
+	if (busy && !packetContext->txWaitingForWrite)
+	{
+		packetContext->txWaitingForWrite = 1;
+		RegisterWriteHandler(line->waitHandle, line, KickTransmit);
+	}
+	else if (!busy && packetContext->txWaitingForWrite)
+	{
+		packetContext->txWaitingForWrite = 0;
+		DeregisterWriteHandler(line->waitHandle);
+	}
+}
+
+static struct tpacket_block_desc *RxBlock(eth_packet_t *packetContext, int block)
+{
+	return (struct tpacket_block_desc *)(packetContext->ring + (size_t)block * PACKET_RX_BLOCK_SIZE);
+}
+
+static struct tpacket3_hdr *TxFrame(eth_packet_t *packetContext, int frame)
+{
+	return (struct tpacket3_hdr *)(packetContext->ring + (size_t)PACKET_RX_BLOCK_SIZE * PACKET_RX_BLOCK_COUNT + (size_t)frame * PACKET_FRAME_SIZE);
+}
+
+static void LogDrops(line_t *line, eth_packet_t *packetContext)
+{
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+
+	/* reading the statistics resets them, so each call reports the drops since the previous block */
+	if (getsockopt(packetContext->socket, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0 && stats.tp_drops > 0)
+	{
+		Log(LogEthPacketLine, LogError, "%u packets dropped since the last block on line %s\n", stats.tp_drops, line->name);
+	}
+}
+
+#endif
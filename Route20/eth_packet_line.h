@@ -0,0 +1,55 @@
+/* eth_packet_line.h: Ethernet line using Linux AF_PACKET rings
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+
+#include "packet.h"
+#include "line.h"
+
+#if !defined(ETH_PACKET_LINE_H)
+
+typedef struct
+{
+	int      socket;
+	byte    *ring;           /* receive blocks followed by transmit frames */
+	size_t   ringSize;
+	int      rxBlock;        /* receive block currently being handed out */
+	int      rxPacketsLeft;  /* packets in rxBlock not yet handed out, -1 if the block has not been opened */
+	byte    *rxNextPacket;
+	int      txFrame;        /* next transmit frame to fill */
+	int      txPending;      /* frames filled since the last send kick */
+	int      txKickQueued;
+	int      txWaitingForWrite; /* a kick found the socket busy and a write handler is registered to kick again */
+} eth_packet_t;
+
+int EthPacketLineStart(line_t *line);
+void EthPacketLineStop(line_t *line);
+packet_t *EthPacketLineReadPacket(line_t *line);
+int EthPacketLineWritePacket(line_t *line, packet_t *packet);
+
+#define ETH_PACKET_LINE_H
+#endif
@@ -28,8 +28,10 @@ in this Software without prior written authorization from the author.
 ------------------------------------------------------------------------------*/
 
 #pragma warning( push, 3 )
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <pcap.h>
 #if !defined(__VAX)
 #include <ctype.h>
@@ -47,6 +49,7 @@ in this Software without prior written authorization from the author.
 #include "eth_decnet.h"
 #include "eth_line.h"
 #include "eth_pcap_line.h"
+#include "node.h"
 
 #define ETH_MAX_DEVICE        20                        /* maximum ethernet devices */
 #define ETH_DEV_NAME_MAX     256                        /* maximum device name size */
@@ -55,6 +58,13 @@ in this Software without prior written authorization from the author.
 #define PCAP_ERRBUF_SIZE     256
 #define MIN_PACKET_SIZE      128
 
+typedef enum
+{
+    PcapSendOk,
+    PcapSendRetry,
+    PcapSendFailed
+} PcapSendResult;
+
 struct eth_list {
     int     num;
     char    name[ETH_DEV_NAME_MAX];
@@ -62,6 +72,12 @@ struct eth_list {
 };
 
 static int eth_translate(char* name, char* translated_name);
+static void BuildReceiveFilter(char* filter);
+static int SendFrame(line_t* line, u_char* data, int len);
+static void StoreFrame(u_char* user, const struct pcap_pkthdr* h, const u_char* bytes);
+static void LogPcapStats(rtimer_t* timer, char* name, void* context);
+static void DrainTransmitQueue(void* context);
+static void StopWaitingForWrite(line_t* line);
 
 int EthPcapLineStart(line_t* line)
 {
@@ -69,6 +85,7 @@ int EthPcapLineStart(line_t* line)
     eth_pcap_t* pcapContext = (eth_pcap_t*)line->lineContext;
     char devname[1024];
     char ebuf[PCAP_ERRBUF_SIZE];
+    char filter[256];
 
     Log(LogEthPcapLine, LogInfo, "Starting line %s\n", line->name);
 
@@ -88,10 +105,18 @@ int EthPcapLineStart(line_t* line)
             {
                 Log(LogEthPcapLine, LogError, "Error setting promiscuous mode\n");
             }
-            else if (pcap_set_immediate_mode(pcapContext->pcap, 1) != 0)
+            else if (pcap_set_immediate_mode(pcapContext->pcap, pcapContext->options.immediateMode) != 0)
             {
                 Log(LogEthPcapLine, LogError, "Could not set immediate mode\n");
             }
+            else if (!pcapContext->options.immediateMode && pcap_set_timeout(pcapContext->pcap, pcapContext->options.timeout) != 0)
+            {
+                Log(LogEthPcapLine, LogError, "Could not set timeout\n");
+            }
+            else if (pcapContext->options.bufferSize > 0 && pcap_set_buffer_size(pcapContext->pcap, pcapContext->options.bufferSize) != 0)
+            {
+                Log(LogEthPcapLine, LogError, "Could not set buffer size\n");
+            }
             else if (pcap_activate(pcapContext->pcap) != 0)
             {
                 Log(LogEthPcapLine, LogError, "Error activating packet capture\n");
@@ -128,16 +153,23 @@ int EthPcapLineStart(line_t* line)
                 else
                 {
                     struct bpf_program pgm;
-                    if (pcap_compile(pcapContext->pcap, &pgm, "decnet or moprc or mopdl", 1, PCAP_NETMASK_UNKNOWN) == -1)
+                    BuildReceiveFilter(filter);
+                    Log(LogEthPcapLine, LogDetail, "Receive filter for %s is: %s\n", line->name, filter);
+                    if (pcap_compile(pcapContext->pcap, &pgm, filter, 1, PCAP_NETMASK_UNKNOWN) == -1)
                     {
                         Log(LogEthPcapLine, LogError, "Failed to compile filter: %s\n", pcap_geterr(pcapContext->pcap));
                     }
-                    if (pcap_setfilter(pcapContext->pcap, &pgm) == -1) // TODO: change filter not to pass LAT.
+                    else if (pcap_setfilter(pcapContext->pcap, &pgm) == -1)
                     {
                         Log(LogEthPcapLine, LogError, "loading filter program");
+                        pcap_freecode(&pgm);
                     }
                     else
                     {
+                        pcap_freecode(&pgm);
+                        pcapContext->lastDropCount = 0;
+                        pcapContext->lastInterfaceDropCount = 0;
+                        pcapContext->statsTimer = CreateTimer("PcapStats", ClockNow() + SECS_TO_MS(PCAP_STATS_INTERVAL_SECS), SECS_TO_MS(PCAP_STATS_INTERVAL_SECS), line, LogPcapStats);
                         QueueImmediate(line, (void (*)(void*))(line->LineUp));
                         ans = 1;
                     }
@@ -164,98 +196,134 @@ void EthPcapLineStop(line_t* line)
 {
     eth_pcap_t* pcapContext = (eth_pcap_t*)line->lineContext;
 
+    StopWaitingForWrite(line);
+
+    if (pcapContext->statsTimer != NULL)
+    {
+        StopTimer(pcapContext->statsTimer);
+        pcapContext->statsTimer = NULL;
+    }
+
+    pcapContext->transmitCount = 0;
+    pcapContext->transmitRetries = 0;
+    pcapContext->receiveCount = 0;
+    pcapContext->receiveNext = 0;
     pcap_close(pcapContext->pcap);
 }
 
+void EthPcapInitialiseOptions(eth_pcap_options_t* options)
+{
+    options->bufferSize = 0;
+    options->immediateMode = 1;
+    options->timeout = PCAP_TIMEOUT_MS;
+    options->readBatch = PCAP_READ_BATCH;
+}
+
 packet_t* EthPcapLineReadPacket(line_t* line)
 {
     eth_pcap_t* pcapContext = (eth_pcap_t*)line->lineContext;
 
-    static int hadErrorLastTime = 0;
     static packet_t packet;
-    packet_t* ans;
-    struct pcap_pkthdr* h;
+    packet_t* ans = NULL;
     int pcapRes;
-    struct pcap_stat stats;
-    static unsigned int lastDroppedPacketCount = 0;
 
-    pcap_stats(pcapContext->pcap, &stats);
-    if (stats.ps_drop > lastDroppedPacketCount)
-    {
-        Log(LogEthPcapLine, LogError, "%u packets dropped since the last read on line %s\n", stats.ps_drop - lastDroppedPacketCount, line->name);
-        lastDroppedPacketCount = stats.ps_drop;
-    }
+    packet.IsDecnet = EthPcapIsDecnet;
 
-    do
+    /* frames are taken from pcap a batch at a time and then handed out one per call */
+    if (pcapContext->receiveNext >= pcapContext->receiveCount)
     {
-        if (hadErrorLastTime)
+        pcapContext->receiveCount = 0;
+        pcapContext->receiveNext = 0;
+        pcapRes = pcap_dispatch(pcapContext->pcap, pcapContext->options.readBatch, StoreFrame, (u_char*)pcapContext);
+        if (pcapRes < 0)
         {
-            Log(LogEthPcapLine, LogError, "About to try reading again after error last time around\n");
+            Log(LogEthPcapLine, LogError, "Error reading from pcap: %s\n", pcap_geterr(pcapContext->pcap));
+            pcapContext->hadReadError = 1;
         }
-
-        ans = &packet;
-        ans->IsDecnet = EthPcapIsDecnet;
-        pcapRes = pcap_next_ex(pcapContext->pcap, &h, (const u_char**)&packet.rawData);
-        if (hadErrorLastTime)
+        else if (pcapContext->hadReadError)
         {
             Log(LogEthPcapLine, LogError, "Completed reading again after error last time around\n");
+            pcapContext->hadReadError = 0;
         }
+    }
 
-        if (pcapRes == 1) /* success */
+    while (ans == NULL && pcapContext->receiveNext < pcapContext->receiveCount)
+    {
+        packet.rawData = pcapContext->receiveFrame[pcapContext->receiveNext];
+        packet.rawLen = pcapContext->receiveLength[pcapContext->receiveNext];
+        pcapContext->receiveNext++;
+
+        if (EthValidPacket(&packet))
         {
-            hadErrorLastTime = 0;
-            packet.rawLen = h->caplen;
-            if (EthValidPacket(&packet))
+            if (packet.IsDecnet(&packet))
             {
-                if (packet.IsDecnet(&packet))
-                {
-                    GetDecnetAddress((decnet_eth_address_t*)&packet.rawData[0], &packet.to);
-                    GetDecnetAddress((decnet_eth_address_t*)&packet.rawData[6], &packet.from);
-                    Log(LogEthPcapLine, LogVerbose, "Packet from : "); LogDecnetAddress(LogEthPcapLine, LogVerbose, &packet.from); Log(LogEthPcapLine, LogVerbose, " received on line %s\n", line->name);
-                    line->stats.validPacketsReceived++;
-                    EthSetPayload(&packet);
-                }
-                else
-                {
-                    Log(LogEthPcapLine, LogVerbose, "Discarding valid non-DECnet Ethernet packet from %s\n", line->name);
-                    ans = NULL;
-                }
+                GetDecnetAddress((decnet_eth_address_t*)&packet.rawData[0], &packet.to);
+                GetDecnetAddress((decnet_eth_address_t*)&packet.rawData[6], &packet.from);
+                Log(LogEthPcapLine, LogVerbose, "Packet from : "); LogDecnetAddress(LogEthPcapLine, LogVerbose, &packet.from); Log(LogEthPcapLine, LogVerbose, " received on line %s\n", line->name);
+                line->stats.validPacketsReceived++;
+                EthSetPayload(&packet);
+                ans = &packet;
             }
             else
             {
-                Log(LogEthPcapLine, LogWarning, "Discarding invalid Ethernet packet from %s\n", line->name);
-                line->stats.invalidPacketsReceived++;
-                ans = NULL;
+                Log(LogEthPcapLine, LogVerbose, "Discarding valid non-DECnet Ethernet packet from %s\n", line->name);
             }
         }
-        else if (pcapRes == 0) /* timeout */
-        {
-            hadErrorLastTime = 0;
-            Log(LogEthPcapLine, LogVerbose, "No data from %s\n", line->name);
-            ans = NULL;
-        }
         else
         {
-            Log(LogEthPcapLine, LogError, "Error reading from pcap: %s\n", pcap_geterr(pcapContext->pcap));
-            ans = NULL;
-            hadErrorLastTime = 1;
+            Log(LogEthPcapLine, LogWarning, "Discarding invalid Ethernet packet from %s\n", line->name);
+            line->stats.invalidPacketsReceived++;
         }
-    } while (pcapRes == 1 && ans == NULL); /* keep reading packets if we have discarded a loopback packet */
+    }
 
     return ans;
 }
 
+static void StoreFrame(u_char* user, const struct pcap_pkthdr* h, const u_char* bytes)
+{
+    eth_pcap_t* pcapContext = (eth_pcap_t*)user;
+    int len = (h->caplen > PCAP_FRAME_LEN) ? PCAP_FRAME_LEN : (int)h->caplen;
+
+    /* pcap only guarantees the frame data until the callback returns */
+    if (pcapContext->receiveCount < PCAP_MAX_READ_BATCH)
+    {
+        memcpy(pcapContext->receiveFrame[pcapContext->receiveCount], bytes, len);
+        pcapContext->receiveLength[pcapContext->receiveCount] = len;
+        pcapContext->receiveCount++;
+    }
+}
+
+static void LogPcapStats(rtimer_t* timer, char* name, void* context)
+{
+    line_t* line = (line_t*)context;
+    eth_pcap_t* pcapContext = (eth_pcap_t*)line->lineContext;
+    struct pcap_stat stats;
+
+    if (pcap_stats(pcapContext->pcap, &stats) == 0)
+    {
+        if (stats.ps_drop > pcapContext->lastDropCount)
+        {
+            Log(LogEthPcapLine, LogError, "%u packets dropped by pcap on line %s in the last %d seconds\n", stats.ps_drop - pcapContext->lastDropCount, line->name, PCAP_STATS_INTERVAL_SECS);
+        }
+
+        if (stats.ps_ifdrop > pcapContext->lastInterfaceDropCount)
+        {
+            Log(LogEthPcapLine, LogError, "%u packets dropped by the interface on line %s in the last %d seconds\n", stats.ps_ifdrop - pcapContext->lastInterfaceDropCount, line->name, PCAP_STATS_INTERVAL_SECS);
+        }
+
+        pcapContext->lastDropCount = stats.ps_drop;
+        pcapContext->lastInterfaceDropCount = stats.ps_ifdrop;
+    }
+}
+
 int EthPcapLineWritePacket(line_t* line, packet_t* packet)
 {
+    int ans = 0;
     eth_pcap_t* pcapContext = (eth_pcap_t*)line->lineContext;
     u_char smallBuf[MIN_PACKET_SIZE];
     u_char* data = packet->rawData;
     int len = packet->rawLen;
-    int retries = 0;
-    char* pcapErr;
-
-#define PCAP_WARN_RETRY 10
-#define PCAP_ERROR_RETRY 50
+    int sendResult = PcapSendOk;
 
     if (packet->rawLen < MIN_PACKET_SIZE)
     {
@@ -265,32 +333,153 @@ int EthPcapLineWritePacket(line_t* line, packet_t* packet)
         len = MIN_PACKET_SIZE;
     }
 
-    while (pcap_sendpacket(pcapContext->pcap, (const u_char*)data, len) != 0 && retries <= PCAP_ERROR_RETRY)
+    /* frames already waiting must go first, so only try the device directly when nothing is queued */
+    if (pcapContext->transmitCount == 0)
+    {
+        sendResult = SendFrame(line, data, len);
+    }
+
+    if (sendResult == PcapSendOk && pcapContext->transmitCount == 0)
+    {
+        ans = 1;
+    }
+    else if (sendResult == PcapSendFailed)
+    {
+        Log(LogEthPcapLine, LogError, "Error writing to %s using pcap: %s\n", line->name, pcap_geterr(pcapContext->pcap));
+        line->stats.packetsDiscardedTransmit++;
+    }
+    else if (pcapContext->transmitCount >= PCAP_TRANSMIT_QUEUE_LIMIT || len > PCAP_FRAME_LEN)
+    {
+        Log(LogEthPcapLine, LogWarning, "Transmit queue full on %s, discarding packet\n", line->name);
+        line->stats.packetsDiscardedTransmit++;
+    }
+    else
+    {
+        int slot = (pcapContext->transmitHead + pcapContext->transmitCount) % PCAP_TRANSMIT_QUEUE_LIMIT;
+        memcpy(pcapContext->transmitFrame[slot], data, len);
+        pcapContext->transmitLength[slot] = len;
+        pcapContext->transmitCount++;
+        line->stats.packetsQueuedForRetry++;
+        if (!pcapContext->transmitWaitingForWrite)
+        {
+            RegisterWriteHandler(line->waitHandle, line, DrainTransmitQueue);
+            pcapContext->transmitWaitingForWrite = 1;
+        }
+
+        ans = 1;
+    }
+
+    return ans;
+}
+
+static int SendFrame(line_t* line, u_char* data, int len)
+{
+    int ans = PcapSendOk;
+    eth_pcap_t* pcapContext = (eth_pcap_t*)line->lineContext;
+
+    if (pcap_sendpacket(pcapContext->pcap, (const u_char*)data, len) != 0)
+    {
+        /* Only a full socket or device queue is worth retrying, anything else fails the same way each time. The error
+           text varies between libpcap versions, so the decision uses errno, which pcap leaves as the send set it. */
+#if defined(WIN32)
+        ans = PcapSendFailed;
+#else
+        int err = errno;
+        if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS || err == EINTR)
+        {
+            Log(LogEthPcapLine, LogDetail, "Device %s busy, will retry: %s\n", line->name, pcap_geterr(pcapContext->pcap));
+            ans = PcapSendRetry;
+        }
+        else
+        {
+            ans = PcapSendFailed;
+        }
+#endif
+    }
+
+    return ans;
+}
+
+/* Called each time the device can be written while frames are queued. A frame is given PCAP_TRANSMIT_MAX_RETRIES
+   attempts, after which it is discarded so that a device which keeps refusing it cannot hold up the frames behind it. */
+static void DrainTransmitQueue(void* context)
+{
+    line_t* line = (line_t*)context;
+    eth_pcap_t* pcapContext = (eth_pcap_t*)line->lineContext;
+    int sendResult = PcapSendOk;
+    int head;
+
+    while (pcapContext->transmitCount > 0 && sendResult != PcapSendRetry)
     {
-        pcapErr = pcap_geterr(pcapContext->pcap);
-        if (strcpy(pcapErr, "Bad file descriptor") == 0)
+        head = pcapContext->transmitHead;
+        sendResult = SendFrame(line, pcapContext->transmitFrame[head], pcapContext->transmitLength[head]);
+        if (sendResult == PcapSendRetry && ++pcapContext->transmitRetries >= PCAP_TRANSMIT_MAX_RETRIES)
+        {
+            Log(LogEthPcapLine, LogWarning, "Device %s refused a queued packet %d times, discarding it\n", line->name, pcapContext->transmitRetries);
+            line->stats.packetsDiscardedTransmit++;
+            sendResult = PcapSendOk;
+        }
+        else if (sendResult == PcapSendFailed)
         {
-            retries = PCAP_ERROR_RETRY + 1;
-            break;
+            Log(LogEthPcapLine, LogError, "Error writing queued packet to %s using pcap: %s\n", line->name, pcap_geterr(pcapContext->pcap));
+            line->stats.packetsDiscardedTransmit++;
         }
 
-        if (retries != 0 && (retries % PCAP_WARN_RETRY) == 0)
+        if (sendResult != PcapSendRetry)
         {
-            // TODO: Orderly shutdown hangs if this happens
-            Log(LogEthPcapLine, LogWarning, "Experiencing problems writing to %s using pcap, retrying: %s\n", line->name, pcapErr);
+            pcapContext->transmitHead = (head + 1) % PCAP_TRANSMIT_QUEUE_LIMIT;
+            pcapContext->transmitCount--;
+            pcapContext->transmitRetries = 0;
         }
+    }
 
-        Sleep(1);
-        retries++;
+    if (pcapContext->transmitCount == 0)
+    {
+        StopWaitingForWrite(line);
     }
+}
 
-    if (retries > PCAP_ERROR_RETRY)
+static void StopWaitingForWrite(line_t* line)
+{
+    eth_pcap_t* pcapContext = (eth_pcap_t*)line->lineContext;
+
+    if (pcapContext->transmitWaitingForWrite)
     {
-        Log(LogEthPcapLine, LogError, "Error writing to %s using pcap: %s\n", line->name, pcap_geterr(pcapContext->pcap));
-        return 0; // TODO: Not sure we handle return value 0, make sure we do something sensible with it, kill the circuit, try to bring it up again.
+        DeregisterWriteHandler(line->waitHandle);
+        pcapContext->transmitWaitingForWrite = 0;
+    }
+}
+
+/*
+The filter runs in the kernel so that frames the circuit would only discard are never copied to user space. It
+accepts DECnet frames sent to this node's own address or to the multicast addresses that IsAddressedToThisNode
+accepts for the node's level, and rejects frames this node sent. MOP is not handled, so it is not passed either.
+*/
+static void BuildReceiveFilter(char* filter)
+{
+    decnet_eth_address_t self;
+    char mac[18];
+
+    SetDecnetAddress(&self, nodeInfo.address);
+    sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", self.id[0], self.id[1], self.id[2], self.id[3], self.id[4], self.id[5]);
+    sprintf(filter, "decnet and not ether src %s and (ether dst %s", mac, mac);
+
+    if (nodeInfo.level == 1 || nodeInfo.level == 2)
+    {
+        strcat(filter, " or ether dst ab:00:00:03:00:00"); /* all routers */
+    }
+
+    if (nodeInfo.level == 2)
+    {
+        strcat(filter, " or ether dst 09:00:2b:02:00:00"); /* all level 2 routers */
+    }
+
+    if (nodeInfo.level == 3)
+    {
+        strcat(filter, " or ether dst ab:00:00:04:00:00"); /* all end nodes */
     }
 
-    return 1;
+    strcat(filter, ")");
 }
 
 /*
@@ -31,13 +31,47 @@
 
 #if !defined(ETH_PCAP_LINE_H)
 
+#include "timer.h"
+
+#define PCAP_TRANSMIT_QUEUE_LIMIT 32   /* frames held for retry when the device cannot take them */
+#define PCAP_FRAME_LEN            1518
+#define PCAP_TRANSMIT_MAX_RETRIES 8    /* attempts at a frame the device keeps refusing before it is discarded */
+#define PCAP_READ_BATCH           16   /* default maximum frames taken from pcap in one read */
+#define PCAP_MAX_READ_BATCH       64
+#define PCAP_TIMEOUT_MS           10   /* default read timeout when immediate mode is off */
+#define PCAP_STATS_INTERVAL_SECS  60
+
 typedef struct pcap pcap_t;
 
+typedef struct eth_pcap_options
+{
+	int bufferSize;    /* kernel buffer size in bytes, 0 leaves the pcap default */
+	int immediateMode; /* deliver each frame as it arrives rather than waiting for the timeout or a full buffer */
+	int timeout;       /* ms, only applies when immediate mode is off */
+	int readBatch;     /* maximum frames taken from pcap in one read */
+} eth_pcap_options_t;
+
 typedef struct
 {
-	pcap_t *pcap;
+	pcap_t   *pcap;
+	eth_pcap_options_t options;
+	byte      receiveFrame[PCAP_MAX_READ_BATCH][PCAP_FRAME_LEN];
+	int       receiveLength[PCAP_MAX_READ_BATCH];
+	int       receiveCount;
+	int       receiveNext;
+	int       hadReadError;
+	rtimer_t *statsTimer;
+	unsigned int lastDropCount;
+	unsigned int lastInterfaceDropCount;
+	byte      transmitFrame[PCAP_TRANSMIT_QUEUE_LIMIT][PCAP_FRAME_LEN];
+	int       transmitLength[PCAP_TRANSMIT_QUEUE_LIMIT];
+	int       transmitHead;
+	int       transmitCount;
+	int       transmitRetries;         /* failed attempts at the frame at the head of the queue */
+	int       transmitWaitingForWrite; /* a write handler is registered to drain the queue */
 } eth_pcap_t;
 
+void EthPcapInitialiseOptions(eth_pcap_options_t *options);
 int EthPcapLineStart(line_t *line);
 void EthPcapLineStop(line_t *line);
 packet_t *EthPcapLineReadPacket(line_t *line);
@@ -38,6 +38,7 @@ in this Software without prior written authorization from the author.
 static void ProcessDnsTimer(rtimer_t *timer, char *name, void *context);
 static void ProcessDnsResponse(byte *address, void *context);
 static int  CheckSourceAddress(sockaddr_t *receivedFrom, eth_sock_t *context);
+static void FlushSendBatch(void *context);
 
 int EthSockLineStart(line_t *line)
 {
@@ -45,25 +46,23 @@ int EthSockLineStart(line_t *line)
 	eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
 	sockaddr_t *destinationAddress;
 
-    InitialiseSocket(&sockContext->socket, line->name);
 	destinationAddress = GetSocketAddressFromName(sockContext->destinationHostName, sockContext->destinationPort);
 
 	if (destinationAddress != NULL)
 	{
-		ans = OpenUdpSocket(&sockContext->socket, sockContext->receivePort);
+		memcpy(&sockContext->destinationAddress, destinationAddress, sizeof(sockContext->destinationAddress));
+		ans = EthSockListenerOpen(line) != NULL;
 		if (ans)
 		{
 			if (DnsConfig.dnsConfigured)
 			{
-				time_t now;
+				clock_ms_t now;
 
-				time(&now);
-				CreateTimer("DNS", now + DnsConfig.pollPeriod, DnsConfig.pollPeriod, line, ProcessDnsTimer);
+				now = ClockNow();
+				CreateTimer("DNS", now + SECS_TO_MS(DnsConfig.pollPeriod), SECS_TO_MS(DnsConfig.pollPeriod), line, ProcessDnsTimer);
 			}
 
-			line->waitHandle = sockContext->socket.waitHandle;
-			RegisterEventHandler(line->waitHandle, "EthSock Line", line, line->LineWaitEventHandler);
-			memcpy(&sockContext->destinationAddress, destinationAddress, sizeof(sockContext->destinationAddress));
+			line->waitHandle = sockContext->listener->socket.waitHandle;
 			QueueImmediate(line, (void (*)(void *))(line->LineUp));
 		}
 	}
@@ -82,8 +81,8 @@ int EthSockLineStart(line_t *line)
 
 void EthSockLineStop(line_t *line)
 {
-	eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
-	CloseSocket(&sockContext->socket);
+	FlushSendBatch(line);
+	EthSockListenerClose(line);
 }
 
 packet_t *EthSockLineReadPacket(line_t *line)
@@ -91,14 +90,27 @@ packet_t *EthSockLineReadPacket(line_t *line)
 	packet_t *packet = NULL;
 
     eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
+	datagram_batch_t *batch = &sockContext->receiveBatch;
 	static packet_t sockPacket;
-	sockaddr_t receivedFrom;
+	sockaddr_t *receivedFrom;
 	
 	sockPacket.IsDecnet = EthSockIsDecnet;
 
-	if (ReadFromDatagramSocket(&sockContext->socket, &sockPacket, &receivedFrom))
+	/* datagrams are read from the socket a batch at a time and then handed out one per call, when the
+	   socket is shared with other bridge lines the listener fills the batch instead */
+	if (batch->next >= batch->count && sockContext->listener != NULL && sockContext->listener->peerCount == 1)
+	{
+		ReadBatchFromDatagramSocket(&sockContext->listener->socket, batch);
+	}
+
+	while (packet == NULL && batch->next < batch->count)
 	{
-		if (CheckSourceAddress(&receivedFrom, sockContext))
+		sockPacket.rawData = batch->buffer[batch->next];
+		sockPacket.rawLen = batch->length[batch->next];
+		receivedFrom = &batch->address[batch->next];
+		batch->next++;
+
+		if (CheckSourceAddress(receivedFrom, sockContext))
 		{
 			if (EthValidPacket(&sockPacket))
 			{
@@ -136,11 +148,51 @@ int EthSockLineWritePacket(line_t *line, packet_t *packet)
 	int ans = 0;
 	eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
 
-	ans = SendToSocket(&sockContext->socket, &sockContext->destinationAddress, packet);
+	datagram_batch_t *batch = &sockContext->sendBatch;
+
+	if (sockContext->listener == NULL)
+	{
+		Log(LogEthSockLine, LogError, "Line %s is not started, cannot write packet\n", line->name);
+	}
+	else if (packet->rawLen > MAX_DATAGRAM_LEN)
+	{
+		FlushSendBatch(line);
+		ans = SendToSocket(&sockContext->listener->socket, &sockContext->destinationAddress, packet);
+	}
+	else
+	{
+		/* frames written during one pass of the event loop, such as a burst of routing messages, go out in a single send */
+		memcpy(batch->buffer[batch->count], packet->rawData, packet->rawLen);
+		batch->length[batch->count] = packet->rawLen;
+		batch->count++;
+		ans = 1;
+
+		if (batch->count >= DATAGRAM_BATCH_SIZE)
+		{
+			ans = SendBatchToSocket(&sockContext->listener->socket, &sockContext->destinationAddress, batch);
+		}
+		else if (!sockContext->sendFlushQueued)
+		{
+			sockContext->sendFlushQueued = 1;
+			QueueImmediate(line, FlushSendBatch);
+		}
+	}
 
 	return ans;
 }
 
+static void FlushSendBatch(void *context)
+{
+	line_t *line = (line_t *)context;
+	eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
+
+	sockContext->sendFlushQueued = 0;
+	if (sockContext->sendBatch.count > 0 && sockContext->listener != NULL)
+	{
+		SendBatchToSocket(&sockContext->listener->socket, &sockContext->destinationAddress, &sockContext->sendBatch);
+	}
+}
+
 static void ProcessDnsTimer(rtimer_t *timer, char *name, void *context)
 {
 	line_t *line = (line_t *)context;
@@ -158,7 +210,17 @@ static void ProcessDnsResponse(byte *address, void *context)
 	if (memcmp(&sockContext->destinationAddress, newAddress, sizeof(sockaddr_t)) != 0)
 	{
 	    Log(LogEthSockLine, LogInfo, "Changed IP address for %s\n", line->name);
-	    memcpy(&sockContext->destinationAddress, newAddress, sizeof(sockContext->destinationAddress));
+	    if (sockContext->listener != NULL)
+	    {
+	        /* the listener hashes peers by address, so move this line to its new bucket */
+	        EthSockListenerRemovePeer(sockContext->listener, line);
+	        memcpy(&sockContext->destinationAddress, newAddress, sizeof(sockContext->destinationAddress));
+	        EthSockListenerAddPeer(sockContext->listener, line);
+	    }
+	    else
+	    {
+	        memcpy(&sockContext->destinationAddress, newAddress, sizeof(sockContext->destinationAddress));
+	    }
 	}
 }
 
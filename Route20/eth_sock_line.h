@@ -29,17 +29,23 @@
 #include "packet.h"
 #include "socket.h"
 #include "eth_circuit.h"
+#include "eth_sock_listener.h"
 
 #if !defined(ETH_SOCK_LINE_H)
 
 typedef struct
 {
-	socket_t socket;
+	eth_sock_listener_t *listener;
+	line_t *nextPeer; /* next line in the listener's peer hash bucket */
 	uint16 receivePort;
 	uint16 destinationPort;
 	char *destinationHostName;
 	sockaddr_t destinationAddress;
     int loggedSourceError;
+	datagram_batch_t receiveBatch;
+	datagram_batch_t sendBatch;
+	int sendFlushQueued;
+	int receiveNotified;
 } eth_sock_t;
 
 int EthSockLineStart(line_t *line);
@@ -0,0 +1,252 @@
+/* eth_sock_listener.c: Shared UDP listener for bridge lines
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+
+#include <stdlib.h>
+#include <memory.h>
+#include "platform.h"
+#include "route20.h"
+#include "socket.h"
+#include "eth_sock_line.h"
+#include "eth_sock_listener.h"
+
+/* Bridge lines configured with the same receive port share one listener, and so one socket. Datagrams
+   are read from it in batches and demultiplexed to the owning line by source address. A listener with
+   only one peer hands the socket to that line to read directly, as there is nothing to demultiplex. */
+
+static eth_sock_listener_t *listeners = NULL;
+
+static eth_sock_listener_t *FindListener(uint16 receivePort);
+static void ProcessListenerEvent(void *context);
+static line_t *FindPeer(eth_sock_listener_t *listener, sockaddr_t *address);
+static line_t *FirstPeer(eth_sock_listener_t *listener);
+static unsigned int HashAddress(sockaddr_t *address);
+
+eth_sock_listener_t *EthSockListenerOpen(line_t *line)
+{
+	eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
+	eth_sock_listener_t *ans = FindListener(sockContext->receivePort);
+
+	if (ans == NULL)
+	{
+		ans = (eth_sock_listener_t *)calloc(1, sizeof(eth_sock_listener_t));
+		ans->receivePort = sockContext->receivePort;
+		InitialiseSocket(&ans->socket, line->name);
+		if (OpenUdpSocket(&ans->socket, ans->receivePort))
+		{
+			RegisterEventHandler(ans->socket.waitHandle, "EthSock Listener", ans, ProcessListenerEvent);
+			ans->next = listeners;
+			listeners = ans;
+		}
+		else
+		{
+			free(ans);
+			ans = NULL;
+		}
+	}
+	else
+	{
+		Log(LogEthSockLine, LogInfo, "Line %s shares port %d with %d other bridge line(s)\n", line->name, ans->receivePort, ans->peerCount);
+	}
+
+	if (ans != NULL)
+	{
+		sockContext->listener = ans;
+		EthSockListenerAddPeer(ans, line);
+	}
+
+	return ans;
+}
+
+void EthSockListenerClose(line_t *line)
+{
+	eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
+	eth_sock_listener_t *listener = sockContext->listener;
+	eth_sock_listener_t **link;
+
+	if (listener != NULL)
+	{
+		EthSockListenerRemovePeer(listener, line);
+		sockContext->listener = NULL;
+
+		if (listener->peerCount == 0)
+		{
+			for (link = &listeners; *link != NULL; link = &(*link)->next)
+			{
+				if (*link == listener)
+				{
+					*link = listener->next;
+					break;
+				}
+			}
+
+			DeregisterEventHandler(listener->socket.waitHandle);
+			CloseSocket(&listener->socket);
+			free(listener);
+		}
+	}
+}
+
+void EthSockListenerAddPeer(eth_sock_listener_t *listener, line_t *line)
+{
+	eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
+	unsigned int bucket = HashAddress(&sockContext->destinationAddress);
+
+	sockContext->nextPeer = listener->peers[bucket];
+	listener->peers[bucket] = line;
+	listener->peerCount++;
+}
+
+void EthSockListenerRemovePeer(eth_sock_listener_t *listener, line_t *line)
+{
+	eth_sock_t *sockContext = (eth_sock_t *)line->lineContext;
+	unsigned int bucket = HashAddress(&sockContext->destinationAddress);
+	line_t **link;
+
+	for (link = &listener->peers[bucket]; *link != NULL; link = &((eth_sock_t *)(*link)->lineContext)->nextPeer)
+	{
+		if (*link == line)
+		{
+			*link = sockContext->nextPeer;
+			sockContext->nextPeer = NULL;
+			listener->peerCount--;
+			break;
+		}
+	}
+}
+
+static eth_sock_listener_t *FindListener(uint16 receivePort)
+{
+	eth_sock_listener_t *ans = listeners;
+
+	while (ans != NULL && ans->receivePort != receivePort)
+	{
+		ans = ans->next;
+	}
+
+	return ans;
+}
+
+static void ProcessListenerEvent(void *context)
+{
+	eth_sock_listener_t *listener = (eth_sock_listener_t *)context;
+	datagram_batch_t *batch = &listener->receiveBatch;
+	line_t *notify[DATAGRAM_BATCH_SIZE];
+	int notifyCount = 0;
+	line_t *line;
+	eth_sock_t *sockContext;
+	int i;
+
+	if (listener->peerCount == 1)
+	{
+		line = FirstPeer(listener);
+		line->LineWaitEventHandler(line);
+	}
+	else
+	{
+		ReadBatchFromDatagramSocket(&listener->socket, batch);
+		for (i = 0; i < batch->count; i++)
+		{
+			line = FindPeer(listener, &batch->address[i]);
+			if (line == NULL)
+			{
+				if (!listener->loggedSourceError)
+				{
+					Log(LogEthSockLine, LogError, "Security, dropping packet from unrecognised source %u.%u.%u.%u on port %d\n", batch->address[i].sa_data[2] & 0xFF, batch->address[i].sa_data[3] & 0xFF, batch->address[i].sa_data[4] & 0xFF, batch->address[i].sa_data[5] & 0xFF, listener->receivePort);
+					listener->loggedSourceError = 1;
+				}
+			}
+			else
+			{
+				sockContext = (eth_sock_t *)line->lineContext;
+				if (!AppendToDatagramBatch(&sockContext->receiveBatch, batch->buffer[i], batch->length[i], &batch->address[i]))
+				{
+					Log(LogEthSockLine, LogWarning, "Receive queue full, discarding packet for %s\n", line->name);
+				}
+				else if (!sockContext->receiveNotified)
+				{
+					sockContext->receiveNotified = 1;
+					notify[notifyCount++] = line;
+				}
+			}
+		}
+
+		for (i = 0; i < notifyCount; i++)
+		{
+			((eth_sock_t *)notify[i]->lineContext)->receiveNotified = 0;
+			notify[i]->LineWaitEventHandler(notify[i]);
+		}
+	}
+}
+
+static line_t *FindPeer(eth_sock_listener_t *listener, sockaddr_t *address)
+{
+	line_t *ans = listener->peers[HashAddress(address)];
+	eth_sock_t *sockContext;
+
+	while (ans != NULL)
+	{
+		sockContext = (eth_sock_t *)ans->lineContext;
+		if (address->sa_family == sockContext->destinationAddress.sa_family && memcmp(address->sa_data, sockContext->destinationAddress.sa_data, sizeof(address->sa_data)) == 0)
+		{
+			break;
+		}
+
+		ans = sockContext->nextPeer;
+	}
+
+	return ans;
+}
+
+static line_t *FirstPeer(eth_sock_listener_t *listener)
+{
+	line_t *ans = NULL;
+	int i;
+
+	for (i = 0; ans == NULL && i < ETH_SOCK_LISTENER_BUCKETS; i++)
+	{
+		ans = listener->peers[i];
+	}
+
+	return ans;
+}
+
+static unsigned int HashAddress(sockaddr_t *address)
+{
+	/* FNV-1a over the port and IPv4 address held in the first six bytes of sa_data */
+	unsigned long hash = 2166136261UL;
+	int i;
+
+	for (i = 0; i < 6; i++)
+	{
+		hash ^= (byte)address->sa_data[i];
+		hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+	}
+
+	return (unsigned int)(hash & (ETH_SOCK_LISTENER_BUCKETS - 1));
+}
@@ -0,0 +1,56 @@
+/* eth_sock_listener.h: Shared UDP listener for bridge lines
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+
+#include "socket.h"
+#include "line.h"
+
+#if !defined(ETH_SOCK_LISTENER_H)
+
+#define ETH_SOCK_LISTENER_BUCKETS 64 /* peer hash buckets, must be a power of 2 */
+
+typedef struct eth_sock_listener *eth_sock_listener_ptr;
+
+typedef struct eth_sock_listener
+{
+	uint16                receivePort;
+	socket_t              socket;
+	int                   peerCount;
+	line_t               *peers[ETH_SOCK_LISTENER_BUCKETS];
+	datagram_batch_t      receiveBatch;
+	int                   loggedSourceError;
+	eth_sock_listener_ptr next;
+} eth_sock_listener_t;
+
+eth_sock_listener_t *EthSockListenerOpen(line_t *line);
+void EthSockListenerClose(line_t *line);
+void EthSockListenerAddPeer(eth_sock_listener_t *listener, line_t *line);
+void EthSockListenerRemovePeer(eth_sock_listener_t *listener, line_t *line);
+
+#define ETH_SOCK_LISTENER_H
+#endif
@@ -0,0 +1,312 @@
+/* eth_tap_line.c: Ethernet line using a Linux TAP device
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+#include "platform.h"
+
+#if defined(USE_TAP)
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+#include "route20.h"
+#include "timer.h"
+#include "eth_decnet.h"
+#include "eth_tap_line.h"
+
+/* A TAP device gives a purely local Ethernet, for example to an emulator on the same host, without a physical
+   interface in promiscuous mode. With more than one queue the device is opened once per queue and all of them
+   are read, frames are written to a queue chosen from the destination address so each destination sees them in
+   order. */
+
+#define TAP_MIN_FRAME_SIZE 60
+
+static int OpenQueue(line_t *line, int queue);
+static int BringUp(line_t *line);
+static void FillBatch(eth_tap_t *tapContext);
+
+int EthTapLineStart(line_t *line)
+{
+	int ans = 1;
+	eth_tap_t *tapContext = (eth_tap_t *)line->lineContext;
+	int i;
+
+	Log(LogEthTapLine, LogInfo, "Starting line %s with %d queue(s)\n", line->name, tapContext->queueCount);
+
+	tapContext->count = 0;
+	tapContext->next = 0;
+	tapContext->nextQueue = 0;
+	for (i = 0; i < tapContext->queueCount; i++)
+	{
+		tapContext->fd[i] = -1;
+	}
+
+	for (i = 0; ans && i < tapContext->queueCount; i++)
+	{
+		ans = OpenQueue(line, i);
+	}
+
+	if (ans)
+	{
+		ans = BringUp(line);
+	}
+
+	if (ans)
+	{
+		line->waitHandle = tapContext->fd[0];
+		for (i = 0; i < tapContext->queueCount; i++)
+		{
+			RegisterEventHandler(tapContext->fd[i], "EthTap Line", line, line->LineWaitEventHandler);
+		}
+
+		tapContext->registered = 1;
+
+		QueueImmediate(line, (void (*)(void *))(line->LineUp));
+	}
+	else
+	{
+		Log(LogEthTapLine, LogError, "Could not open circuit for %s\n", line->name);
+		EthTapLineStop(line);
+	}
+
+	return ans;
+}
+
+void EthTapLineStop(line_t *line)
+{
+	eth_tap_t *tapContext = (eth_tap_t *)line->lineContext;
+	int i;
+
+	for (i = 0; i < tapContext->queueCount; i++)
+	{
+		if (tapContext->fd[i] != -1)
+		{
+			if (tapContext->registered)
+			{
+				DeregisterEventHandler(tapContext->fd[i]);
+			}
+
+			close(tapContext->fd[i]);
+			tapContext->fd[i] = -1;
+		}
+	}
+
+	tapContext->registered = 0;
+}
+
+packet_t *EthTapLineReadPacket(line_t *line)
+{
+	eth_tap_t *tapContext = (eth_tap_t *)line->lineContext;
+	static packet_t packet;
+	packet_t *ans = NULL;
+
+	packet.IsDecnet = EthPcapIsDecnet;
+
+	if (tapContext->next >= tapContext->count)
+	{
+		FillBatch(tapContext);
+	}
+
+	while (ans == NULL && tapContext->next < tapContext->count)
+	{
+		packet.rawData = tapContext->buffer[tapContext->next];
+		packet.rawLen = tapContext->length[tapContext->next];
+		tapContext->next++;
+
+		if (EthValidPacket(&packet))
+		{
+			if (packet.IsDecnet(&packet))
+			{
+				GetDecnetAddress((decnet_eth_address_t *)&packet.rawData[0], &packet.to);
+				GetDecnetAddress((decnet_eth_address_t *)&packet.rawData[6], &packet.from);
+				if (IsLoggable(LogEthTapLine, LogVerbose))
+				{
+					Log(LogEthTapLine, LogVerbose, "Packet from : "); LogDecnetAddress(LogEthTapLine, LogVerbose, &packet.from); Log(LogEthTapLine, LogVerbose, " received on line %s\n", line->name);
+				}
+				line->stats.validPacketsReceived++;
+				EthSetPayload(&packet);
+				ans = &packet;
+			}
+			else
+			{
+				Log(LogEthTapLine, LogVerbose, "Discarding valid non-DECnet Ethernet packet from %s\n", line->name);
+			}
+		}
+		else
+		{
+			Log(LogEthTapLine, LogWarning, "Discarding invalid Ethernet packet from %s\n", line->name);
+			line->stats.invalidPacketsReceived++;
+		}
+	}
+
+	return ans;
+}
+
+int EthTapLineWritePacket(line_t *line, packet_t *packet)
+{
+	int ans = 0;
+	eth_tap_t *tapContext = (eth_tap_t *)line->lineContext;
+	static byte padding[TAP_MIN_FRAME_SIZE];
+	struct iovec iov[2];
+	int iovCount = 1;
+	int queue = 0;
+
+	/* short frames are padded from a separate buffer rather than copied */
+	iov[0].iov_base = packet->rawData;
+	iov[0].iov_len = packet->rawLen;
+	if (packet->rawLen < TAP_MIN_FRAME_SIZE)
+	{
+		iov[1].iov_base = padding;
+		iov[1].iov_len = TAP_MIN_FRAME_SIZE - packet->rawLen;
+		iovCount = 2;
+	}
+
+	if (tapContext->queueCount > 1 && packet->rawLen >= 6)
+	{
+		queue = (packet->rawData[4] ^ packet->rawData[5]) % tapContext->queueCount;
+	}
+
+	if (tapContext->fd[queue] == -1)
+	{
+		Log(LogEthTapLine, LogError, "Line %s is not started, cannot write packet\n", line->name);
+	}
+	else if (writev(tapContext->fd[queue], iov, iovCount) == -1)
+	{
+		Log(LogEthTapLine, (errno == EAGAIN) ? LogWarning : LogError, "Error writing to %s: %s\n", line->name, strerror(errno));
+	}
+	else
+	{
+		ans = 1;
+	}
+
+	return ans;
+}
+
+static int OpenQueue(line_t *line, int queue)
+{
+	int ans = 0;
+	eth_tap_t *tapContext = (eth_tap_t *)line->lineContext;
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, line->name, IFNAMSIZ - 1);
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (tapContext->queueCount > 1)
+	{
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	}
+
+	if ((tapContext->fd[queue] = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) == -1)
+	{
+		Log(LogEthTapLine, LogError, "Error opening /dev/net/tun: %s\n", strerror(errno));
+	}
+	else if (ioctl(tapContext->fd[queue], TUNSETIFF, &ifr) == -1)
+	{
+		Log(LogEthTapLine, LogError, "Error attaching queue %d to TAP device %s: %s\n", queue, line->name, strerror(errno));
+	}
+	else
+	{
+		ans = 1;
+	}
+
+	return ans;
+}
+
+static int BringUp(line_t *line)
+{
+	int ans = 0;
+	struct ifreq ifr;
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, line->name, IFNAMSIZ - 1);
+
+	if (sock == -1 || ioctl(sock, SIOCGIFFLAGS, &ifr) == -1)
+	{
+		Log(LogEthTapLine, LogError, "Error reading flags of %s: %s\n", line->name, strerror(errno));
+	}
+	else if ((ifr.ifr_flags & IFF_UP) == 0)
+	{
+		ifr.ifr_flags |= IFF_UP;
+		if (ioctl(sock, SIOCSIFFLAGS, &ifr) == -1)
+		{
+			Log(LogEthTapLine, LogError, "Error bringing %s up: %s\n", line->name, strerror(errno));
+		}
+		else
+		{
+			ans = 1;
+		}
+	}
+	else
+	{
+		ans = 1;
+	}
+
+	if (sock != -1)
+	{
+		close(sock);
+	}
+
+	return ans;
+}
+
+static void FillBatch(eth_tap_t *tapContext)
+{
+	int queue;
+	int i;
+	int len;
+	int more = 1;
+
+	/* take one frame from each queue in turn until the batch is full or every queue is empty */
+	tapContext->count = 0;
+	tapContext->next = 0;
+	while (more && tapContext->count < TAP_BATCH_SIZE)
+	{
+		more = 0;
+		for (i = 0; i < tapContext->queueCount && tapContext->count < TAP_BATCH_SIZE; i++)
+		{
+			queue = (tapContext->nextQueue + i) % tapContext->queueCount;
+			len = (int)read(tapContext->fd[queue], tapContext->buffer[tapContext->count], TAP_FRAME_LEN);
+			if (len > 0)
+			{
+				tapContext->length[tapContext->count++] = len;
+				more = 1;
+			}
+		}
+	}
+
+	tapContext->nextQueue = (tapContext->nextQueue + 1) % tapContext->queueCount;
+}
+
+#endif
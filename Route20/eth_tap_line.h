@@ -0,0 +1,56 @@
+/* eth_tap_line.h: Ethernet line using a Linux TAP device
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+#include "packet.h"
+#include "line.h"
+
+#if !defined(ETH_TAP_LINE_H)
+
+#define TAP_MAX_QUEUES 8
+#define TAP_BATCH_SIZE 16 /* maximum frames read in one pass over the queues */
+#define TAP_FRAME_LEN  1518
+
+typedef struct
+{
+	int  queueCount;
+	int  fd[TAP_MAX_QUEUES];
+	int  registered;
+	byte buffer[TAP_BATCH_SIZE][TAP_FRAME_LEN];
+	int  length[TAP_BATCH_SIZE];
+	int  count;
+	int  next;      /* next frame in the batch to hand out */
+	int  nextQueue; /* queue to read first next time, so one busy queue cannot starve the others */
+} eth_tap_t;
+
+int EthTapLineStart(line_t *line);
+void EthTapLineStop(line_t *line);
+packet_t *EthTapLineReadPacket(line_t *line);
+int EthTapLineWritePacket(line_t *line, packet_t *packet);
+
+#define ETH_TAP_LINE_H
+#endif
@@ -0,0 +1,592 @@
+/* eth_xdp_line.c: Ethernet line using Linux AF_XDP sockets
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+#include "platform.h"
+
+#if defined(USE_XDP)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+
+#include "route20.h"
+#include "timer.h"
+#include "eth_decnet.h"
+#include "eth_line.h"
+#include "eth_xdp_line.h"
+
+/* A small XDP program is attached to the interface which redirects frames with the DECnet ethertype that arrive
+   on the configured queue to an AF_XDP socket, everything else is passed on to the kernel as normal. The program
+   is built here and loaded directly with the bpf system call, so there is no dependency on libbpf or a BPF compiler.
+
+   Frames are received straight into UMEM frames, which are handed to the circuit without copying and given back to
+   the kernel on the next read. Frames to transmit are copied into free UMEM frames, and the kernel is told to send
+   them once per pass of the event loop. Native XDP is used if the driver supports it, otherwise generic XDP. */
+
+#if !defined(AF_XDP)
+#define AF_XDP 44
+#endif
+#if !defined(SOL_XDP)
+#define SOL_XDP 283
+#endif
+
+#define XDP_FRAME_SIZE        2048
+#define XDP_FRAME_COUNT       1024
+#define XDP_RX_FRAME_COUNT    (XDP_FRAME_COUNT / 2) /* the rest are used for transmit */
+#define XDP_RING_SIZE         512
+#define XDP_MAP_ENTRIES       64
+#define XDP_MIN_FRAME_SIZE    60
+
+static int LoadProgram(line_t *line, eth_xdp_t *xdpContext, int ifIndex);
+static int CreateSocket(line_t *line, eth_xdp_t *xdpContext, int ifIndex);
+static int MapRing(xsk_ring_t *ring, int sock, struct xdp_ring_offset *offsets, size_t entrySize, off_t pageOffset);
+static void UnmapRing(xsk_ring_t *ring);
+static int SetPromiscuous(eth_xdp_t *xdpContext, int ifIndex);
+static void GiveBackRxFrame(eth_xdp_t *xdpContext);
+static void ReclaimTxFrames(eth_xdp_t *xdpContext);
+static void KickTransmit(void *context);
+static long Bpf(int cmd, union bpf_attr *attr);
+
+int EthXdpLineStart(line_t *line)
+{
+	int ans = 0;
+	eth_xdp_t *xdpContext = (eth_xdp_t *)line->lineContext;
+	int ifIndex;
+
+	Log(LogEthXdpLine, LogInfo, "Starting line %s on queue %d\n", line->name, xdpContext->queueId);
+
+	xdpContext->socket = -1;
+	xdpContext->promiscSocket = -1;
+	xdpContext->mapFd = -1;
+	xdpContext->programFd = -1;
+	xdpContext->linkFd = -1;
+	xdpContext->umem = MAP_FAILED;
+	xdpContext->rxFrameHeld = 0;
+	ifIndex = if_nametoindex(line->name);
+
+	if (ifIndex == 0)
+	{
+		Log(LogEthXdpLine, LogError, "Unknown interface %s\n", line->name);
+	}
+	else if (CreateSocket(line, xdpContext, ifIndex) && LoadProgram(line, xdpContext, ifIndex))
+	{
+		if (!SetPromiscuous(xdpContext, ifIndex))
+		{
+			Log(LogEthXdpLine, LogError, "Error setting promiscuous mode: %s\n", strerror(errno));
+		}
+		else
+		{
+			line->waitHandle = xdpContext->socket;
+			RegisterEventHandler(line->waitHandle, "EthXdp Line", line, line->LineWaitEventHandler);
+			QueueImmediate(line, (void (*)(void *))(line->LineUp));
+			ans = 1;
+		}
+	}
+
+	if (!ans)
+	{
+		Log(LogEthXdpLine, LogError, "Could not open circuit for %s\n", line->name);
+		EthXdpLineStop(line);
+	}
+
+	return ans;
+}
+
+void EthXdpLineStop(line_t *line)
+{
+	eth_xdp_t *xdpContext = (eth_xdp_t *)line->lineContext;
+
+	/* closing the link detaches the program, from then on all traffic goes to the kernel */
+	if (xdpContext->linkFd != -1)
+	{
+		close(xdpContext->linkFd);
+		xdpContext->linkFd = -1;
+	}
+
+	if (xdpContext->programFd != -1)
+	{
+		close(xdpContext->programFd);
+		xdpContext->programFd = -1;
+	}
+
+	if (xdpContext->mapFd != -1)
+	{
+		close(xdpContext->mapFd);
+		xdpContext->mapFd = -1;
+	}
+
+	if (xdpContext->socket != -1)
+	{
+		if (line->waitHandle == xdpContext->socket)
+		{
+			DeregisterEventHandler(line->waitHandle);
+		}
+
+		UnmapRing(&xdpContext->rx);
+		UnmapRing(&xdpContext->tx);
+		UnmapRing(&xdpContext->fill);
+		UnmapRing(&xdpContext->completion);
+		close(xdpContext->socket);
+		xdpContext->socket = -1;
+	}
+
+	if (xdpContext->umem != MAP_FAILED)
+	{
+		munmap(xdpContext->umem, xdpContext->umemSize);
+		xdpContext->umem = MAP_FAILED;
+	}
+
+	if (xdpContext->promiscSocket != -1)
+	{
+		close(xdpContext->promiscSocket);
+		xdpContext->promiscSocket = -1;
+	}
+
+	free(xdpContext->txFree);
+	xdpContext->txFree = NULL;
+}
+
+packet_t *EthXdpLineReadPacket(line_t *line)
+{
+	eth_xdp_t *xdpContext = (eth_xdp_t *)line->lineContext;
+	static packet_t packet;
+	packet_t *ans = NULL;
+	xsk_ring_t *rx = &xdpContext->rx;
+	struct xdp_desc *desc;
+	unsigned int consumer;
+
+	packet.IsDecnet = EthPcapIsDecnet;
+
+	/* the frame handed out by the previous call has been processed by now */
+	GiveBackRxFrame(xdpContext);
+
+	consumer = *rx->consumer;
+	while (ans == NULL && consumer != __atomic_load_n(rx->producer, __ATOMIC_ACQUIRE))
+	{
+		desc = &((struct xdp_desc *)rx->descs)[consumer & (rx->size - 1)];
+		packet.rawData = xdpContext->umem + desc->addr;
+		packet.rawLen = desc->len;
+		xdpContext->rxFrame = desc->addr;
+		xdpContext->rxFrameHeld = 1;
+		consumer++;
+		__atomic_store_n(rx->consumer, consumer, __ATOMIC_RELEASE);
+
+		if (EthValidPacket(&packet))
+		{
+			if (packet.IsDecnet(&packet))
+			{
+				GetDecnetAddress((decnet_eth_address_t *)&packet.rawData[0], &packet.to);
+				GetDecnetAddress((decnet_eth_address_t *)&packet.rawData[6], &packet.from);
+				if (IsLoggable(LogEthXdpLine, LogVerbose))
+				{
+					Log(LogEthXdpLine, LogVerbose, "Packet from : "); LogDecnetAddress(LogEthXdpLine, LogVerbose, &packet.from); Log(LogEthXdpLine, LogVerbose, " received on line %s\n", line->name);
+				}
+				line->stats.validPacketsReceived++;
+				EthSetPayload(&packet);
+				ans = &packet;
+			}
+			else
+			{
+				Log(LogEthXdpLine, LogVerbose, "Discarding valid non-DECnet Ethernet packet from %s\n", line->name);
+			}
+		}
+		else
+		{
+			Log(LogEthXdpLine, LogWarning, "Discarding invalid Ethernet packet from %s\n", line->name);
+			line->stats.invalidPacketsReceived++;
+		}
+
+		if (ans == NULL)
+		{
+			GiveBackRxFrame(xdpContext);
+		}
+	}
+
+	return ans;
+}
+
+int EthXdpLineWritePacket(line_t *line, packet_t *packet)
+{
+	int ans = 0;
+	eth_xdp_t *xdpContext = (eth_xdp_t *)line->lineContext;
+	xsk_ring_t *tx = &xdpContext->tx;
+	struct xdp_desc *desc;
+	unsigned int producer;
+	unsigned long long frame;
+	int len = packet->rawLen;
+
+	ReclaimTxFrames(xdpContext);
+	producer = *tx->producer;
+
+	if (len > XDP_FRAME_SIZE)
+	{
+		Log(LogEthXdpLine, LogError, "Packet of %d bytes too large to write to %s\n", len, line->name);
+	}
+	else if (xdpContext->txFreeCount == 0 || producer - __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE) >= tx->size)
+	{
+		/* everything is still waiting to go, send what is there and let the circuit retry */
+		Log(LogEthXdpLine, LogWarning, "Transmit ring full on %s\n", line->name);
+		KickTransmit(line);
+	}
+	else
+	{
+		frame = xdpContext->txFree[--xdpContext->txFreeCount];
+		memcpy(xdpContext->umem + frame, packet->rawData, len);
+		if (len < XDP_MIN_FRAME_SIZE)
+		{
+			memset(xdpContext->umem + frame + len, 0, XDP_MIN_FRAME_SIZE - len);
+			len = XDP_MIN_FRAME_SIZE;
+		}
+
+		desc = &((struct xdp_desc *)tx->descs)[producer & (tx->size - 1)];
+		desc->addr = frame;
+		desc->len = len;
+		desc->options = 0;
+		__atomic_store_n(tx->producer, producer + 1, __ATOMIC_RELEASE);
+		ans = 1;
+
+		if (!xdpContext->txKickQueued)
+		{
+			xdpContext->txKickQueued = 1;
+			QueueImmediate(line, KickTransmit);
+		}
+	}
+
+	return ans;
+}
+
+static int CreateSocket(line_t *line, eth_xdp_t *xdpContext, int ifIndex)
+{
+	int ans = 0;
+	struct xdp_umem_reg umemReg;
+	struct xdp_mmap_offsets offsets;
+	struct sockaddr_xdp addr;
+	socklen_t offsetsLen = sizeof(offsets);
+	int ringSize = XDP_RING_SIZE;
+	unsigned int producer;
+	int i;
+
+	xdpContext->umemSize = (size_t)XDP_FRAME_SIZE * XDP_FRAME_COUNT;
+	xdpContext->umem = mmap(NULL, xdpContext->umemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	memset(&umemReg, 0, sizeof(umemReg));
+	umemReg.addr = (unsigned long long)(unsigned long)xdpContext->umem;
+	umemReg.len = xdpContext->umemSize;
+	umemReg.chunk_size = XDP_FRAME_SIZE;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sxdp_family = AF_XDP;
+	addr.sxdp_ifindex = ifIndex;
+	addr.sxdp_queue_id = xdpContext->queueId;
+
+	if (xdpContext->umem == MAP_FAILED)
+	{
+		Log(LogEthXdpLine, LogError, "Error allocating UMEM: %s\n", strerror(errno));
+	}
+	else if ((xdpContext->socket = socket(AF_XDP, SOCK_RAW, 0)) == -1)
+	{
+		Log(LogEthXdpLine, LogError, "Error creating XDP socket: %s\n", strerror(errno));
+	}
+	else if (setsockopt(xdpContext->socket, SOL_XDP, XDP_UMEM_REG, &umemReg, sizeof(umemReg)) == -1)
+	{
+		Log(LogEthXdpLine, LogError, "Error registering UMEM: %s\n", strerror(errno));
+	}
+	else if (setsockopt(xdpContext->socket, SOL_XDP, XDP_UMEM_FILL_RING, &ringSize, sizeof(ringSize)) == -1
+		  || setsockopt(xdpContext->socket, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringSize, sizeof(ringSize)) == -1
+		  || setsockopt(xdpContext->socket, SOL_XDP, XDP_RX_RING, &ringSize, sizeof(ringSize)) == -1
+		  || setsockopt(xdpContext->socket, SOL_XDP, XDP_TX_RING, &ringSize, sizeof(ringSize)) == -1)
+	{
+		Log(LogEthXdpLine, LogError, "Error creating XDP rings: %s\n", strerror(errno));
+	}
+	else if (getsockopt(xdpContext->socket, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsetsLen) == -1)
+	{
+		Log(LogEthXdpLine, LogError, "Error reading XDP ring offsets: %s\n", strerror(errno));
+	}
+	else if (!MapRing(&xdpContext->rx, xdpContext->socket, &offsets.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING)
+		  || !MapRing(&xdpContext->tx, xdpContext->socket, &offsets.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING)
+		  || !MapRing(&xdpContext->fill, xdpContext->socket, &offsets.fr, sizeof(unsigned long long), XDP_UMEM_PGOFF_FILL_RING)
+		  || !MapRing(&xdpContext->completion, xdpContext->socket, &offsets.cr, sizeof(unsigned long long), XDP_UMEM_PGOFF_COMPLETION_RING))
+	{
+		Log(LogEthXdpLine, LogError, "Error mapping XDP rings: %s\n", strerror(errno));
+	}
+	else
+	{
+		/* the first half of the UMEM is given to the kernel to receive into, the second half is kept for transmit */
+		producer = *xdpContext->fill.producer;
+		for (i = 0; i < XDP_RX_FRAME_COUNT; i++)
+		{
+			((unsigned long long *)xdpContext->fill.descs)[(producer + i) & (xdpContext->fill.size - 1)] = (unsigned long long)i * XDP_FRAME_SIZE;
+		}
+		__atomic_store_n(xdpContext->fill.producer, producer + XDP_RX_FRAME_COUNT, __ATOMIC_RELEASE);
+
+		xdpContext->txFree = (unsigned long long *)malloc((XDP_FRAME_COUNT - XDP_RX_FRAME_COUNT) * sizeof(unsigned long long));
+		xdpContext->txFreeCount = 0;
+		for (i = XDP_RX_FRAME_COUNT; i < XDP_FRAME_COUNT; i++)
+		{
+			xdpContext->txFree[xdpContext->txFreeCount++] = (unsigned long long)i * XDP_FRAME_SIZE;
+		}
+
+		if (bind(xdpContext->socket, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		{
+			Log(LogEthXdpLine, LogError, "Error binding XDP socket to %s queue %d: %s\n", line->name, xdpContext->queueId, strerror(errno));
+		}
+		else
+		{
+			ans = 1;
+		}
+	}
+
+	return ans;
+}
+
+static int LoadProgram(line_t *line, eth_xdp_t *xdpContext, int ifIndex)
+{
+	int ans = 0;
+	union bpf_attr attr;
+	int key = xdpContext->queueId;
+	char verifierLog[1024];
+	struct bpf_insn program[] =
+	{
+		{ BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0 },                        /* r6 = ctx */
+		{ BPF_LDX | BPF_W | BPF_MEM, 2, 6, 0, 0 },                          /* r2 = ctx->data */
+		{ BPF_LDX | BPF_W | BPF_MEM, 3, 6, 4, 0 },                          /* r3 = ctx->data_end */
+		{ BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0 },                        /* r4 = r2 */
+		{ BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 14 },                       /* r4 += 14 */
+		{ BPF_JMP | BPF_JGT | BPF_X, 4, 3, 8, 0 },                          /* if r4 > r3 goto pass */
+		{ BPF_LDX | BPF_H | BPF_MEM, 5, 2, 12, 0 },                         /* r5 = ethertype */
+		{ BPF_JMP | BPF_JNE | BPF_K, 5, 0, 6, 0 },                          /* if r5 != DECnet goto pass */
+		{ BPF_LDX | BPF_W | BPF_MEM, 2, 6, 16, 0 },                         /* r2 = ctx->rx_queue_index */
+		{ BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, 0 },          /* r1 = map */
+		{ 0, 0, 0, 0, 0 },
+		{ BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS },                 /* r3 = pass if the queue has no socket */
+		{ BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },             /* r0 = redirect(map, queue) */
+		{ BPF_JMP | BPF_EXIT, 0, 0, 0, 0 },
+		{ BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS },                 /* pass: r0 = pass */
+		{ BPF_JMP | BPF_EXIT, 0, 0, 0, 0 }
+	};
+
+	program[7].imm = htons(ETHERTYPE_DECnet);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(int);
+	attr.value_size = sizeof(int);
+	attr.max_entries = XDP_MAP_ENTRIES;
+	xdpContext->mapFd = (int)Bpf(BPF_MAP_CREATE, &attr);
+
+	if (xdpContext->mapFd < 0)
+	{
+		Log(LogEthXdpLine, LogError, "Error creating XSK map: %s\n", strerror(errno));
+	}
+	else
+	{
+		program[9].imm = xdpContext->mapFd;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.prog_type = BPF_PROG_TYPE_XDP;
+		attr.insns = (unsigned long long)(unsigned long)program;
+		attr.insn_cnt = sizeof(program) / sizeof(program[0]);
+		attr.license = (unsigned long long)(unsigned long)"Dual MIT/GPL";
+		attr.log_buf = (unsigned long long)(unsigned long)verifierLog;
+		attr.log_size = sizeof(verifierLog);
+		attr.log_level = 1;
+		verifierLog[0] = '\0';
+		xdpContext->programFd = (int)Bpf(BPF_PROG_LOAD, &attr);
+
+		if (xdpContext->programFd < 0)
+		{
+			Log(LogEthXdpLine, LogError, "Error loading XDP program: %s\n%s\n", strerror(errno), verifierLog);
+		}
+		else
+		{
+			memset(&attr, 0, sizeof(attr));
+			attr.map_fd = xdpContext->mapFd;
+			attr.key = (unsigned long long)(unsigned long)&key;
+			attr.value = (unsigned long long)(unsigned long)&xdpContext->socket;
+
+			if (Bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+			{
+				Log(LogEthXdpLine, LogError, "Error adding socket to XSK map: %s\n", strerror(errno));
+			}
+			else
+			{
+				memset(&attr, 0, sizeof(attr));
+				attr.link_create.prog_fd = xdpContext->programFd;
+				attr.link_create.target_ifindex = ifIndex;
+				attr.link_create.attach_type = BPF_XDP;
+				attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+				xdpContext->linkFd = (int)Bpf(BPF_LINK_CREATE, &attr);
+
+				if (xdpContext->linkFd < 0)
+				{
+					attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+					xdpContext->linkFd = (int)Bpf(BPF_LINK_CREATE, &attr);
+					if (xdpContext->linkFd >= 0)
+					{
+						Log(LogEthXdpLine, LogInfo, "Driver for %s does not support native XDP, using generic XDP\n", line->name);
+					}
+				}
+
+				if (xdpContext->linkFd < 0)
+				{
+					Log(LogEthXdpLine, LogError, "Error attaching XDP program to %s: %s\n", line->name, strerror(errno));
+				}
+				else
+				{
+					ans = 1;
+				}
+			}
+		}
+	}
+
+	return ans;
+}
+
+static int MapRing(xsk_ring_t *ring, int sock, struct xdp_ring_offset *offsets, size_t entrySize, off_t pageOffset)
+{
+	ring->size = XDP_RING_SIZE;
+	ring->mapSize = offsets->desc + ring->size * entrySize;
+	ring->map = mmap(NULL, ring->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, sock, pageOffset);
+	if (ring->map != MAP_FAILED)
+	{
+		ring->producer = (unsigned int *)((byte *)ring->map + offsets->producer);
+		ring->consumer = (unsigned int *)((byte *)ring->map + offsets->consumer);
+		ring->descs = (byte *)ring->map + offsets->desc;
+	}
+	else
+	{
+		ring->map = NULL;
+	}
+
+	return ring->map != NULL;
+}
+
+static void UnmapRing(xsk_ring_t *ring)
+{
+	if (ring->map != NULL)
+	{
+		munmap(ring->map, ring->mapSize);
+		ring->map = NULL;
+	}
+}
+
+static int SetPromiscuous(eth_xdp_t *xdpContext, int ifIndex)
+{
+	int ans = 0;
+	struct packet_mreq mreq;
+
+	/* a packet socket that is bound to no protocol receives nothing, but its membership keeps the interface
+	   promiscuous until it is closed, so unicast frames for DECnet addresses reach the XDP program */
+	xdpContext->promiscSocket = socket(AF_PACKET, SOCK_RAW, 0);
+	if (xdpContext->promiscSocket != -1)
+	{
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.mr_ifindex = ifIndex;
+		mreq.mr_type = PACKET_MR_PROMISC;
+		ans = setsockopt(xdpContext->promiscSocket, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0;
+	}
+
+	return ans;
+}
+
+static void GiveBackRxFrame(eth_xdp_t *xdpContext)
+{
+	xsk_ring_t *fill = &xdpContext->fill;
+	unsigned int producer;
+
+	/* there are only as many receive frames as the fill ring has entries, so there is always room */
+	if (xdpContext->rxFrameHeld)
+	{
+		producer = *fill->producer;
+		((unsigned long long *)fill->descs)[producer & (fill->size - 1)] = xdpContext->rxFrame;
+		__atomic_store_n(fill->producer, producer + 1, __ATOMIC_RELEASE);
+		xdpContext->rxFrameHeld = 0;
+	}
+}
+
+static void ReclaimTxFrames(eth_xdp_t *xdpContext)
+{
+	xsk_ring_t *completion = &xdpContext->completion;
+	unsigned int consumer = *completion->consumer;
+	unsigned int producer = __atomic_load_n(completion->producer, __ATOMIC_ACQUIRE);
+
+	while (consumer != producer)
+	{
+		xdpContext->txFree[xdpContext->txFreeCount++] = ((unsigned long long *)completion->descs)[consumer & (completion->size - 1)];
+		consumer++;
+	}
+
+	__atomic_store_n(completion->consumer, consumer, __ATOMIC_RELEASE);
+}
+
+static void KickTransmit(void *context)
+{
+	line_t *line = (line_t *)context;
+	eth_xdp_t *xdpContext = (eth_xdp_t *)line->lineContext;
+
+	xsk_ring_t *tx = &xdpContext->tx;
+	int sending = xdpContext->socket != -1;
+	unsigned int consumer;
+
+	/* the kernel only takes a limited number of frames from the ring on each call and returns EAGAIN if it left
+	   some behind, so keep going while it is making progress */
+	xdpContext->txKickQueued = 0;
+	while (sending)
+	{
+		consumer = __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE);
+		sending = 0;
+		if (sendto(xdpContext->socket, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1)
+		{
+			if (errno == EAGAIN)
+			{
+				sending = consumer != __atomic_load_n(tx->consumer, __ATOMIC_ACQUIRE);
+			}
+			else if (errno != ENOBUFS && errno != EBUSY)
+			{
+				Log(LogEthXdpLine, LogError, "Error sending on %s: %s\n", line->name, strerror(errno));
+			}
+		}
+	}
+}
+
+static long Bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+#endif
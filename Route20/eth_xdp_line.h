@@ -0,0 +1,71 @@
+/* eth_xdp_line.h: Ethernet line using Linux AF_XDP sockets
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+#include "packet.h"
+#include "line.h"
+
+#if !defined(ETH_XDP_LINE_H)
+
+typedef struct
+{
+	unsigned int *producer;
+	unsigned int *consumer;
+	void         *descs;
+	unsigned int  size; /* number of entries, a power of 2 */
+	void         *map;
+	size_t        mapSize;
+} xsk_ring_t;
+
+typedef struct
+{
+	int             socket;
+	int             queueId;
+	int             promiscSocket; /* packet socket holding the interface in promiscuous mode */
+	int             mapFd;
+	int             programFd;
+	int             linkFd;
+	byte           *umem;
+	size_t          umemSize;
+	xsk_ring_t      rx;
+	xsk_ring_t      tx;
+	xsk_ring_t      fill;
+	xsk_ring_t      completion;
+	unsigned long long rxFrame;    /* UMEM frame last handed out, to be given back to the fill ring */
+	int             rxFrameHeld;
+	unsigned long long *txFree;    /* UMEM frames available for transmit */
+	int             txFreeCount;
+	int             txKickQueued;
+} eth_xdp_t;
+
+int EthXdpLineStart(line_t *line);
+void EthXdpLineStop(line_t *line);
+packet_t *EthXdpLineReadPacket(line_t *line);
+int EthXdpLineWritePacket(line_t *line, packet_t *packet);
+
+#define ETH_XDP_LINE_H
+#endif
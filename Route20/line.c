@@ -32,6 +32,9 @@
 #include "line.h"
 #include "eth_pcap_line.h"
 #include "eth_sock_line.h"
+#include "eth_packet_line.h"
+#include "eth_xdp_line.h"
+#include "eth_tap_line.h"
 #include "ddcmp_sock_line.h"
 
 static void LineUp(line_ptr line);
@@ -40,9 +43,17 @@ static void LineWaitEventHandler(void *context);
 
 // TODO: abstract properly by putting common functions for read/write etc which do logging, stats etc, then delegate to actual line implementations.
 
-void LineCreateEthernetPcap(line_ptr line, char *name, void *notifyContext, void (*lineNotifyData)(line_ptr line))
+void LineCreateEthernetPcap(line_ptr line, char *name, struct eth_pcap_options *options, void *notifyContext, void (*lineNotifyData)(line_ptr line))
 {
 	eth_pcap_t *context = (eth_pcap_t *)calloc(1, sizeof(eth_pcap_t));
+	if (options != NULL)
+	{
+		context->options = *options;
+	}
+	else
+	{
+		EthPcapInitialiseOptions(&context->options);
+	}
 
 	line->name = (char *)malloc(strlen(name)+1);
 	strcpy(line->name, name);
@@ -62,6 +73,82 @@ void LineCreateEthernetPcap(line_ptr line, char *name, void *notifyContext, void
     line->LineNotifyData = lineNotifyData;
 }
 
+#if defined(USE_PACKET_RING)
+void LineCreateEthernetPacket(line_ptr line, char *name, void *notifyContext, void (*lineNotifyData)(line_ptr line))
+{
+	eth_packet_t *context = (eth_packet_t *)calloc(1, sizeof(eth_packet_t));
+	context->socket = -1;
+
+	line->name = (char *)malloc(strlen(name)+1);
+	strcpy(line->name, name);
+	line->lineContext = (void *)context;
+    line->notifyContext = notifyContext;
+    line->lineType = PacketLineType;
+	line->lineState = LineStateOff;
+    memset(&line->stats, 0, sizeof(line->stats));
+
+	line->LineStart = EthPacketLineStart;
+	line->LineStop = EthPacketLineStop;
+    line->LineUp = LineUp;
+    line->LineDown = LineDown;
+	line->LineReadPacket = EthPacketLineReadPacket;
+	line->LineWritePacket = EthPacketLineWritePacket;
+	line->LineWaitEventHandler = LineWaitEventHandler;
+    line->LineNotifyData = lineNotifyData;
+}
+#endif
+
+#if defined(USE_XDP)
+void LineCreateEthernetXdp(line_ptr line, char *name, int queueId, void *notifyContext, void (*lineNotifyData)(line_ptr line))
+{
+	eth_xdp_t *context = (eth_xdp_t *)calloc(1, sizeof(eth_xdp_t));
+	context->socket = -1;
+	context->queueId = queueId;
+
+	line->name = (char *)malloc(strlen(name)+1);
+	strcpy(line->name, name);
+	line->lineContext = (void *)context;
+    line->notifyContext = notifyContext;
+    line->lineType = XdpLineType;
+	line->lineState = LineStateOff;
+    memset(&line->stats, 0, sizeof(line->stats));
+
+	line->LineStart = EthXdpLineStart;
+	line->LineStop = EthXdpLineStop;
+    line->LineUp = LineUp;
+    line->LineDown = LineDown;
+	line->LineReadPacket = EthXdpLineReadPacket;
+	line->LineWritePacket = EthXdpLineWritePacket;
+	line->LineWaitEventHandler = LineWaitEventHandler;
+    line->LineNotifyData = lineNotifyData;
+}
+#endif
+
+#if defined(USE_TAP)
+void LineCreateEthernetTap(line_ptr line, char *name, int queueCount, void *notifyContext, void (*lineNotifyData)(line_ptr line))
+{
+	eth_tap_t *context = (eth_tap_t *)calloc(1, sizeof(eth_tap_t));
+	context->queueCount = queueCount;
+
+	line->name = (char *)malloc(strlen(name)+1);
+	strcpy(line->name, name);
+	line->lineContext = (void *)context;
+    line->notifyContext = notifyContext;
+    line->lineType = TapLineType;
+	line->lineState = LineStateOff;
+    memset(&line->stats, 0, sizeof(line->stats));
+
+	line->LineStart = EthTapLineStart;
+	line->LineStop = EthTapLineStop;
+    line->LineUp = LineUp;
+    line->LineDown = LineDown;
+	line->LineReadPacket = EthTapLineReadPacket;
+	line->LineWritePacket = EthTapLineWritePacket;
+	line->LineWaitEventHandler = LineWaitEventHandler;
+    line->LineNotifyData = lineNotifyData;
+}
+#endif
+
 void LineCreateEthernetSocket(line_ptr line, char *name, uint16 receivePort, char *destinationHostName, uint16 destinationPort, void *notifyContext, void (*lineNotifyData)(line_ptr line))
 {
 	eth_sock_t *context = (eth_sock_t *)calloc(1, sizeof(eth_sock_t));
@@ -88,7 +175,7 @@ void LineCreateEthernetSocket(line_ptr line, char *name, uint16 receivePort, cha
     line->LineNotifyData = lineNotifyData;
 }
 
-void LineCreateDdcmpSocket(line_ptr line, char *name, char *destinationHostName, uint16 destinationPort, int connectPoll, void *notifyContext, void (*lineNotifyData)(line_ptr line))
+void LineCreateDdcmpSocket(line_ptr line, char *name, char *destinationHostName, uint16 destinationPort, int connectPoll, struct ddcmp_options *options, void *notifyContext, void (*lineNotifyData)(line_ptr line))
 {
 	ddcmp_sock_t *context = (ddcmp_sock_t *)calloc(1, sizeof(ddcmp_sock_t));
     InitialiseSocket(&context->socket, destinationHostName);
@@ -97,22 +184,43 @@ void LineCreateDdcmpSocket(line_ptr line, char *name, char *destinationHostName,
 	context->destinationPort = destinationPort;
 	strcpy(context->destinationHostName, destinationHostName);
     context->connectPoll = connectPoll;
+	if (options != NULL)
+	{
+		context->options = *options;
+	}
+	else
+	{
+		DdcmpInitialiseOptions(&context->options);
+	}
 
 	line->name = (char *)malloc(strlen(name)+1);
 	strcpy(line->name, name);
 	line->lineContext = (void *)context;
     line->notifyContext = notifyContext;
-    line->lineType = DDCMPSockLineType;
 	line->lineState = LineStateOff;
     memset(&line->stats, 0, sizeof(line->stats));
 
-	line->LineStart = DdcmpSockLineStart;
-    line->LineOpen = DdcmpSockLineOpen;
-    line->LineClosed = DdcmpSockLineClosed;
-    line->LineStop = DdcmpSockLineStop;
+	if (context->options.udpPort != 0)
+	{
+		line->lineType = DDCMPUdpLineType;
+		line->LineStart = DdcmpUdpLineStart;
+		line->LineOpen = DdcmpUdpLineOpen;
+		line->LineClosed = DdcmpUdpLineClosed;
+		line->LineStop = DdcmpUdpLineStop;
+		line->LineReadPacket = DdcmpUdpLineReadPacket;
+	}
+	else
+	{
+		line->lineType = DDCMPSockLineType;
+		line->LineStart = DdcmpSockLineStart;
+		line->LineOpen = DdcmpSockLineOpen;
+		line->LineClosed = DdcmpSockLineClosed;
+		line->LineStop = DdcmpSockLineStop;
+		line->LineReadPacket = DdcmpSockLineReadPacket;
+	}
+
     line->LineUp = LineUp;
     line->LineDown = LineDown;
-	line->LineReadPacket = DdcmpSockLineReadPacket;
 	line->LineWritePacket = DdcmpSockLineWritePacket;
 	line->LineWaitEventHandler = LineWaitEventHandler;
     line->LineNotifyData = lineNotifyData;
@@ -31,12 +31,18 @@
 #if !defined(LINE_H)
 
 typedef struct line *line_ptr;
+struct eth_pcap_options;
+struct ddcmp_options;
 
 typedef enum
 {
     PcapLineType,
     SockLineType,
-    DDCMPSockLineType
+    PacketLineType,
+    XdpLineType,
+    TapLineType,
+    DDCMPSockLineType,
+    DDCMPUdpLineType
 } LineType;
 
 typedef enum
@@ -49,6 +55,8 @@ typedef struct line_stats
 {
 	long          validPacketsReceived;
 	long          invalidPacketsReceived; /* TODO: not sure all scenarios covered for line stats, also no writing counters */
+	long          packetsQueuedForRetry;  /* writes the device could not take straight away */
+	long          packetsDiscardedTransmit; /* writes dropped because the retry queue was full */
 } line_stats_t;
 
 typedef struct line
@@ -74,9 +82,12 @@ typedef struct line
     void (*LineNotifyData)(line_ptr line);
 } line_t;
 
-void LineCreateEthernetPcap(line_ptr line, char *name, void *notifyContext, void (*lineNotifyData)(line_ptr line));
+void LineCreateEthernetPcap(line_ptr line, char *name, struct eth_pcap_options *options, void *notifyContext, void (*lineNotifyData)(line_ptr line));
+void LineCreateEthernetPacket(line_ptr line, char *name, void *notifyContext, void (*lineNotifyData)(line_ptr line));
+void LineCreateEthernetXdp(line_ptr line, char *name, int queueId, void *notifyContext, void (*lineNotifyData)(line_ptr line));
+void LineCreateEthernetTap(line_ptr line, char *name, int queueCount, void *notifyContext, void (*lineNotifyData)(line_ptr line));
 void LineCreateEthernetSocket(line_ptr line, char *name, uint16 receivePort, char *destinationHostName, uint16 destinationPort, void *notifyContext, void (*lineNotifyData)(line_ptr line));
-void LineCreateDdcmpSocket(line_ptr line, char *name, char *destinationHostName, uint16 destinationPort, int connectPoll, void *notifyContext, void (*lineNotifyData)(line_ptr line));
+void LineCreateDdcmpSocket(line_ptr line, char *name, char *destinationHostName, uint16 destinationPort, int connectPoll, struct ddcmp_options *options, void *notifyContext, void (*lineNotifyData)(line_ptr line));
 
 #define LINE_H
 #endif
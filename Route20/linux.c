@@ -30,6 +30,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/select.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -49,9 +52,42 @@
 #include "session.h"
 #include "netman.h"
 #include "dns.h"
+#include "uring.h"
 
 #define PID_FILE_NAME "/var/run/route20.pid"
 
+#if defined(USE_EPOLL)
+#define EPOLL_MAX_EVENTS 64 /* maximum events returned by one epoll_wait, more are returned on the next call */
+
+typedef struct epoll_handler *epoll_handler_ptr;
+
+typedef struct epoll_handler
+{
+    event_handler_t   handler;
+    int               deleted; /* deregistered while events were being dispatched, freed once dispatch is complete */
+    int               armed;   /* io_uring only, a poll request is outstanding for this handle */
+    int               writeArmed; /* io_uring only, a poll request for write readiness is outstanding */
+    int               ringReceive; /* io_uring only, the handle is a socket read through a ring receiver rather than polled */
+    epoll_handler_ptr next;
+} epoll_handler_t;
+
+static int epollFd = -1;
+static epoll_handler_ptr epollHandlers = NULL;
+static epoll_handler_ptr deletedEpollHandlers = NULL;
+#if defined(USE_IO_URING)
+static int uringTried = 0;
+static int uringActive = 0;
+#endif
+
+static void OpenEpoll(void);
+static epoll_handler_ptr FindEpollHandler(unsigned int waitHandle);
+static void FreeDeletedEpollHandlers(void);
+static void ProcessEpollEvents(void);
+#if defined(USE_IO_URING)
+static void ProcessUringEvents(void);
+#endif
+#endif
+
 static void ProcessPackets(circuit_t *circuit, void (*process)(circuit_t *, packet_t *));
 static void SetupHupHandler(void);
 static void SigHupHandler(int signum);
@@ -234,32 +270,254 @@ void QueuePacket(circuit_t *circuit, packet_t *packet)
     ProcessPacket(circuit, packet);
 }
 
+#if defined(USE_EPOLL)
+void RegisterEventHandler(unsigned int waitHandle, char *name, void *context, void (*eventHandler)(void *context))
+{
+    epoll_handler_ptr entry;
+
+    OpenEpoll();
+
+    /* we may already have this wait handle registered, if so just update the information. This can happen for outbound sockets where the handler changes after the socket is connected */
+    entry = FindEpollHandler(waitHandle);
+    if (entry == NULL)
+    {
+        struct epoll_event event;
+
+        entry = (epoll_handler_ptr)malloc(sizeof(epoll_handler_t));
+        memset(entry, 0, sizeof(epoll_handler_t));
+        entry->handler.waitHandle = waitHandle;
+
+#if defined(USE_IO_URING)
+        if (uringActive)
+        {
+            if (UringAttachReceiver((int)waitHandle, entry))
+            {
+                entry->ringReceive = 1;
+            }
+            else
+            {
+                UringAddPoll((int)waitHandle, entry, 0);
+                entry->armed = 1;
+            }
+        }
+        else
+#endif
+        {
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.ptr = entry;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, (int)waitHandle, &event) == -1)
+            {
+                Log(LogGeneral, LogFatal, "Cannot add handle %d to epoll: %d\n", waitHandle, errno);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        entry->next = epollHandlers;
+        epollHandlers = entry;
+        numEventHandlers++;
+        eventHandlersChanged = 1;
+    }
+#if defined(USE_IO_URING)
+    else if (uringActive && !entry->ringReceive && UringAttachReceiver((int)waitHandle, entry))
+    {
+        /* a TCP socket that has just connected, from now on it is read through its ring receiver, any poll still
+           outstanding is left to complete and is not re-armed */
+        entry->ringReceive = 1;
+    }
+#endif
+
+    Log(LogGeneral, LogDetail, "Registering event handler for %s, handle is %d\n", name, waitHandle);
+    entry->handler.name = name;
+    entry->handler.context = context;
+    entry->handler.eventHandler = eventHandler;
+}
+
+void DeregisterEventHandler(unsigned int waitHandle)
+{
+    epoll_handler_ptr entry = epollHandlers;
+    epoll_handler_ptr prev = NULL;
+
+    while (entry != NULL && entry->handler.waitHandle != waitHandle)
+    {
+        prev = entry;
+        entry = entry->next;
+    }
+
+    if (entry != NULL)
+    {
+        Log(LogGeneral, LogDetail, "Deregistering event handler for %s, handle is %d\n", entry->handler.name, waitHandle);
+
+        if (prev == NULL)
+        {
+            epollHandlers = entry->next;
+        }
+        else
+        {
+            prev->next = entry->next;
+        }
+
+        entry->deleted = 1;
+#if defined(USE_IO_URING)
+        if (uringActive && entry->ringReceive)
+        {
+            UringDetachReceiver(entry);
+        }
+
+        if (uringActive && (entry->armed || entry->writeArmed))
+        {
+            /* freed when the cancelled poll requests complete */
+            if (entry->armed)
+            {
+                UringRemovePoll(entry, 0);
+            }
+
+            if (entry->writeArmed)
+            {
+                UringRemovePoll(entry, 1);
+            }
+        }
+        else
+#endif
+        {
+            /* the handle may already be closed, in which case epoll has already removed it */
+            if (epollFd != -1)
+            {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, (int)waitHandle, NULL);
+            }
+
+            /* events for this handle may still be waiting to be dispatched from the current epoll_wait, so don't free it yet */
+            entry->next = deletedEpollHandlers;
+            deletedEpollHandlers = entry;
+        }
+
+        numEventHandlers--;
+        eventHandlersChanged = 1;
+    }
+    else
+    {
+        Log(LogGeneral, LogWarning, "Unable to deregister event handler as the registration entry for the handle %d could not be found\n", waitHandle);
+    }
+}
+
+void RegisterWriteHandler(unsigned int waitHandle, void *context, void (*writeHandler)(void *context))
+{
+    epoll_handler_ptr entry = FindEpollHandler(waitHandle);
+
+    if (entry != NULL)
+    {
+        Log(LogGeneral, LogVerbose, "Registering write handler for %s, handle is %d\n", entry->handler.name, waitHandle);
+        entry->handler.writeContext = context;
+        entry->handler.writeHandler = writeHandler;
+#if defined(USE_IO_URING)
+        if (uringActive)
+        {
+            if (!entry->writeArmed)
+            {
+                UringAddPoll((int)waitHandle, entry, 1);
+                entry->writeArmed = 1;
+            }
+        }
+        else
+#endif
+        {
+            struct epoll_event event;
+
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLOUT;
+            event.data.ptr = entry;
+            if (epoll_ctl(epollFd, EPOLL_CTL_MOD, (int)waitHandle, &event) == -1)
+            {
+                Log(LogGeneral, LogError, "Cannot add write interest for handle %d to epoll: %d\n", waitHandle, errno);
+            }
+        }
+    }
+    else
+    {
+        Log(LogGeneral, LogWarning, "Unable to register write handler as the registration entry for the handle %d could not be found\n", waitHandle);
+    }
+}
+
+void DeregisterWriteHandler(unsigned int waitHandle)
+{
+    /* the event handler may already have been deregistered along with the handle, in which case there is nothing to do */
+    epoll_handler_ptr entry = FindEpollHandler(waitHandle);
+
+    if (entry != NULL && entry->handler.writeHandler != NULL)
+    {
+        Log(LogGeneral, LogVerbose, "Deregistering write handler for %s, handle is %d\n", entry->handler.name, waitHandle);
+        entry->handler.writeHandler = NULL;
+        entry->handler.writeContext = NULL;
+#if defined(USE_IO_URING)
+        if (uringActive)
+        {
+            /* a write poll request still outstanding completes as soon as the handle is writable and is then not re-armed */
+        }
+        else
+#endif
+        {
+            struct epoll_event event;
+
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.ptr = entry;
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, (int)waitHandle, &event);
+        }
+    }
+}
+
+void ProcessEvents(circuit_t circuits[], int numCircuits, void (*process)(circuit_t *, packet_t *))
+{
+    signal(SIGTERM, SigTermHandler);
+    OpenEpoll();
+
+#if defined(USE_IO_URING)
+    if (uringActive)
+    {
+        ProcessUringEvents();
+    }
+    else
+#endif
+    {
+        ProcessEpollEvents();
+    }
+}
+#else
 void ProcessEvents(circuit_t circuits[], int numCircuits, void (*process)(circuit_t *, packet_t *))
 {
     int i;
     int h;
     int nfds = 0;
     fd_set handles;
+    fd_set writeHandles;
 
     signal(SIGTERM, SigTermHandler);
 
     while(!shutdownRequested)
     {
         struct timespec timeout;
-        timeout.tv_sec = SecondsUntilNextDue();
-        timeout.tv_nsec = 0;
+        int ms = MillisecondsUntilNextDue();
+        timeout.tv_sec = ms / 1000;
+        timeout.tv_nsec = (ms % 1000) * 1000000L;
 
         FD_ZERO(&handles);
+        FD_ZERO(&writeHandles);
         for (h = 0; h < numEventHandlers; h++)
         {
             FD_SET(eventHandlers[h].waitHandle, &handles);
+            if (eventHandlers[h].writeHandler != NULL)
+            {
+                FD_SET(eventHandlers[h].waitHandle, &writeHandles);
+            }
+
             if (eventHandlers[h].waitHandle > nfds)
             {
                 nfds = eventHandlers[h].waitHandle;
             }
         }
 
-        i = pselect(nfds + 1, &handles, NULL, NULL, &timeout, NULL);
+        i = pselect(nfds + 1, &handles, &writeHandles, NULL, (ms < 0) ? NULL : &timeout, NULL);
+        ClockUpdate();
         if (i == -1)
         {
             if (errno != EINTR)
@@ -274,6 +532,11 @@ void ProcessEvents(circuit_t circuits[], int numCircuits, void (*process)(circui
             {
                 for (h = 0; h < numEventHandlers; h++)
                 {
+                    if (FD_ISSET(eventHandlers[h].waitHandle, &writeHandles) && eventHandlers[h].writeHandler != NULL)
+                    {
+                        eventHandlers[h].writeHandler(eventHandlers[h].writeContext);
+                    }
+
                     if (FD_ISSET(eventHandlers[h].waitHandle, &handles))
                     {
                         eventHandlers[h].eventHandler(eventHandlers[h].context);
@@ -283,6 +546,7 @@ void ProcessEvents(circuit_t circuits[], int numCircuits, void (*process)(circui
         }
     }
 }
+#endif
 
 static void ProcessPackets(circuit_t *circuit, void (*process)(circuit_t *, packet_t *))
 {
@@ -318,4 +582,180 @@ static void SigHupHandler(int signum)
     ReadConfig(configFileName, ConfigReadModeUpdate);
 }
 
+#if defined(USE_EPOLL)
+static void OpenEpoll(void)
+{
+#if defined(USE_IO_URING)
+    if (!uringTried)
+    {
+        uringTried = 1;
+        uringActive = UringIsActive();
+        if (uringActive)
+        {
+            Log(LogGeneral, LogInfo, "Using io_uring for event handling\n");
+        }
+    }
+
+    if (!uringActive && epollFd == -1)
+#else
+    if (epollFd == -1)
+#endif
+    {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd == -1)
+        {
+            Log(LogGeneral, LogFatal, "Cannot create epoll instance: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static epoll_handler_ptr FindEpollHandler(unsigned int waitHandle)
+{
+    epoll_handler_ptr entry = epollHandlers;
+
+    while (entry != NULL && entry->handler.waitHandle != waitHandle)
+    {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+static void ProcessEpollEvents(void)
+{
+    int i;
+    int n;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    while(!shutdownRequested)
+    {
+        n = epoll_wait(epollFd, events, EPOLL_MAX_EVENTS, MillisecondsUntilNextDue());
+        ClockUpdate();
+        if (n == -1)
+        {
+            if (errno != EINTR)
+            {
+                Log(LogGeneral, LogError, "epoll_wait error: %d\n", errno);
+            }
+        }
+        else
+        {
+            ProcessTimers();
+            for (i = 0; i < n; i++)
+            {
+                epoll_handler_ptr entry = (epoll_handler_ptr)events[i].data.ptr;
+                if (!entry->deleted && (events[i].events & EPOLLOUT) && entry->handler.writeHandler != NULL)
+                {
+                    entry->handler.writeHandler(entry->handler.writeContext);
+                }
+
+                if (!entry->deleted && (events[i].events & ~EPOLLOUT))
+                {
+                    entry->handler.eventHandler(entry->handler.context);
+                }
+            }
+
+            FreeDeletedEpollHandlers();
+        }
+    }
+}
+
+#if defined(USE_IO_URING)
+static void ProcessUringEvents(void)
+{
+    int i;
+    int n;
+    uring_event_t events[EPOLL_MAX_EVENTS];
+
+    while(!shutdownRequested)
+    {
+        n = UringWait(MillisecondsUntilNextDue(), events, EPOLL_MAX_EVENTS);
+        ClockUpdate();
+        if (n == -1)
+        {
+            if (errno != EINTR)
+            {
+                Log(LogGeneral, LogError, "io_uring wait error: %d\n", errno);
+            }
+        }
+        else
+        {
+            ProcessTimers();
+            for (i = 0; i < n; i++)
+            {
+                epoll_handler_ptr entry = (epoll_handler_ptr)events[i].userData;
+                if (events[i].received)
+                {
+                    /* data is waiting in the ring receiver, it is reported again on the next pass if the handler leaves any unread */
+                    if (!entry->deleted)
+                    {
+                        entry->handler.eventHandler(entry->handler.context);
+                    }
+                }
+                else
+                {
+                    if (events[i].writable)
+                    {
+                        entry->writeArmed = 0;
+                    }
+                    else
+                    {
+                        entry->armed = 0;
+                    }
+
+                    if (entry->deleted)
+                    {
+                        if (!entry->armed && !entry->writeArmed)
+                        {
+                            /* this was its last outstanding poll request, freed after this batch as a receive event may follow */
+                            entry->next = deletedEpollHandlers;
+                            deletedEpollHandlers = entry;
+                        }
+                    }
+                    else if (events[i].result < 0)
+                    {
+                        Log(LogGeneral, LogError, "io_uring poll error %d for %s, handle is %d\n", -events[i].result, entry->handler.name, entry->handler.waitHandle);
+                    }
+                    else if (events[i].writable)
+                    {
+                        if (entry->handler.writeHandler != NULL)
+                        {
+                            entry->handler.writeHandler(entry->handler.writeContext);
+                            if (!entry->deleted && entry->handler.writeHandler != NULL && !entry->writeArmed)
+                            {
+                                UringAddPoll((int)entry->handler.waitHandle, entry, 1);
+                                entry->writeArmed = 1;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        entry->handler.eventHandler(entry->handler.context);
+                        if (!entry->deleted && !entry->ringReceive)
+                        {
+                            UringAddPoll((int)entry->handler.waitHandle, entry, 0);
+                            entry->armed = 1;
+                        }
+                    }
+                }
+            }
+
+            FreeDeletedEpollHandlers();
+        }
+    }
+}
+#endif
+
+static void FreeDeletedEpollHandlers(void)
+{
+    while (deletedEpollHandlers != NULL)
+    {
+        epoll_handler_ptr next = deletedEpollHandlers->next;
+        free(deletedEpollHandlers);
+        deletedEpollHandlers = next;
+    }
+}
+#endif
+
 #endif
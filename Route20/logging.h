@@ -43,6 +43,9 @@ typedef enum
     LogEthCircuit,
 	LogEthPcapLine,
 	LogEthSockLine,
+	LogEthPacketLine,
+	LogEthXdpLine,
+	LogEthTapLine,
 	LogDdcmpSock,
 	LogDdcmp,
 	LogDdcmpInit,
@@ -285,7 +285,7 @@ static void ProcessLinkActivity(decnet_address_t *from, nsp_header_t *header)
 
 static void ProcessLinkConnectionCompletionMessage(decnet_address_t *from, nsp_header_t *header)
 {
-	time_t now;
+	clock_ms_t now;
 
 	if (IsDataAcknowledgementMessage((byte *)header) || IsInterruptMessage((byte *)header) || IsLinkServiceMessage((byte *)header) || IsOtherDataAcknowledgementMessage((byte *)header))
 	{
@@ -297,8 +297,8 @@ static void ProcessLinkConnectionCompletionMessage(decnet_address_t *from, nsp_h
 			if (port->state == NspPortStateConnectConfirm)
 			{
 				SetPortState(port, NspPortStateRunning);
-				time(&now);
-				port->inactivityTimer = CreateTimer("NSP Inactivity Timer", now + NspConfig.NSPInactTim, 0, port, HandleInactivityTimer);
+				now = ClockNow();
+				port->inactivityTimer = CreateTimer("NSP Inactivity Timer", now + SECS_TO_MS(NspConfig.NSPInactTim), 0, port, HandleInactivityTimer);
 			}
 		}
 	}
@@ -33,6 +33,14 @@
 
 #define MAX_EVENT_HANDLERS 32
 
+#if defined(__linux__)
+#define USE_EPOLL /* event handlers are registered directly with epoll, so MAX_EVENT_HANDLERS does not apply */
+#define USE_MMSG  /* recvmmsg and sendmmsg are available to move several datagrams in one call */
+#define USE_PACKET_RING /* AF_PACKET rings are available as an alternative Ethernet driver to pcap */
+#define USE_XDP /* AF_XDP sockets are available as an alternative Ethernet driver to pcap */
+#define USE_TAP /* TAP devices are available for [tap] circuits */
+#endif
+
 #if defined(WIN32)
 typedef int socklen_t;
 #define uint_ptr UINT_PTR
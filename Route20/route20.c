@@ -38,11 +38,14 @@ in this Software without prior written authorization from the author.
 #include "route20.h"
 #include "circuit.h"
 #include "line.h"
+#include "eth_tap_line.h"
+#include "eth_pcap_line.h"
 #include "messages.h"
 #include "decnet.h"
 #include "adjacency.h"
 #include "timer.h"
 #include "init_layer.h"
+#include "ddcmp.h"
 #include "ddcmp_init_layer.h"
 #include "routing_database.h"
 #include "decision.h"
@@ -54,7 +57,9 @@ in this Software without prior written authorization from the author.
 #include "node.h"
 #include "socket.h"
 
+#if !defined(USE_EPOLL)
 event_handler_t eventHandlers[MAX_EVENT_HANDLERS];
+#endif
 int numEventHandlers;
 int eventHandlersChanged;
 
@@ -63,6 +68,12 @@ static init_layer_t *ethernetInitLayer;
 static init_layer_t *ddcmpInitLayer;
 static void (*processHigherLevelProtocolPacket)(decnet_address_t *from, byte *data, uint16 dataLength) = NULL;
 static rtimer_t *statsTimer = NULL;
+static int receiveBudget = RECEIVE_BUDGET;
+static circuit_t *receiveRunQueue[NC]; /* circuits which used their whole receive budget and may have more packets waiting */
+static int receiveRunQueueHead = 0;
+static int receiveRunQueueCount = 0;
+static int receivePending[NC + 1];
+static int receiveRunQueueScheduled = 0;
 
 // TODO: Add Phase III support
 static char *ReadConfigLine(FILE *f);
@@ -72,7 +83,9 @@ static char *ReadNodeConfig(FILE *f, ConfigReadMode mode, int *ans);
 static char *ReadSocketConfig(FILE *f, ConfigReadMode mode, int *ans);
 static char *ReadEthernetConfig(FILE *f, ConfigReadMode mode, int *ans);
 static char *ReadBridgeConfig(FILE *f, ConfigReadMode mode, int *ans);
+static char *ReadTapConfig(FILE *f, ConfigReadMode mode, int *ans);
 static char *ReadDdcmpConfig(FILE *f, ConfigReadMode mode, int *ans);
+static int ReadEgressConfigItem(char *name, char *value, int *queueLimit, long *rateLimit, long *rateBurst);
 static char *ReadNspConfig(FILE *f, ConfigReadMode mode, int *ans);
 static char *ReadSessionConfig(FILE *f, ConfigReadMode mode, int *ans);
 static char *ReadDnsConfig(FILE *f, ConfigReadMode mode, int *ans);
@@ -84,6 +97,9 @@ static void LogAllStats(rtimer_t *, char *, void *);
 static void LogCircuitStats(circuit_t *);
 static void LogLineStats(line_t *);
 static int ProcessSingleCircuitPacket(circuit_t *circuit);
+static int ProcessCircuitPackets(circuit_t *circuit);
+static void ScheduleCircuitReceive(circuit_t *circuit);
+static void ProcessReceiveRunQueue(void *context);
 static void ProcessPhaseIIMessage(circuit_t *circuit, packet_t *packet);
 static void ProcessPhaseIVMessage(circuit_t *circuit, packet_t *packet);
 static int RouterHelloIsForThisNode(decnet_address_t *from, int iinfo);
@@ -116,6 +132,9 @@ void InitialiseLogging(void)
     LogSourceName[LogEthCircuit] = "ECR";
     LogSourceName[LogEthPcapLine] = "EPL";
     LogSourceName[LogEthSockLine] = "ESL";
+    LogSourceName[LogEthPacketLine] = "EKL";
+    LogSourceName[LogEthXdpLine] = "EXL";
+    LogSourceName[LogEthTapLine] = "ETL";
     LogSourceName[LogDdcmpSock] = "DSK";
     LogSourceName[LogDdcmp] = "DDC";
     LogSourceName[LogDdcmpInit] = "DDI";
@@ -152,7 +171,7 @@ int InitialiseConfig(int (*ConfigReader)(char *fileName, ConfigReadMode mode), c
 int DecnetInitialise(void)
 {
     int ans = 1;
-    time_t now;
+    clock_ms_t now;
 
     InitialiseSockets();
     InitialiseAdjacencies();
@@ -161,8 +180,8 @@ int DecnetInitialise(void)
     SetAdjacencyStateChangeCallback(ProcessAdjacencyStateChange);
     SetCircuitStateChangeCallback(ProcessCircuitStateChange);
     nodeInfo.state = Running;
-    time(&now);
-    CreateTimer("PurgeAdjacencies", now + 1, 1, NULL, PurgeAdjacenciesCallback);
+    now = ClockNow();
+    CreateTimer("PurgeAdjacencies", now + SECS_TO_MS(1), SECS_TO_MS(1), NULL, PurgeAdjacenciesCallback);
 
     ethernetInitLayer = CreateEthernetInitializationSublayer();
     InitializationSublayerAssociateCircuits(Circuits, numCircuits, EthernetCircuit, ethernetInitLayer);
@@ -185,6 +204,7 @@ void RoutingSetCallback(void (*callback)(decnet_address_t *from, byte *data, uin
 	processHigherLevelProtocolPacket = callback;
 }
 
+#if !defined(USE_EPOLL)
 void RegisterEventHandler(unsigned int waitHandle, char *name, void *context, void (*eventHandler)(void *context))
 {
     int i;
@@ -214,6 +234,8 @@ void RegisterEventHandler(unsigned int waitHandle, char *name, void *context, vo
 	eventHandlers[entry].eventHandler = eventHandler;
     if (entry >= numEventHandlers)
     {
+        eventHandlers[entry].writeContext = NULL;
+        eventHandlers[entry].writeHandler = NULL;
         numEventHandlers++;
         eventHandlersChanged = 1;
     }
@@ -247,6 +269,48 @@ void DeregisterEventHandler(unsigned int waitHandle)
     }
 }
 
+void RegisterWriteHandler(unsigned int waitHandle, void *context, void (*writeHandler)(void *context))
+{
+	int i;
+	int found = 0;
+	for (i = 0; i < numEventHandlers; i++)
+	{
+		if (eventHandlers[i].waitHandle == waitHandle)
+		{
+			Log(LogGeneral, LogVerbose, "Registering write handler for %s in slot %d, handle is %d\n", eventHandlers[i].name, i, waitHandle);
+			eventHandlers[i].writeContext = context;
+			eventHandlers[i].writeHandler = writeHandler;
+			found = 1;
+		}
+	}
+
+	if (found)
+	{
+	    eventHandlersChanged = 1;
+	}
+    else
+    {
+        Log(LogGeneral, LogWarning, "Unable to register write handler as the registration entry for the handle %d could not be found\n", waitHandle);
+    }
+}
+
+void DeregisterWriteHandler(unsigned int waitHandle)
+{
+	/* the event handler may already have been deregistered along with the handle, in which case there is nothing to do */
+	int i;
+	for (i = 0; i < numEventHandlers; i++)
+	{
+		if (eventHandlers[i].waitHandle == waitHandle && eventHandlers[i].writeHandler != NULL)
+		{
+			Log(LogGeneral, LogVerbose, "Deregistering write handler for %s in slot %d, handle is %d\n", eventHandlers[i].name, i, waitHandle);
+			eventHandlers[i].writeContext = NULL;
+			eventHandlers[i].writeHandler = NULL;
+			eventHandlersChanged = 1;
+		}
+	}
+}
+#endif
+
 void MainLoop(void)
 {
 	Log(LogGeneral, LogInfo, "Main loop start\n");
@@ -263,7 +327,8 @@ void MainLoop(void)
 	ddcmpInitLayer->Stop();
 
 	/* handle any final events queued for immediate processing as part of shutdown */
-	while (SecondsUntilNextDue() == 0)
+	ClockUpdate();
+	while (MillisecondsUntilNextDue() == 0)
 	{
 	    ProcessTimers();
 	}
@@ -323,6 +388,10 @@ int ReadConfig(char *fileName, ConfigReadMode mode)
 			{
 				line = ReadBridgeConfig(f, mode, &ans);
 			}
+			else if (stricmp(line, "[tap]") == 0)
+			{
+				line = ReadTapConfig(f, mode, &ans);
+			}
 			else if (stricmp(line, "[ddcmp]") == 0)
 			{
 				line = ReadDdcmpConfig(f, mode, &ans);
@@ -450,6 +519,18 @@ static char *ReadLoggingConfig(FILE *f, ConfigReadMode mode, int *ans)
 			{
 				ParseLogLevel(value, &LoggingLevels[LogEthSockLine]);
 			}
+			else if (stricmp(name, "ethpacketline") == 0)
+			{
+				ParseLogLevel(value, &LoggingLevels[LogEthPacketLine]);
+			}
+			else if (stricmp(name, "ethxdpline") == 0)
+			{
+				ParseLogLevel(value, &LoggingLevels[LogEthXdpLine]);
+			}
+			else if (stricmp(name, "ethtapline") == 0)
+			{
+				ParseLogLevel(value, &LoggingLevels[LogEthTapLine]);
+			}
 			else if (stricmp(name, "ddcmpsock") == 0)
 			{
 				ParseLogLevel(value, &LoggingLevels[LogDdcmpSock]);
@@ -543,6 +624,15 @@ static char *ReadNodeConfig(FILE *f, ConfigReadMode mode, int *ans)
 				{
 					nodeInfo.priority = (byte)atoi(value);
 				}
+				else if (stricmp(name, "receivebudget") == 0)
+				{
+					receiveBudget = atoi(value);
+					if (receiveBudget < 1)
+					{
+						Log(LogGeneral, LogError, "ReceiveBudget must be at least 1, using %d\n", RECEIVE_BUDGET);
+						receiveBudget = RECEIVE_BUDGET;
+					}
+				}
 			}
 		}
 
@@ -617,6 +707,15 @@ static char *ReadEthernetConfig(FILE *f, ConfigReadMode mode, int *ans)
 	char *value;
 	int cost = 3;
 	char pcapInterface[80] = "";
+	eth_pcap_options_t pcapOptions;
+	int usePacketRing = 0;
+	int useXdp = 0;
+	int xdpQueue = 0;
+	int queueLimit = EGRESS_QUEUE_LIMIT;
+	long rateLimit = 0;
+	long rateBurst = 0;
+
+	EthPcapInitialiseOptions(&pcapOptions);
 
 	if (mode == ConfigReadModeFull)
 	{
@@ -637,6 +736,55 @@ static char *ReadEthernetConfig(FILE *f, ConfigReadMode mode, int *ans)
 				{
 					cost = atoi(value);
 				}
+				if (stricmp(name, "driver") == 0)
+				{
+					if (stricmp(value, "packet") == 0)
+					{
+#if defined(USE_PACKET_RING)
+						usePacketRing = 1;
+#else
+						Log(LogGeneral, LogWarning, "The packet driver is not available on this platform, using pcap\n");
+#endif
+					}
+					else if (stricmp(value, "xdp") == 0)
+					{
+#if defined(USE_XDP)
+						useXdp = 1;
+#else
+						Log(LogGeneral, LogWarning, "The xdp driver is not available on this platform, using pcap\n");
+#endif
+					}
+					else if (stricmp(value, "pcap") != 0)
+					{
+						Log(LogGeneral, LogWarning, "Unknown ethernet driver %s, using pcap\n", value);
+					}
+				}
+				if (stricmp(name, "XdpQueue") == 0)
+				{
+					xdpQueue = atoi(value);
+				}
+				if (stricmp(name, "BufferSize") == 0)
+				{
+					pcapOptions.bufferSize = atoi(value);
+				}
+				if (stricmp(name, "ImmediateMode") == 0)
+				{
+					pcapOptions.immediateMode = atoi(value) != 0;
+				}
+				if (stricmp(name, "Timeout") == 0)
+				{
+					pcapOptions.timeout = atoi(value);
+				}
+				if (stricmp(name, "ReadBatch") == 0)
+				{
+					pcapOptions.readBatch = atoi(value);
+					if (pcapOptions.readBatch < 1 || pcapOptions.readBatch > PCAP_MAX_READ_BATCH)
+					{
+						Log(LogGeneral, LogWarning, "ReadBatch must be between 1 and %d, using %d\n", PCAP_MAX_READ_BATCH, PCAP_READ_BATCH);
+						pcapOptions.readBatch = PCAP_READ_BATCH;
+					}
+				}
+				ReadEgressConfigItem(name, value, &queueLimit, &rateLimit, &rateBurst);
 			}
 		}
 
@@ -654,7 +802,24 @@ static char *ReadEthernetConfig(FILE *f, ConfigReadMode mode, int *ans)
 			else
 			{
 				Log(LogGeneral, LogInfo, "Ethernet interface is: %s\n", pcapInterface);
-				CircuitCreateEthernetPcap(&Circuits[1 + numCircuits++], pcapInterface, cost, ProcessCircuitEvent);
+#if defined(USE_XDP)
+				if (useXdp)
+				{
+					CircuitCreateEthernetXdp(&Circuits[1 + numCircuits++], pcapInterface, xdpQueue, cost, ProcessCircuitEvent);
+				}
+				else
+#endif
+#if defined(USE_PACKET_RING)
+				if (usePacketRing)
+				{
+					CircuitCreateEthernetPacket(&Circuits[1 + numCircuits++], pcapInterface, cost, ProcessCircuitEvent);
+				}
+				else
+#endif
+				{
+					CircuitCreateEthernetPcap(&Circuits[1 + numCircuits++], pcapInterface, &pcapOptions, cost, ProcessCircuitEvent);
+				}
+				CircuitConfigureEgress(&Circuits[numCircuits], queueLimit, rateLimit, rateBurst);
 			}
 		}
 	}
@@ -666,6 +831,81 @@ static char *ReadEthernetConfig(FILE *f, ConfigReadMode mode, int *ans)
 	return line;
 }
 
+static char *ReadTapConfig(FILE *f, ConfigReadMode mode, int *ans)
+{
+	char *line;
+	char *name;
+	char *value;
+	int cost = 3;
+	int queueCount = 1;
+	char device[80] = "";
+	int queueLimit = EGRESS_QUEUE_LIMIT;
+	long rateLimit = 0;
+	long rateBurst = 0;
+
+	if (mode == ConfigReadModeFull)
+	{
+		while ((line = ReadConfigLine(f)))
+		{
+			if (*line == '[')
+			{
+				break;
+			}
+
+			if (SplitString(line, '=', &name, &value))
+			{
+				if (stricmp(name, "device") == 0)
+				{
+					strncpy(device, value, sizeof(device) -1);
+				}
+				if (stricmp(name, "queues") == 0)
+				{
+					queueCount = atoi(value);
+				}
+				if (stricmp(name, "cost") == 0)
+				{
+					cost = atoi(value);
+				}
+				ReadEgressConfigItem(name, value, &queueLimit, &rateLimit, &rateBurst);
+			}
+		}
+
+		if (*device == '\0')
+		{
+			*ans = 0;
+			Log(LogGeneral, LogError, "Device not defined for tap circuit\n");
+		}
+		else if (queueCount < 1 || queueCount > TAP_MAX_QUEUES)
+		{
+			*ans = 0;
+			Log(LogGeneral, LogError, "Tap circuit %s must have between 1 and %d queues\n", device, TAP_MAX_QUEUES);
+		}
+		else
+		{
+#if defined(USE_TAP)
+			if (numCircuits >= NC)
+			{
+				Log(LogGeneral, LogError, "Too many circuit definitions, ignoring tap device %s\n", device);
+			}
+			else
+			{
+				Log(LogGeneral, LogInfo, "Tap device is: %s\n", device);
+				CircuitCreateEthernetTap(&Circuits[1 + numCircuits++], device, queueCount, cost, ProcessCircuitEvent);
+				CircuitConfigureEgress(&Circuits[numCircuits], queueLimit, rateLimit, rateBurst);
+			}
+#else
+			Log(LogGeneral, LogError, "Tap circuits are not available on this platform, ignoring tap device %s\n", device);
+#endif
+		}
+	}
+	else
+	{
+		line = ReadConfigToNextSection(f);
+	}
+
+	return line;
+}
+
 static char *ReadBridgeConfig(FILE *f, ConfigReadMode mode, int *ans)
 {
 	char  *line;
@@ -677,6 +917,9 @@ static char *ReadBridgeConfig(FILE *f, ConfigReadMode mode, int *ans)
 	uint16 destPort = 0;
 	uint16 receivePort = 0;
 	int    cost = 5;
+	int    queueLimit = EGRESS_QUEUE_LIMIT;
+	long   rateLimit = 0;
+	long   rateBurst = 0;
 
 	if (mode == ConfigReadModeFull)
 	{
@@ -713,6 +956,7 @@ static char *ReadBridgeConfig(FILE *f, ConfigReadMode mode, int *ans)
 				{
 					cost = atoi(value);
 				}
+				ReadEgressConfigItem(name, value, &queueLimit, &rateLimit, &rateBurst);
 			}
 		}
 
@@ -736,6 +980,7 @@ static char *ReadBridgeConfig(FILE *f, ConfigReadMode mode, int *ans)
 			{
 				Log(LogGeneral, LogInfo, "Bridge interface sends to %s:%d and listens on %d\n", hostName, destPort, receivePort);
 				CircuitCreateEthernetSocket(&Circuits[1 + numCircuits++], hostName, receivePort, destPort, cost, ProcessCircuitEvent);
+				CircuitConfigureEgress(&Circuits[numCircuits], queueLimit, rateLimit, rateBurst);
 				dnsNeeded = 1;
 			}
 		}
@@ -758,6 +1003,12 @@ static char *ReadDdcmpConfig(FILE *f, ConfigReadMode mode, int *ans)
 	uint16 port;
 	int    cost = 5;
     int    connectPoll = 30;
+	ddcmp_options_t ddcmpOptions;
+	int    queueLimit = EGRESS_QUEUE_LIMIT;
+	long   rateLimit = 0;
+	long   rateBurst = 0;
+
+	DdcmpInitialiseOptions(&ddcmpOptions);
 
 	if (mode == ConfigReadModeFull)
 	{
@@ -798,6 +1049,67 @@ static char *ReadDdcmpConfig(FILE *f, ConfigReadMode mode, int *ans)
 				{
 					connectPoll = atoi(value);
 				}
+
+				if (stricmp(name, "window") == 0)
+				{
+					ddcmpOptions.windowSize = atoi(value);
+					if (ddcmpOptions.windowSize < 1 || ddcmpOptions.windowSize > DDCMP_MAX_WINDOW)
+					{
+						Log(LogGeneral, LogWarning, "DDCMP window must be between 1 and %d, using %d\n", DDCMP_MAX_WINDOW, DDCMP_DEFAULT_WINDOW);
+						ddcmpOptions.windowSize = DDCMP_DEFAULT_WINDOW;
+					}
+				}
+
+				if (stricmp(name, "ackdelay") == 0)
+				{
+					ddcmpOptions.ackDelay = atoi(value);
+				}
+
+				if (stricmp(name, "replytimermin") == 0)
+				{
+					ddcmpOptions.replyTimerMin = atoi(value);
+				}
+
+				if (stricmp(name, "replytimermax") == 0)
+				{
+					ddcmpOptions.replyTimerMax = atoi(value);
+				}
+
+				if (stricmp(name, "udpport") == 0)
+				{
+					ddcmpOptions.udpPort = (uint16)atoi(value);
+				}
+
+				if (stricmp(name, "tcpmode") == 0)
+				{
+					if (stricmp(value, "nodelay") == 0)
+					{
+						ddcmpOptions.tcpPolicy = DdcmpTcpNoDelay;
+					}
+					else if (stricmp(value, "nagle") == 0)
+					{
+						ddcmpOptions.tcpPolicy = DdcmpTcpNagle;
+					}
+					else if (stricmp(value, "cork") == 0)
+					{
+						ddcmpOptions.tcpPolicy = DdcmpTcpCork;
+					}
+					else
+					{
+						Log(LogGeneral, LogWarning, "Unknown DDCMP TcpMode %s, must be NoDelay, Nagle or Cork\n", value);
+					}
+				}
+
+				if (stricmp(name, "backlog") == 0)
+				{
+					ddcmpOptions.backlogLimit = atoi(value);
+					if (ddcmpOptions.backlogLimit < 0)
+					{
+						ddcmpOptions.backlogLimit = 0;
+					}
+				}
+
+				ReadEgressConfigItem(name, value, &queueLimit, &rateLimit, &rateBurst);
 			}
 		}
 
@@ -806,6 +1118,11 @@ static char *ReadDdcmpConfig(FILE *f, ConfigReadMode mode, int *ans)
 			*ans = 0;
 			Log(LogGeneral, LogError, "Address not defined for DDCMP circuit\n");
 		}
+		else if (ddcmpOptions.udpPort != 0 && port == 0)
+		{
+			*ans = 0;
+			Log(LogGeneral, LogError, "Address for DDCMP circuit %s over UDP must include the port\n", hostName);
+		}
 		else
 		{
 			if (numCircuits >= NC)
@@ -814,7 +1131,11 @@ static char *ReadDdcmpConfig(FILE *f, ConfigReadMode mode, int *ans)
 			}
 			else
 			{
-				if (port == 0)
+				if (ddcmpOptions.udpPort != 0)
+				{
+				    Log(LogGeneral, LogInfo, "DDCMP interface over UDP to %s:%d from port %d\n", hostName, port, ddcmpOptions.udpPort);
+				}
+				else if (port == 0)
 				{
 				    Log(LogGeneral, LogInfo, "DDCMP interface expecting connections from %s\n", hostName);
 				}
@@ -823,7 +1144,8 @@ static char *ReadDdcmpConfig(FILE *f, ConfigReadMode mode, int *ans)
 				    Log(LogGeneral, LogInfo, "DDCMP interface connecting to %s:%d\n", hostName, port);
 				}
 
-				CircuitCreateDdcmpSocket(&Circuits[1 + numCircuits++], hostName, port, cost, connectPoll, ProcessCircuitEvent);
+				CircuitCreateDdcmpSocket(&Circuits[1 + numCircuits++], hostName, port, cost, connectPoll, &ddcmpOptions, ProcessCircuitEvent);
+				CircuitConfigureEgress(&Circuits[numCircuits], queueLimit, rateLimit, rateBurst);
 				dnsNeeded = 1;
 			}
 		}
@@ -836,6 +1158,35 @@ static char *ReadDdcmpConfig(FILE *f, ConfigReadMode mode, int *ans)
 	return line;
 }
 
+static int ReadEgressConfigItem(char *name, char *value, int *queueLimit, long *rateLimit, long *rateBurst)
+{
+	int ans = 1;
+
+	if (stricmp(name, "queuelimit") == 0)
+	{
+		*queueLimit = atoi(value);
+		if (*queueLimit < 1)
+		{
+			Log(LogGeneral, LogError, "QueueLimit must be at least 1, using %d\n", EGRESS_QUEUE_LIMIT);
+			*queueLimit = EGRESS_QUEUE_LIMIT;
+		}
+	}
+	else if (stricmp(name, "ratelimit") == 0)
+	{
+		*rateLimit = atol(value);
+	}
+	else if (stricmp(name, "rateburst") == 0)
+	{
+		*rateBurst = atol(value);
+	}
+	else
+	{
+		ans = 0;
+	}
+
+	return ans;
+}
+
 static char *ReadNspConfig(FILE *f, ConfigReadMode mode, int *ans)
 {
 	char *line;
@@ -988,10 +1339,10 @@ static char *ReadStatsConfig(FILE *f, ConfigReadMode mode, int *ans)
 
 		if (period > 0)
 		{
-			time_t now;
+			clock_ms_t now;
 
-			time(&now);
-			statsTimer = CreateTimer("CircuitStats", now + period, period, NULL, LogAllStats);
+			now = ClockNow();
+			statsTimer = CreateTimer("CircuitStats", now + SECS_TO_MS(period), SECS_TO_MS(period), NULL, LogAllStats);
 		}
 	}
 	else
@@ -1121,6 +1472,8 @@ static void LogCircuitStats(circuit_t *circuit)
     Log(LogGeneral, LogFatal, "  Loopback packets received:            %d\n", circuit->stats.loopbackPacketsReceived);
     Log(LogGeneral, LogFatal, "  Valid raw packets received:           %d\n", circuit->stats.validRawPacketsReceived);
     Log(LogGeneral, LogFatal, "  Packets sent:                         %d\n", circuit->stats.packetsSent);
+    Log(LogGeneral, LogFatal, "  Packets queued for transmission:      %d\n", circuit->stats.packetsQueued);
+    Log(LogGeneral, LogFatal, "  Packets discarded due to congestion:  %d\n", circuit->stats.packetsDiscardedCongestion);
 }
 
 static void LogLineStats(line_t *line)
@@ -1128,40 +1481,26 @@ static void LogLineStats(line_t *line)
     Log(LogGeneral, LogFatal, "Line %s\n", line->name);
     Log(LogGeneral, LogFatal, "  Valid packets received:              %d\n", line->stats.validPacketsReceived);
     Log(LogGeneral, LogFatal, "  Invalid packets received:            %d\n", line->stats.invalidPacketsReceived);
+    Log(LogGeneral, LogFatal, "  Packets queued for retry:            %d\n", line->stats.packetsQueuedForRetry);
+    Log(LogGeneral, LogFatal, "  Packets discarded on transmit:       %d\n", line->stats.packetsDiscardedTransmit);
 }
 
 void ProcessCircuitEvent(void *context) /* TODO: not sure this should in here */
 {
 	circuit_t *circuit;
-	//int foundData;
-	//int i;
 
 	// TODO: Implement flow control. Look at routing spec.
 	circuit = (circuit_t *)context;
 
-    // Two processing methods available, not decided which one is best.
-#if 1
-	while (ProcessSingleCircuitPacket(circuit))
-    {
-    }
-#else
-	// Process the packet on the circuit that caused the event, and then round robin all the other circuits until none have any data to process.
-    // TODO: Need to add the concept of a Line, so can poll for input when a line is up rather than when a circuit is up. Because we need data to be exchanged before a circuit can be up, so can't use circuit status to decide whether to read a line or not.
-	ProcessSingleCircuitPacket(circuit);
-
-	do
+	/* A circuit that is already waiting in the run queue gets its next turn from there, otherwise a busy circuit
+	   could jump the queue every time its line signals and starve the other circuits. */
+	if (!receivePending[circuit->slot])
 	{
-		foundData = 0;
-		for (i = 1; i <= numCircuits; i++)
+		if (ProcessCircuitPackets(circuit))
 		{
-			if (ProcessSingleCircuitPacket(&Circuits[i]))
-			{
-				foundData = 1;
-			}
+			ScheduleCircuitReceive(circuit);
 		}
 	}
-	while (foundData);
-#endif
 }
 
 static int ProcessSingleCircuitPacket(circuit_t *circuit)
@@ -1179,6 +1518,57 @@ static int ProcessSingleCircuitPacket(circuit_t *circuit)
 	return ans;
 }
 
+/* Reads at most the receive budget of packets from the circuit, returns true if the budget was used up so there may be more to read */
+static int ProcessCircuitPackets(circuit_t *circuit)
+{
+	int count = 0;
+
+	while (count < receiveBudget && ProcessSingleCircuitPacket(circuit))
+	{
+		count++;
+	}
+
+	return count >= receiveBudget;
+}
+
+static void ScheduleCircuitReceive(circuit_t *circuit)
+{
+	if (!receivePending[circuit->slot] && receiveRunQueueCount < NC)
+	{
+		receiveRunQueue[(receiveRunQueueHead + receiveRunQueueCount) % NC] = circuit;
+		receiveRunQueueCount++;
+		receivePending[circuit->slot] = 1;
+	}
+
+	if (!receiveRunQueueScheduled)
+	{
+		/* run as soon as the event loop has checked for other ready lines */
+		receiveRunQueueScheduled = 1;
+		QueueImmediate(NULL, ProcessReceiveRunQueue);
+	}
+}
+
+static void ProcessReceiveRunQueue(void *context)
+{
+	int n = receiveRunQueueCount;
+
+	receiveRunQueueScheduled = 0;
+
+	/* one pass round robin over the circuits that were waiting, each one that uses its whole budget again goes to the back of the queue */
+	while (n-- > 0)
+	{
+		circuit_t *circuit = receiveRunQueue[receiveRunQueueHead];
+		receiveRunQueueHead = (receiveRunQueueHead + 1) % NC;
+		receiveRunQueueCount--;
+		receivePending[circuit->slot] = 0;
+
+		if (ProcessCircuitPackets(circuit))
+		{
+			ScheduleCircuitReceive(circuit);
+		}
+	}
+}
+
 void ProcessPacket(circuit_t *circuit, packet_t *packet)
 {
 	if (nodeInfo.state == Running)
@@ -45,10 +45,14 @@ typedef struct
     char *name;
 	void *context;
 	void (*eventHandler)(void *context);
+	void *writeContext;
+	void (*writeHandler)(void *context); /* NULL unless the handle is being watched for write readiness */
 
 } event_handler_t;
 
+#if !defined(USE_EPOLL)
 extern event_handler_t eventHandlers[MAX_EVENT_HANDLERS];
+#endif
 extern int numEventHandlers;
 extern int eventHandlersChanged;
 
@@ -60,6 +64,9 @@ void ProcessCircuitEvent(void *context);
 void RoutingSetCallback(void (*callback)(decnet_address_t *from, byte *data, uint16 dataLength));
 void RegisterEventHandler(unsigned int waitHandle, char *name, void *context, void (*eventHandler)(void *context));
 void DeregisterEventHandler(unsigned int waitHandle);
+/* Calls writeHandler each time the handle can be written until DeregisterWriteHandler, the handle must already have an event handler */
+void RegisterWriteHandler(unsigned int waitHandle, void *context, void (*writeHandler)(void *context));
+void DeregisterWriteHandler(unsigned int waitHandle);
 void ProcessPacket(circuit_t *circuit, packet_t *packet);
 void MainLoop(void);
 
@@ -211,16 +211,16 @@ static void ConnectCallback(decnet_address_t *remNode, uint16 locAddr, uint16 re
             uint16 reason;
             byte *acceptData;
             byte acceptDataLength;
-            time_t now;
+            clock_ms_t now;
             if (registration->connectCallback((void *)session, remNode, NULL, 0, &reason, &acceptData, &acceptDataLength)) // TODO: probably should remove the object type and pass remaining data?
             {
-                time(&now);
+                now = ClockNow();
                 session->inUse = 1;
                 session->locAddr = locAddr;
                 session->remaddr = remAddr;
                 memcpy(&session->remNode, remNode, sizeof(decnet_address_t));
                 session->objectRegistration = registration;
-                session->inactivityTimer = CreateTimer("Session Inactivity Timer", now + SessionConfig.sessionInactivityTimeout, SessionConfig.sessionInactivityTimeout, session, HandleSessionInactivityTimer);
+                session->inactivityTimer = CreateTimer("Session Inactivity Timer", now + SECS_TO_MS(SessionConfig.sessionInactivityTimeout), SECS_TO_MS(SessionConfig.sessionInactivityTimeout), session, HandleSessionInactivityTimer);
                 NspAccept(locAddr, SERVICES_NONE, acceptDataLength, acceptData);
                 Log(LogSession, LogInfo, "Starting session with ");
                 LogDecnetAddress(LogSession, LogInfo, remNode);
@@ -29,6 +29,9 @@
 
 // TODO: Don't try outbound connect again, if there is still an outbound connect in progress
 
+#if defined(__linux__)
+#define _GNU_SOURCE /* for recvmmsg and sendmmsg */
+#endif
 #include "platform.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,9 +45,15 @@
 #else
 #include <unistd.h>
 #include <sys/time.h>
+#include <netinet/tcp.h>
+#endif
+#if defined(USE_IO_URING)
+#include "uring.h"
 #endif
 
 #define MAX_BUF_LEN 8192
+#define RING_DATAGRAM_BUFFERS 64 /* datagrams that can be received on the io_uring ring before they are read */
+#define RING_STREAM_BUFFERS 16   /* reads of up to MAX_BUF_LEN that can be received on the io_uring ring before they are read */
 
 socket_config_t SocketConfig;
 socket_t ListenSocket;
@@ -68,6 +77,8 @@ static void SetupSocketEvents(socket_t *sock, char *eventName, long events);
 static void CompleteSocketDisconnection(socket_t *sock);
 static void ProcessListenSocketEvent(void *context);
 static void ProcessConnectSocketEvent(void *context);
+static void StartRingReceive(socket_t *sock, int stream);
+static void StopRingReceive(socket_t *sock);
 #if defined(WIN32)
 static void LogNetworkEvent(WSANETWORKEVENTS *networkEvents, char *name, int mask, int bitNo);
 #endif
@@ -105,11 +116,18 @@ void InitialiseSocket(socket_t *sock, char *eventName)
     sock->socket = INVALID_SOCKET;
     sock->waitHandle = (unsigned int)-1;
     sock->eventName = eventName;
+#if defined(USE_IO_URING)
+	sock->receiver = NULL;
+#endif
 }
 
 int OpenUdpSocket(socket_t *sock, uint16 receivePort)
 {
 	int ans = OpenSocket(sock, sock->eventName, receivePort, SOCK_DGRAM, IPPROTO_UDP);
+	if (ans)
+	{
+		StartRingReceive(sock, 0);
+	}
 
 	return ans;
 }
@@ -163,16 +181,26 @@ int ReadFromDatagramSocket(socket_t *sock, packet_t *packet, sockaddr_t *receive
 	socklen_t ilen;
 
 	ans = 1;
-	ilen = sizeof(*receivedFrom);
-	packet->rawLen = recvfrom(sock->socket, (char *)buf, 1518, 0, receivedFrom, &ilen);
+#if defined(USE_IO_URING)
+	if (sock->receiver != NULL)
+	{
+		packet->rawLen = UringNextDatagram(sock->receiver, &packet->rawData, receivedFrom);
+	}
+	else
+#endif
+	{
+		ilen = sizeof(*receivedFrom);
+		packet->rawLen = recvfrom(sock->socket, (char *)buf, sizeof(buf), 0, receivedFrom, &ilen);
+		packet->rawData = buf;
+	}
+
 	if (packet->rawLen > 0)
 	{
         if (IsLoggable(LogSock, LogVerbose))
         {
 	        Log(LogSock, LogVerbose, "Read %d bytes on port %d\n", packet->rawLen, sock->receivePort);
-		    LogBytes(LogSock, LogVerbose, buf, packet->rawLen);
+		    LogBytes(LogSock, LogVerbose, packet->rawData, packet->rawLen);
         }
-		packet->rawData = buf;
 	}
 	else
 	{
@@ -182,6 +210,109 @@ int ReadFromDatagramSocket(socket_t *sock, packet_t *packet, sockaddr_t *receive
 	return  ans;
 }
 
+/* Reads as many datagrams as are waiting, up to DATAGRAM_BATCH_SIZE, replacing the previous contents of the batch */
+int ReadBatchFromDatagramSocket(socket_t *sock, datagram_batch_t *batch)
+{
+	int i;
+#if defined(USE_MMSG)
+	struct mmsghdr msgs[DATAGRAM_BATCH_SIZE];
+	struct iovec iovecs[DATAGRAM_BATCH_SIZE];
+	int received;
+#endif
+
+#if defined(USE_IO_URING)
+	if (sock->receiver != NULL)
+	{
+		byte *data;
+		int length;
+
+		batch->count = 0;
+		while (batch->count < DATAGRAM_BATCH_SIZE && (length = UringNextDatagram(sock->receiver, &data, &batch->address[batch->count])) > 0)
+		{
+			batch->length[batch->count] = (length < MAX_DATAGRAM_LEN) ? length : MAX_DATAGRAM_LEN;
+			memcpy(batch->buffer[batch->count], data, batch->length[batch->count]);
+			batch->count++;
+		}
+	}
+	else
+#endif
+	{
+#if defined(USE_MMSG)
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < DATAGRAM_BATCH_SIZE; i++)
+		{
+			iovecs[i].iov_base = batch->buffer[i];
+			iovecs[i].iov_len = MAX_DATAGRAM_LEN;
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &batch->address[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(batch->address[i]);
+		}
+
+		received = recvmmsg(sock->socket, msgs, DATAGRAM_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		batch->count = (received > 0) ? received : 0;
+		for (i = 0; i < batch->count; i++)
+		{
+			batch->length[i] = (int)msgs[i].msg_len;
+		}
+#else
+		socklen_t ilen = sizeof(batch->address[0]);
+
+		batch->count = 0;
+		batch->length[0] = recvfrom(sock->socket, (char *)batch->buffer[0], MAX_DATAGRAM_LEN, 0, &batch->address[0], &ilen);
+		if (batch->length[0] > 0)
+		{
+			batch->count = 1;
+		}
+#endif
+	}
+
+	batch->next = 0;
+
+	if (IsLoggable(LogSock, LogVerbose))
+	{
+		for (i = 0; i < batch->count; i++)
+		{
+			Log(LogSock, LogVerbose, "Read %d bytes on port %d\n", batch->length[i], sock->receivePort);
+			LogBytes(LogSock, LogVerbose, batch->buffer[i], batch->length[i]);
+		}
+	}
+
+	return batch->count;
+}
+
+int AppendToDatagramBatch(datagram_batch_t *batch, byte *data, int length, sockaddr_t *from)
+{
+	int ans = 0;
+
+	if (batch->next >= batch->count)
+	{
+		batch->count = 0;
+		batch->next = 0;
+	}
+	else if (batch->count >= DATAGRAM_BATCH_SIZE && batch->next > 0)
+	{
+		/* slide the datagrams not yet handed out to the front to make room */
+		int remaining = batch->count - batch->next;
+		memmove(batch->buffer[0], batch->buffer[batch->next], remaining * sizeof(batch->buffer[0]));
+		memmove(&batch->length[0], &batch->length[batch->next], remaining * sizeof(batch->length[0]));
+		memmove(&batch->address[0], &batch->address[batch->next], remaining * sizeof(batch->address[0]));
+		batch->count = remaining;
+		batch->next = 0;
+	}
+
+	if (batch->count < DATAGRAM_BATCH_SIZE && length <= MAX_DATAGRAM_LEN)
+	{
+		memcpy(batch->buffer[batch->count], data, length);
+		batch->length[batch->count] = length;
+		memcpy(&batch->address[batch->count], from, sizeof(batch->address[0]));
+		batch->count++;
+		ans = 1;
+	}
+
+	return ans;
+}
+
 int ReadFromStreamSocket(socket_t *sock, byte *buffer, int bufferLength)
 {
 	int ans;
@@ -190,7 +321,16 @@ int ReadFromStreamSocket(socket_t *sock, byte *buffer, int bufferLength)
 	ans = 0;
     if (!IsSockClosed(sock))
     {
-        bytesRead = recv(sock->socket, (char *)buffer, bufferLength, 0);
+#if defined(USE_IO_URING)
+        if (sock->receiver != NULL)
+        {
+            bytesRead = UringReadStream(sock->receiver, buffer, bufferLength);
+        }
+        else
+#endif
+        {
+            bytesRead = recv(sock->socket, (char *)buffer, bufferLength, 0);
+        }
         if (bytesRead > 0)
         {
             Log(LogSock, LogVerbose, "Read %d bytes on port %d\n", bytesRead, sock->receivePort);
@@ -275,45 +415,276 @@ int WriteToStreamSocket(socket_t *sock, byte *buffer, int bufferLength)
 	return ans;
 }
 
-int SendToSocket(socket_t *sock, sockaddr_t *destination, packet_t *packet)
+/* Gathers the buffers into a single send of as much as the socket will take without blocking. Returns the number of
+   bytes written, which may end part way through a buffer and is 0 if the socket buffer is full, or -1 if the connection
+   has failed. At most STREAM_WRITE_MAX_BUFFERS buffers are written at a time. */
+int WriteBuffersToStreamSocketNonBlocking(socket_t *sock, stream_buffer_t *buffers, int count)
 {
-	int ans = 0;
-	int retry = 0;
+	int ans = -1;
 
-	do
+	if (!IsSockClosed(sock))
 	{
-		if (sendto(sock->socket, (char *)packet->rawData, packet->rawLen, 0, destination, sizeof(*destination)) == -1)
+		int i;
+		int sentBytes;
+#if defined(WIN32)
+		WSABUF wsaBuffers[STREAM_WRITE_MAX_BUFFERS];
+		DWORD sent;
+#elif defined(__VAX)
+		int more = 1;
+#else
+		struct iovec iovecs[STREAM_WRITE_MAX_BUFFERS];
+		struct msghdr msg;
+		int flags = 0;
+#endif
+
+		if (count > STREAM_WRITE_MAX_BUFFERS)
 		{
+			count = STREAM_WRITE_MAX_BUFFERS;
+		}
+
 #if defined(WIN32)
-			if (IsSockErrorWouldBlock(GetSockError()))
+		for (i = 0; i < count; i++)
+		{
+			wsaBuffers[i].buf = (char *)buffers[i].data;
+			wsaBuffers[i].len = buffers[i].length;
+		}
+
+		sentBytes = (WSASend(sock->socket, wsaBuffers, count, &sent, 0, NULL, NULL) == SOCKET_ERROR) ? SOCKET_ERROR : (int)sent;
+#elif defined(__VAX)
+		/* there is no gathered send, so send the buffers in turn until one does not go completely */
+		sentBytes = 0;
+		for (i = 0; i < count && more; i++)
+		{
+			int sent = send(sock->socket, (char *)buffers[i].data, buffers[i].length, 0);
+			if (sent == SOCKET_ERROR)
 			{
-				retry = 1;
-				Sleep(1);
+				if (sentBytes == 0)
+				{
+					sentBytes = SOCKET_ERROR;
+				}
+
+				more = 0;
 			}
 			else
 			{
-				retry = 0;
-				SockError("sendto");
+				sentBytes += sent;
+				more = sent == buffers[i].length;
 			}
+		}
 #else
-			SockError("sendto");
+		for (i = 0; i < count; i++)
+		{
+			iovecs[i].iov_base = buffers[i].data;
+			iovecs[i].iov_len = buffers[i].length;
+		}
+
+		/* sendmsg rather than writev, so that flags can be given */
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iovecs;
+		msg.msg_iovlen = count;
+#if defined(MSG_NOSIGNAL)
+		flags = MSG_NOSIGNAL; /* a connection reset by the peer is reported as an error rather than SIGPIPE */
+#endif
+		sentBytes = (int)sendmsg(sock->socket, &msg, flags);
 #endif
+		if (sentBytes == SOCKET_ERROR)
+		{
+			if (IsSockErrorWouldBlock(GetSockError()))
+			{
+				Log(LogSock, LogVerbose, "Socket buffer full on port %d, %d buffers waiting\n", sock->receivePort, count);
+				ans = 0;
+			}
+			else
+			{
+				SockErrorAndClear("send");
+				Log(LogSock, LogDetail, "Socket write failure due to unexpected closure of socket %s\n", sock->eventName);
+				QueueImmediate(sock, (void (*)(void *))CompleteSocketDisconnection);
+			}
 		}
 		else
 		{
-    	    Log(LogSock, LogVerbose, "Wrote %d bytes on port %d\n", packet->rawLen, sock->receivePort);
-		    LogBytes(LogSock, LogVerbose, packet->rawData, packet->rawLen);
-			ans = 1;
-			retry = 0;
+			Log(LogSock, LogVerbose, "Wrote %d bytes from %d buffers on port %d\n", sentBytes, count, sock->receivePort);
+			ans = sentBytes;
+		}
+	}
+
+	return ans;
+}
+
+/* Turns the Nagle algorithm off (noDelay true) or on for a TCP socket */
+int SetTcpNoDelay(socket_t *sock, int noDelay)
+{
+	int ans = 0;
+#if defined(TCP_NODELAY)
+	int value = noDelay ? 1 : 0;
+	if (setsockopt(sock->socket, IPPROTO_TCP, TCP_NODELAY, (char *)&value, sizeof(value)) == SOCKET_ERROR)
+	{
+		SockErrorAndClear("setsockopt TCP_NODELAY");
+	}
+	else
+	{
+		ans = 1;
+	}
+#endif
+
+	return ans;
+}
+
+/* Corks a TCP socket so that only full segments are sent, uncorking sends whatever is held back.
+   Returns false where TCP_CORK is not available. */
+int SetTcpCork(socket_t *sock, int cork)
+{
+	int ans = 0;
+#if defined(TCP_CORK)
+	int value = cork ? 1 : 0;
+	if (setsockopt(sock->socket, IPPROTO_TCP, TCP_CORK, (char *)&value, sizeof(value)) == SOCKET_ERROR)
+	{
+		SockErrorAndClear("setsockopt TCP_CORK");
+	}
+	else
+	{
+		ans = 1;
+	}
+#endif
+
+	return ans;
+}
+
+int SendToSocket(socket_t *sock, sockaddr_t *destination, packet_t *packet)
+{
+	int ans = 0;
+	int retry = 0;
+
+#if defined(USE_IO_URING)
+	if (UringIsActive() && UringSendTo((int)sock->socket, packet->rawData, packet->rawLen, destination, sizeof(*destination)))
+	{
+		/* sent with the next submission to the ring, a failure is logged when it completes */
+		Log(LogSock, LogVerbose, "Queued %d bytes on port %d\n", packet->rawLen, sock->receivePort);
+		LogBytes(LogSock, LogVerbose, packet->rawData, packet->rawLen);
+		ans = 1;
+	}
+	else
+#endif
+	{
+		do
+		{
+			if (sendto(sock->socket, (char *)packet->rawData, packet->rawLen, 0, destination, sizeof(*destination)) == -1)
+			{
+#if defined(WIN32)
+				if (IsSockErrorWouldBlock(GetSockError()))
+				{
+					retry = 1;
+					Sleep(1);
+				}
+				else
+				{
+					retry = 0;
+					SockError("sendto");
+				}
+#else
+				SockError("sendto");
+#endif
+			}
+			else
+			{
+	    	    Log(LogSock, LogVerbose, "Wrote %d bytes on port %d\n", packet->rawLen, sock->receivePort);
+			    LogBytes(LogSock, LogVerbose, packet->rawData, packet->rawLen);
+				ans = 1;
+				retry = 0;
+			}
 		}
+		while (retry);
 	}
-	while (retry);
 
 	SockErrorClear();
 
 	return ans;
 }
 
+/* Sends all the datagrams in the batch to the same destination and empties the batch, returns true if all were sent */
+int SendBatchToSocket(socket_t *sock, sockaddr_t *destination, datagram_batch_t *batch)
+{
+	int ans = 1;
+#if defined(USE_MMSG)
+	int i;
+	struct mmsghdr msgs[DATAGRAM_BATCH_SIZE];
+	struct iovec iovecs[DATAGRAM_BATCH_SIZE];
+	int sent = 0;
+
+#if defined(USE_IO_URING)
+	if (UringIsActive())
+	{
+		/* the ring already takes all of them to the kernel in one submission */
+		for (i = 0; i < batch->count; i++)
+		{
+			packet_t packet;
+			packet.rawData = batch->buffer[i];
+			packet.rawLen = batch->length[i];
+			if (!SendToSocket(sock, destination, &packet))
+			{
+				ans = 0;
+			}
+		}
+	}
+	else
+#endif
+	{
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < batch->count; i++)
+		{
+			iovecs[i].iov_base = batch->buffer[i];
+			iovecs[i].iov_len = batch->length[i];
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = destination;
+			msgs[i].msg_hdr.msg_namelen = sizeof(*destination);
+		}
+
+		/* sendmmsg stops at the first datagram that fails, so carry on after it rather than drop the rest */
+		while (sent < batch->count)
+		{
+			int n = sendmmsg(sock->socket, &msgs[sent], batch->count - sent, 0);
+			if (n <= 0)
+			{
+				SockError("sendmmsg");
+				ans = 0;
+				n = 1;
+			}
+
+			sent += n;
+		}
+
+		if (IsLoggable(LogSock, LogVerbose))
+		{
+			for (i = 0; i < batch->count; i++)
+			{
+				Log(LogSock, LogVerbose, "Wrote %d bytes on port %d\n", batch->length[i], sock->receivePort);
+				LogBytes(LogSock, LogVerbose, batch->buffer[i], batch->length[i]);
+			}
+		}
+
+		SockErrorClear();
+	}
+#else
+	int i;
+
+	for (i = 0; i < batch->count; i++)
+	{
+		packet_t packet;
+		packet.rawData = batch->buffer[i];
+		packet.rawLen = batch->length[i];
+		if (!SendToSocket(sock, destination, &packet))
+		{
+			ans = 0;
+		}
+	}
+#endif
+
+	batch->count = 0;
+
+	return ans;
+}
+
 static void ClosePrimitiveSocket(uint_ptr sock)
 {
 #if defined(WIN32)
@@ -325,6 +696,7 @@ static void ClosePrimitiveSocket(uint_ptr sock)
 
 void CloseSocket(socket_t *sock)
 {
+	StopRingReceive(sock);
 #if defined(WIN32)
     if (sock->waitHandle != (unsigned int)-1)
     {
@@ -732,6 +1104,7 @@ static void ProcessListenSocketEvent(void *context)
                     {
                         /* reject outbound connection */
     	                Log(LogSock, LogDetail, "Successful inbound and outbound connection, randomly rejecting outbound request from %s\n", FormatAddr(&receivedFrom));
+                        StopRingReceive(sock);
                         ClosePrimitiveSocket(sock->socket);
                     }
                 }
@@ -744,10 +1117,11 @@ static void ProcessListenSocketEvent(void *context)
                 sock->receivePort = inaddr->sin_port;
                 SetNonBlocking(sock);
 #if defined(WIN32)
-                SetupSocketEvents(sock, sock->eventName, FD_READ | FD_CLOSE);
+                SetupSocketEvents(sock, sock->eventName, FD_READ | FD_WRITE | FD_CLOSE);
 #else
                 SetupSocketEvents(sock, sock->eventName, 0);
 #endif
+                StartRingReceive(sock, 1);
                 if (tcpConnectCallback != NULL)
                 {
                     tcpConnectCallback(sock);
@@ -776,10 +1150,11 @@ static void ProcessConnectSocketEvent(void *context)
 
         SetNonBlocking(sock);
 #if defined(WIN32)
-        SetupSocketEvents(sock, sock->eventName, FD_READ | FD_CLOSE);
+        SetupSocketEvents(sock, sock->eventName, FD_READ | FD_WRITE | FD_CLOSE);
 #else
         SetupSocketEvents(sock, sock->eventName, 0);
 #endif
+        StartRingReceive(sock, 1);
         if (tcpConnectCallback != NULL)
         {
             tcpConnectCallback(sock);
@@ -793,6 +1168,28 @@ static void ProcessConnectSocketEvent(void *context)
     }
 }
 
+static void StartRingReceive(socket_t *sock, int stream)
+{
+#if defined(USE_IO_URING)
+	/* from now on the socket is read from the completions of a multishot receive on the event loop's ring */
+	if (UringIsActive())
+	{
+		sock->receiver = UringStartReceive((int)sock->socket, stream, MAX_BUF_LEN, stream ? RING_STREAM_BUFFERS : RING_DATAGRAM_BUFFERS);
+	}
+#endif
+}
+
+static void StopRingReceive(socket_t *sock)
+{
+#if defined(USE_IO_URING)
+	if (sock->receiver != NULL)
+	{
+		UringStopReceive(sock->receiver);
+		sock->receiver = NULL;
+	}
+#endif
+}
+
 #if defined(WIN32)
 static void LogNetworkEvent(WSANETWORKEVENTS *networkEvents, char *name, int mask, int bitNo)
 {
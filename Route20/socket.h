@@ -56,6 +56,26 @@ typedef struct sockaddr_in sockaddr_in_t;
 typedef struct in_addr rinaddr_t;
 typedef struct hostent hostent_t;
 
+#define DATAGRAM_BATCH_SIZE 16 /* maximum datagrams moved by one batch read or send */
+#define MAX_DATAGRAM_LEN 1518
+
+typedef struct
+{
+	byte       buffer[DATAGRAM_BATCH_SIZE][MAX_DATAGRAM_LEN];
+	int        length[DATAGRAM_BATCH_SIZE];
+	sockaddr_t address[DATAGRAM_BATCH_SIZE]; /* source when receiving, unused when sending */
+	int        count;
+	int        next; /* next datagram to hand out when receiving */
+} datagram_batch_t;
+
+#define STREAM_WRITE_MAX_BUFFERS 64 /* maximum buffers gathered into one stream write */
+
+typedef struct
+{
+	byte *data;
+	int   length;
+} stream_buffer_t;
+
 typedef struct
 {
 	int socketConfigured;
@@ -69,6 +89,9 @@ typedef struct
 	unsigned int receivePort;
     sockaddr_t   remoteAddress;
     char        *eventName;
+#if defined(USE_IO_URING)
+	struct uring_receiver *receiver; /* multishot receive on the event loop's ring, NULL if the socket is read directly */
+#endif
 } socket_t;
 
 extern socket_config_t SocketConfig;
@@ -83,9 +106,15 @@ void SetTcpAcceptCallback(socket_t *(*callback)(sockaddr_t *receivedFrom));
 void SetTcpConnectCallback(void (*callback)(socket_t *sock));
 void SetTcpDisconnectCallback(void (*callback)(socket_t *sock));
 int ReadFromDatagramSocket(socket_t *sock, packet_t *packet, sockaddr_t *receivedFrom);
+int ReadBatchFromDatagramSocket(socket_t *sock, datagram_batch_t *batch);
+int AppendToDatagramBatch(datagram_batch_t *batch, byte *data, int length, sockaddr_t *from);
 int ReadFromStreamSocket(socket_t *sock, byte *buffer, int bufferLength);
 int WriteToStreamSocket(socket_t *sock, byte *buffer, int bufferLength);
+int WriteBuffersToStreamSocketNonBlocking(socket_t *sock, stream_buffer_t *buffers, int count);
+int SetTcpNoDelay(socket_t *sock, int noDelay);
+int SetTcpCork(socket_t *sock, int cork);
 int SendToSocket(socket_t *sock, sockaddr_t *destination, packet_t *packet);
+int SendBatchToSocket(socket_t *sock, sockaddr_t *destination, datagram_batch_t *batch);
 static void ClosePrimitiveSocket(uint_ptr sock);
 void CloseSocket(socket_t *sock);
 sockaddr_t *GetSocketAddressFromName(char *hostName, uint16 port);
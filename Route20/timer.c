@@ -32,166 +32,223 @@
 #include "timer.h"
 #include "platform.h"
 
-// TODO: change implementation so that changes in the system clock do not affect operation.
+#define TIMER_POOL_CHUNK 32 /* number of timer or immediate nodes allocated at once when the pool is empty */
 
-static rtimer_t *timerList = NULL;
+/* Scheduled timers are kept in a binary min-heap ordered by due time, so finding the next timer due is O(1) and
+   adding, stopping or rescheduling a timer is O(log n). Timer nodes are recycled through a free list rather than
+   returned to the heap allocator. Stopped timers are only recycled at the end of ProcessTimers so that a caller can
+   safely stop a timer and still refer to it in the same pass, as it could when timers were freed lazily.
 
-rtimer_t *CreateTimer(char *name, time_t due, int interval, void *context, void (*callback)(rtimer_t *, char *,void *))
+   Immediate callbacks do not need a due time so they go on a separate FIFO, also with pooled nodes. */
+
+typedef struct immediate *immediate_ptr;
+
+typedef struct immediate
 {
-	rtimer_t *newTimer = (rtimer_t *)malloc(sizeof(rtimer_t));
+	void *context;
+	void (*callback)(void *);
+	immediate_ptr next;
+} immediate_t;
+
+static rtimer_t **timerHeap = NULL;
+static int timerHeapCount = 0;
+static int timerHeapSize = 0;
+static rtimer_t *freeTimers = NULL;
+static rtimer_t *stoppedTimers = NULL;
+
+static immediate_t *immediateHead = NULL;
+static immediate_t *immediateTail = NULL;
+static int immediateCount = 0;
+static immediate_t *freeImmediates = NULL;
+
+static rtimer_t *AllocateTimer(void);
+static void RecycleStoppedTimers(void);
+static immediate_t *AllocateImmediate(void);
+static void HeapInsert(rtimer_t *timer);
+static void HeapRemove(rtimer_t *timer);
+static void HeapSiftUp(int index);
+static void HeapSiftDown(int index);
+static void HeapSwap(int i, int j);
+
+rtimer_t *CreateTimer(char *name, clock_ms_t due, clock_ms_t interval, void *context, void (*callback)(rtimer_t *, char *,void *))
+{
+	rtimer_t *newTimer = AllocateTimer();
 
-    newTimer->isFullTimer = 1;
 	newTimer->name = name;
 	newTimer->due = due;
 	newTimer->interval = (interval <= 0) ? 0 : interval;
 	newTimer->context = context;
 	newTimer->callback = callback;
-	newTimer->next = timerList;
-	timerList = newTimer;
+	HeapInsert(newTimer);
 
 	return newTimer;
 }
 
 void ResetTimer(rtimer_t *timer)
 {
-	time_t now;
 	if (timer->interval > 0)
 	{
-		time(&now);
-		timer->due = now + timer->interval;
+		timer->due = ClockNow() + timer->interval;
+		if (timer->state == TimerScheduled)
+		{
+			HeapSiftUp(timer->heapIndex);
+			HeapSiftDown(timer->heapIndex);
+		}
 	}
 }
 
 void QueueImmediate(void *context, void (*callback)(void *))
 {
-    time_t now;
+	immediate_t *entry = AllocateImmediate();
 
-	rtimer_t *newTimer = (rtimer_t *)malloc(sizeof(rtimer_t));
+	entry->context = context;
+	entry->callback = callback;
+	entry->next = NULL;
 
-	time(&now);
-    newTimer->isFullTimer = 0;
-	newTimer->name = "Immediate";
-	newTimer->due = now;
-	newTimer->interval = 0;
-	newTimer->context = context;
-	newTimer->immediateCallback = callback;
-	newTimer->next = timerList;
-	timerList = newTimer;
+	if (immediateTail != NULL)
+	{
+		immediateTail->next = entry;
+	}
+	else
+	{
+		immediateHead = entry;
+	}
+
+	immediateTail = entry;
+	immediateCount++;
 }
 
 void StopTimer(rtimer_t *timer)
 {
-	timer->interval = -1;
-	timer->due = 0;
+	if (timer->state == TimerScheduled)
+	{
+		HeapRemove(timer);
+	}
+
+	if (timer->state == TimerScheduled || timer->state == TimerRunning)
+	{
+		timer->state = TimerStopped;
+		timer->next = stoppedTimers;
+		stoppedTimers = timer;
+	}
 }
 
 void StopAllTimers(void)
 {
-	rtimer_t *timer = timerList;
-	while (timer != NULL)
+	immediate_t *entry;
+
+	while (timerHeapCount > 0)
+	{
+		StopTimer(timerHeap[0]);
+	}
+
+	while (immediateHead != NULL)
 	{
-		StopTimer(timer);
-		timer = timer->next;
+		entry = immediateHead;
+		immediateHead = entry->next;
+		entry->next = freeImmediates;
+		freeImmediates = entry;
 	}
 
-	ProcessTimers();
+	immediateTail = NULL;
+	immediateCount = 0;
+
+	RecycleStoppedTimers();
 }
 
 void ProcessTimers(void)
 {
-	rtimer_t *timer = timerList;
-	rtimer_t *prevTimer;
-	rtimer_t *nextTimer;
-	time_t now;
-	int deleted;
-
-	prevTimer = NULL;
-	time(&now);
-	while (timer != NULL)
+	int n;
+	rtimer_t *timer;
+	clock_ms_t now;
+	clock_ms_t scheduledDue;
+
+	/* only run the immediate callbacks that were queued before this pass, any they queue run on the next pass */
+	n = immediateCount;
+	while (n-- > 0)
 	{
-		deleted = 0;
-		nextTimer = timer->next;
-		if (timer->due <= now)
+		immediate_t *entry = immediateHead;
+		void *context = entry->context;
+		void (*callback)(void *) = entry->callback;
+
+		immediateHead = entry->next;
+		if (immediateHead == NULL)
 		{
-			if (timer->interval >= 0)
-			{
-                Log(LogGeneral, LogVerbose, "Calling timer %s\n", timer->name);
-                if (timer->isFullTimer)
-                {
-				    timer->callback(timer, timer->name, timer->context);
-                }
-                else
-                {
-				    timer->immediateCallback(timer->context);
-                }
-                Log(LogGeneral, LogVerbose, "Finished calling timer %s\n", timer->name);
-
-                time(&now); /* update current time in case other timers fall due */
-			}
+			immediateTail = NULL;
+		}
+		immediateCount--;
 
-			/* the callback may have added more timers to the head of the list, if so, adjust prevTimer if we were at the head list before the callback */
-			if (prevTimer == NULL && timerList != timer)
-			{
-				prevTimer = timerList;
-				while(prevTimer->next != timer)
-				{
-					prevTimer = prevTimer->next;
-				}
-			}
+		entry->next = freeImmediates;
+		freeImmediates = entry;
 
+        Log(LogGeneral, LogVerbose, "Calling immediate\n");
+		callback(context);
+	}
+
+	/* bound the number of timers run in one pass so that a periodic timer which has fallen behind cannot hold up the event loop */
+	ClockUpdate(); /* update current time in case timers fell due while running the immediate callbacks */
+	now = ClockNow();
+	n = timerHeapCount;
+	while (n-- > 0 && timerHeapCount > 0 && timerHeap[0]->due <= now)
+	{
+		timer = timerHeap[0];
+		HeapRemove(timer);
+		timer->state = TimerRunning;
+		scheduledDue = timer->due;
+
+        Log(LogGeneral, LogVerbose, "Calling timer %s\n", timer->name);
+		timer->callback(timer, timer->name, timer->context);
+        Log(LogGeneral, LogVerbose, "Finished calling timer %s\n", timer->name);
+
+		if (timer->state == TimerRunning)
+		{
 			if (timer->interval > 0)
 			{
-				timer->due += timer->interval;
+				/* keep the new due time if the timer was reset by its own callback */
+				if (timer->due == scheduledDue)
+				{
+				    timer->due += timer->interval;
+				}
+				HeapInsert(timer);
 			}
 			else
 			{
-				if (prevTimer == NULL)
-				{
-					timerList = nextTimer;
-				}
-				else
-				{
-					prevTimer->next = nextTimer;
-				}
-
-				free(timer);
-				deleted = 1;
+				timer->state = TimerStopped;
+				timer->next = stoppedTimers;
+				stoppedTimers = timer;
 			}
 		}
 
-		if (!deleted)
-		{
-			prevTimer = timer;
-		}
-
-		timer = nextTimer;
+		ClockUpdate(); /* update current time in case other timers fall due */
+		now = ClockNow();
 	}
+
+	RecycleStoppedTimers();
 }
 
-int  SecondsUntilNextDue(void)
+int  MillisecondsUntilNextDue(void)
 {
 	int ans = 0;
-	rtimer_t *timer = timerList;
-	time_t now;
-	time_t minDue = LONG_MAX;
+	clock_ms_t now;
+	clock_ms_t minDue;
 
-	if (timerList != NULL)
+	if (immediateCount > 0)
 	{
-		time(&now);
-		while (timer != NULL)
-		{
-			if (difftime(minDue, timer->due) > 0)
-			{
-				minDue = timer->due;
-			}
-
-			timer = timer->next;
-		}
+		ans = 0;
+	}
+	else if (timerHeapCount > 0)
+	{
+		now = ClockNow();
+		minDue = timerHeap[0]->due;
 
 		if (minDue < now)
 		{
 			ans = 0;
 		}
+		else if (minDue - now > INT_MAX)
+		{
+			ans = INT_MAX;
+		}
 		else
 		{
 			ans = (int)(minDue - now);
@@ -207,18 +264,156 @@ int  SecondsUntilNextDue(void)
 
 void DumpTimers(LogLevel level)
 {
-	rtimer_t *timer = timerList;
-	time_t now;
-    time(&now);
+	int i;
+	clock_ms_t now = ClockNow();
 
-    Log(LogGeneral, level, "Start of timer dump\n");
+    Log(LogGeneral, level, "Start of timer dump, %d immediate callbacks queued\n", immediateCount);
 
-	while (timer != NULL)
+	for (i = 0; i < timerHeapCount; i++)
 	{
-        double dueIn = difftime(timer->due, now);
-        Log(LogGeneral, level, "  %s, due at %lld in %f (secs)\n", timer->name, timer->due, dueIn);
-        timer = timer->next;
+		rtimer_t *timer = timerHeap[i];
+        double dueIn = (double)(timer->due - now) / 1000;
+        Log(LogGeneral, level, "  %s, due in %.3f (secs)\n", timer->name, dueIn);
     }
 
     Log(LogGeneral, level, "End of timer dump\n");
-}
\ No newline at end of file
+}
+
+static rtimer_t *AllocateTimer(void)
+{
+	rtimer_t *ans;
+	int i;
+
+	if (freeTimers == NULL)
+	{
+		rtimer_t *chunk = (rtimer_t *)malloc(TIMER_POOL_CHUNK * sizeof(rtimer_t));
+		for (i = 0; i < TIMER_POOL_CHUNK; i++)
+		{
+			chunk[i].state = TimerFree;
+			chunk[i].next = freeTimers;
+			freeTimers = &chunk[i];
+		}
+	}
+
+	ans = freeTimers;
+	freeTimers = ans->next;
+	ans->next = NULL;
+	ans->heapIndex = -1;
+	ans->state = TimerFree;
+
+	return ans;
+}
+
+static void RecycleStoppedTimers(void)
+{
+	while (stoppedTimers != NULL)
+	{
+		rtimer_t *timer = stoppedTimers;
+		stoppedTimers = timer->next;
+		timer->state = TimerFree;
+		timer->next = freeTimers;
+		freeTimers = timer;
+	}
+}
+
+static immediate_t *AllocateImmediate(void)
+{
+	immediate_t *ans;
+	int i;
+
+	if (freeImmediates == NULL)
+	{
+		immediate_t *chunk = (immediate_t *)malloc(TIMER_POOL_CHUNK * sizeof(immediate_t));
+		for (i = 0; i < TIMER_POOL_CHUNK; i++)
+		{
+			chunk[i].next = freeImmediates;
+			freeImmediates = &chunk[i];
+		}
+	}
+
+	ans = freeImmediates;
+	freeImmediates = ans->next;
+
+	return ans;
+}
+
+static void HeapInsert(rtimer_t *timer)
+{
+	if (timerHeapCount >= timerHeapSize)
+	{
+		timerHeapSize = (timerHeapSize == 0) ? TIMER_POOL_CHUNK : timerHeapSize * 2;
+		timerHeap = (rtimer_t **)realloc(timerHeap, timerHeapSize * sizeof(rtimer_t *));
+	}
+
+	timer->state = TimerScheduled;
+	timer->heapIndex = timerHeapCount;
+	timerHeap[timerHeapCount++] = timer;
+	HeapSiftUp(timer->heapIndex);
+}
+
+static void HeapRemove(rtimer_t *timer)
+{
+	int index = timer->heapIndex;
+
+	timerHeapCount--;
+	if (index != timerHeapCount)
+	{
+		HeapSwap(index, timerHeapCount);
+		HeapSiftUp(index);
+		HeapSiftDown(index);
+	}
+
+	timer->heapIndex = -1;
+}
+
+static void HeapSiftUp(int index)
+{
+	while (index > 0)
+	{
+		int parent = (index - 1) / 2;
+		if (timerHeap[parent]->due <= timerHeap[index]->due)
+		{
+			break;
+		}
+
+		HeapSwap(parent, index);
+		index = parent;
+	}
+}
+
+static void HeapSiftDown(int index)
+{
+	for (;;)
+	{
+		int smallest = index;
+		int left = 2 * index + 1;
+		int right = left + 1;
+
+		if (left < timerHeapCount && timerHeap[left]->due < timerHeap[smallest]->due)
+		{
+			smallest = left;
+		}
+
+		if (right < timerHeapCount && timerHeap[right]->due < timerHeap[smallest]->due)
+		{
+			smallest = right;
+		}
+
+		if (smallest == index)
+		{
+			break;
+		}
+
+		HeapSwap(index, smallest);
+		index = smallest;
+	}
+}
+
+static void HeapSwap(int i, int j)
+{
+	rtimer_t *temp = timerHeap[i];
+	timerHeap[i] = timerHeap[j];
+	timerHeap[j] = temp;
+	timerHeap[i]->heapIndex = i;
+	timerHeap[j]->heapIndex = j;
+}
@@ -27,34 +27,42 @@
 
   ------------------------------------------------------------------------------*/
 
-#include <time.h>
 #include "basictypes.h"
+#include "clock.h"
 #include "logging.h"
 
 #if !defined(TIMER_H)
 
 typedef struct rtimer *timer_ptr;
 
+typedef enum
+{
+	TimerFree,
+	TimerScheduled,
+	TimerRunning,
+	TimerStopped
+} TimerState;
+
 #pragma warning(disable : 4820)
 typedef struct rtimer
 {
-    int isFullTimer;
 	char *name;
-	time_t due;
-	int interval; /* seconds, =0 if one-shot, =-1 if stopped */
+	clock_ms_t due;
+	clock_ms_t interval; /* milliseconds, =0 if one-shot */
 	void *context;
 	void (*callback)(struct rtimer *, char *, void *);
-	void (*immediateCallback)(void *);
-	timer_ptr next;
+	TimerState state;
+	int heapIndex; /* position in the due time heap while scheduled */
+	timer_ptr next; /* free or stopped list link */
 } rtimer_t;
 
-rtimer_t *CreateTimer(char *name, time_t due, int interval, void *context, void (*callback)(rtimer_t *, char *,void *));
+rtimer_t *CreateTimer(char *name, clock_ms_t due, clock_ms_t interval, void *context, void (*callback)(rtimer_t *, char *,void *));
 void ResetTimer(rtimer_t *timer);
 void QueueImmediate(void *context, void (*callback)(void *));
 void StopTimer(rtimer_t *);
 void StopAllTimers(void);
 void ProcessTimers(void);
-int  SecondsUntilNextDue(void);
+int  MillisecondsUntilNextDue(void);
 void DumpTimers(LogLevel level);
 
 #define TIMER_H
@@ -46,15 +46,15 @@ static int Level2UpdateRequired(int slot);
 
 void InitialiseUpdateProcess(void)
 {
-    time_t now;
+    clock_ms_t now;
 
-    time(&now);
+    now = ClockNow();
 
     if (nodeInfo.level == 1 || nodeInfo.level == 2)
     {
         /* add T3 + 5 seconds to first delay to allow ethernet adjacencies to come up first so that any other nodes on the
            ethernet see the adjacency before receiving any routing messages */
-        CreateTimer("Update", now + T2 + T3 + 5, T2, NULL, ProcessUpdateTimer);
+        CreateTimer("Update", now + SECS_TO_MS(T2 + T3 + 5), SECS_TO_MS(T2), NULL, ProcessUpdateTimer);
     }
 }
 
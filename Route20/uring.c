@@ -0,0 +1,775 @@
+/* uring.c: io_uring event notification for Linux
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+#if defined(USE_IO_URING)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "basictypes.h"
+#include "logging.h"
+#include "uring.h"
+
+/* Talks to the kernel directly rather than through liburing so there is no extra build dependency.
+
+   Sockets are read with multishot receives. Each socket has a ring of buffers registered with the kernel, which fills
+   them as data arrives and posts a completion for each one, without any further system call. The reads in socket.c take
+   the data from those completions and hand each buffer back to the kernel once it has been read. Datagram sends are
+   copied and queued on the ring rather than made one system call at a time.
+
+   Handles that are not read through a ring receiver, such as pcap and listening sockets, have a one-shot poll
+   outstanding instead, re-armed by the event loop after the handler has been called. A one-shot poll completes
+   immediately if the handle is still readable, which keeps the level triggered behaviour the handlers expect from
+   select and epoll. A ring receiver is reported as ready for as long as it holds data that has not been read, for the
+   same reason.
+
+   Everything queued during a pass round the event loop, including the timeout for the next timer, is submitted
+   together with the wait, so a pass normally costs a single system call however many packets it moves. */
+
+#define URING_ENTRIES 256
+#define URING_MAX_SENDS 512       /* datagram sends in flight at once, beyond this they are sent directly */
+#define URING_SEND_BUFFER_LEN 2048 /* initial size of a send buffer, grown for larger datagrams */
+
+/* the low bits of the user data of a request say what kind of request it is, the rest is a pointer, which malloc aligns to at least 8 bytes */
+#define TAG_MASK       7
+#define TAG_POLL       0
+#define TAG_RECEIVE    1
+#define TAG_SEND       2
+#define TAG_TIMEOUT    3
+#define TAG_WRITE_POLL 4
+
+typedef struct uring_receiver
+{
+	int                       fd;
+	int                       stream;
+	int                       bufferGroup;
+	int                       armed;          /* a multishot receive is outstanding */
+	int                       closing;        /* the socket has been closed, freed once the outstanding receive completes */
+	int                       finished;       /* no more data will arrive, the stream was closed or the receive failed */
+	int                       finishError;    /* errno the receive failed with, 0 if the stream was closed by the peer */
+	int                       finishReported;
+	void                     *userData;
+	struct io_uring_buf_ring *bufferRing;
+	size_t                    bufferRingSize;
+	unsigned char            *buffers;
+	int                       bufferSize;
+	int                       bufferCount;    /* a power of 2 */
+	unsigned short            ringTail;
+	struct msghdr             msg;            /* tells a multishot recvmsg how much room to leave for the source address */
+	int                      *pendingId;      /* buffers holding received data not yet read, oldest first */
+	int                      *pendingLength;
+	int                       pendingHead;
+	int                       pendingCount;
+	int                       consumed;       /* stream only, bytes already read from the oldest pending buffer */
+	int                       held;           /* datagram only, buffer handed out by the last read, -1 if none */
+	uring_receiver_ptr        next;
+} uring_receiver_t;
+
+typedef struct uring_send *uring_send_ptr;
+
+typedef struct uring_send
+{
+	struct msghdr           msg;
+	struct iovec            iov;
+	struct sockaddr_storage destination;
+	unsigned char          *data;
+	int                     dataSize;
+	uring_send_ptr          next; /* next free send */
+} uring_send_t;
+
+static int tried = 0;
+static int ringFd = -1;
+static unsigned *sqHead;
+static unsigned *sqTail;
+static unsigned *sqRingMask;
+static unsigned *sqArray;
+static unsigned sqEntries;
+static struct io_uring_sqe *sqes;
+static unsigned *cqHead;
+static unsigned *cqTail;
+static unsigned *cqRingMask;
+static struct io_uring_cqe *cqes;
+static unsigned sqLocalTail;
+static unsigned toSubmit;
+static struct __kernel_timespec timeoutSpec;
+static uring_receiver_ptr receivers = NULL;
+static uring_send_ptr freeSends = NULL;
+static int numSends = 0;
+
+static int Initialise(void);
+static struct io_uring_sqe *GetSqe(void);
+static int Enter(unsigned minComplete);
+static int AllocateBufferGroup(void);
+static void ProvideBuffer(uring_receiver_ptr receiver, int id);
+static void ArmReceive(uring_receiver_ptr receiver);
+static int HasDataWaiting(uring_receiver_ptr receiver);
+static void TakePending(uring_receiver_ptr receiver);
+static void ReleaseHeldBuffer(uring_receiver_ptr receiver);
+static void CompleteReceive(uring_receiver_ptr receiver, struct io_uring_cqe *cqe);
+static void FreeReceiver(uring_receiver_ptr receiver);
+static void CompleteSend(uring_send_ptr send, struct io_uring_cqe *cqe);
+
+/* Sets up the ring the first time it is called, returns true if io_uring can be used */
+int UringIsActive(void)
+{
+	if (!tried)
+	{
+		tried = 1;
+		if (!Initialise())
+		{
+			Log(LogGeneral, LogWarning, "io_uring is not available (%d), using epoll for event handling\n", errno);
+		}
+	}
+
+	return ringFd != -1;
+}
+
+void UringAddPoll(int fd, void *userData, int write)
+{
+	struct io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = write ? POLLOUT : POLLIN;
+	sqe->user_data = (__u64)(unsigned long)userData | (write ? TAG_WRITE_POLL : TAG_POLL);
+}
+
+void UringRemovePoll(void *userData, int write)
+{
+	/* the cancelled poll completes with -ECANCELED and the same user data, the removal itself completes with no user data */
+	struct io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (__u64)(unsigned long)userData | (write ? TAG_WRITE_POLL : TAG_POLL);
+	sqe->user_data = 0;
+}
+
+int UringWait(int timeoutMs, uring_event_t *events, int maxEvents)
+{
+	int ans = 0;
+	unsigned head;
+	unsigned tail;
+	unsigned minComplete = 1;
+	uring_receiver_ptr receiver;
+
+	for (receiver = receivers; receiver != NULL; receiver = receiver->next)
+	{
+		/* a multishot receive stops when it runs out of buffers, start it again once everything it received has been read */
+		if (!receiver->armed && !receiver->closing && !receiver->finished && receiver->pendingCount == 0)
+		{
+			ArmReceive(receiver);
+		}
+
+		if (receiver->userData != NULL && HasDataWaiting(receiver))
+		{
+			minComplete = 0;
+		}
+	}
+
+	head = *cqHead;
+	tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+	if (head != tail || timeoutMs == 0)
+	{
+		/* completions are already waiting, so just submit anything queued */
+		minComplete = 0;
+	}
+	else if (minComplete > 0 && timeoutMs > 0)
+	{
+		/* completes after the time or as soon as any other request completes, whichever is first */
+		struct io_uring_sqe *sqe = GetSqe();
+		timeoutSpec.tv_sec = timeoutMs / 1000;
+		timeoutSpec.tv_nsec = (timeoutMs % 1000) * 1000000L;
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = (__u64)(unsigned long)&timeoutSpec;
+		sqe->len = 1;
+		sqe->off = 1;
+		sqe->user_data = TAG_TIMEOUT;
+	}
+
+	if ((minComplete > 0 || toSubmit > 0) && Enter(minComplete) == -1 && errno != ETIME)
+	{
+		ans = -1;
+	}
+	else
+	{
+		head = *cqHead;
+		tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+		while (head != tail && ans < maxEvents)
+		{
+			struct io_uring_cqe *cqe = &cqes[head & *cqRingMask];
+			void *pointer = (void *)(unsigned long)(cqe->user_data & ~(__u64)TAG_MASK);
+			switch (cqe->user_data & TAG_MASK)
+			{
+			case TAG_POLL:
+			case TAG_WRITE_POLL:
+				{
+					if (pointer != NULL)
+					{
+						events[ans].userData = pointer;
+						events[ans].result = cqe->res;
+						events[ans].received = 0;
+						events[ans].writable = (cqe->user_data & TAG_MASK) == TAG_WRITE_POLL;
+						ans++;
+					}
+					break;
+				}
+			case TAG_RECEIVE:
+				{
+					CompleteReceive((uring_receiver_ptr)pointer, cqe);
+					break;
+				}
+			case TAG_SEND:
+				{
+					CompleteSend((uring_send_ptr)pointer, cqe);
+					break;
+				}
+			default:
+				{
+					break;
+				}
+			}
+
+			head++;
+		}
+
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+		for (receiver = receivers; receiver != NULL && ans < maxEvents; receiver = receiver->next)
+		{
+			if (receiver->userData != NULL && HasDataWaiting(receiver))
+			{
+				events[ans].userData = receiver->userData;
+				events[ans].result = POLLIN;
+				events[ans].received = 1;
+				events[ans].writable = 0;
+				ans++;
+			}
+		}
+	}
+
+	return ans;
+}
+
+/* Starts a multishot receive on a socket, bufferSize is the largest read or datagram to be received in one go.
+   Returns NULL if the receive could not be started, in which case the socket has to be read directly. */
+uring_receiver_ptr UringStartReceive(int fd, int stream, int bufferSize, int bufferCount)
+{
+	uring_receiver_ptr ans = NULL;
+	uring_receiver_ptr receiver = (uring_receiver_ptr)calloc(1, sizeof(uring_receiver_t));
+	struct io_uring_buf_reg reg;
+	int i;
+
+	receiver->fd = fd;
+	receiver->stream = stream;
+	receiver->held = -1;
+	receiver->bufferCount = bufferCount;
+	receiver->bufferSize = bufferSize;
+	if (!stream)
+	{
+		/* each datagram buffer starts with the recvmsg header and the source address */
+		receiver->msg.msg_namelen = sizeof(struct sockaddr);
+		receiver->bufferSize += sizeof(struct io_uring_recvmsg_out) + receiver->msg.msg_namelen;
+	}
+
+	receiver->bufferGroup = AllocateBufferGroup();
+	receiver->bufferRingSize = bufferCount * sizeof(struct io_uring_buf);
+	receiver->bufferRing = (struct io_uring_buf_ring *)mmap(NULL, receiver->bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	receiver->buffers = (unsigned char *)malloc(receiver->bufferSize * bufferCount);
+	receiver->pendingId = (int *)malloc(bufferCount * sizeof(int));
+	receiver->pendingLength = (int *)malloc(bufferCount * sizeof(int));
+
+	if (receiver->bufferRing != MAP_FAILED)
+	{
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (__u64)(unsigned long)receiver->bufferRing;
+		reg.ring_entries = bufferCount;
+		reg.bgid = (__u16)receiver->bufferGroup;
+		if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0)
+		{
+			for (i = 0; i < bufferCount; i++)
+			{
+				ProvideBuffer(receiver, i);
+			}
+
+			ArmReceive(receiver);
+			receiver->next = receivers;
+			receivers = receiver;
+			ans = receiver;
+		}
+	}
+
+	if (ans == NULL)
+	{
+		Log(LogSock, LogWarning, "Unable to start io_uring receive on handle %d (%d), it will be read directly\n", fd, errno);
+		if (receiver->bufferRing != MAP_FAILED)
+		{
+			munmap(receiver->bufferRing, receiver->bufferRingSize);
+		}
+
+		free(receiver->buffers);
+		free(receiver->pendingId);
+		free(receiver->pendingLength);
+		free(receiver);
+	}
+
+	return ans;
+}
+
+/* Called when the socket is closed, anything received but not read is discarded */
+void UringStopReceive(uring_receiver_ptr receiver)
+{
+	receiver->closing = 1;
+	receiver->userData = NULL;
+	if (receiver->armed)
+	{
+		/* the cancelled receive completes without IORING_CQE_F_MORE, the receiver is freed then */
+		struct io_uring_sqe *sqe = GetSqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (__u64)(unsigned long)receiver | TAG_RECEIVE;
+		sqe->user_data = 0;
+	}
+	else
+	{
+		FreeReceiver(receiver);
+	}
+}
+
+/* Has the event loop report the receiver for the handle under the given user data, returns false if the handle has no receiver */
+int UringAttachReceiver(int fd, void *userData)
+{
+	int ans = 0;
+	uring_receiver_ptr receiver;
+
+	for (receiver = receivers; receiver != NULL; receiver = receiver->next)
+	{
+		if (receiver->fd == fd && !receiver->closing)
+		{
+			receiver->userData = userData;
+			ans = 1;
+			break;
+		}
+	}
+
+	return ans;
+}
+
+void UringDetachReceiver(void *userData)
+{
+	uring_receiver_ptr receiver;
+
+	for (receiver = receivers; receiver != NULL; receiver = receiver->next)
+	{
+		if (receiver->userData == userData)
+		{
+			receiver->userData = NULL;
+		}
+	}
+}
+
+/* Returns the length of the next datagram, or 0 if there is none. The data is left in the receive buffer, which stays
+   valid until the next call. */
+int UringNextDatagram(uring_receiver_ptr receiver, unsigned char **data, struct sockaddr *from)
+{
+	int ans = 0;
+
+	ReleaseHeldBuffer(receiver);
+	if (receiver->pendingCount > 0)
+	{
+		int id = receiver->pendingId[receiver->pendingHead];
+		int length = receiver->pendingLength[receiver->pendingHead];
+		unsigned char *buffer = receiver->buffers + id * receiver->bufferSize;
+		struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+		int headerLength = sizeof(struct io_uring_recvmsg_out) + receiver->msg.msg_namelen;
+
+		TakePending(receiver);
+		receiver->held = id;
+
+		memset(from, 0, sizeof(struct sockaddr));
+		memcpy(from, buffer + sizeof(struct io_uring_recvmsg_out), (out->namelen < sizeof(struct sockaddr)) ? out->namelen : sizeof(struct sockaddr));
+		*data = buffer + headerLength;
+
+		/* a datagram too big for the buffer is truncated, as it would be by recvfrom */
+		ans = length - headerLength;
+		if (ans > (int)out->payloadlen)
+		{
+			ans = (int)out->payloadlen;
+		}
+	}
+
+	return ans;
+}
+
+/* Behaves like recv on a non-blocking socket, returns the number of bytes read, 0 if the stream has been closed by the
+   peer, or -1 with errno set to EAGAIN if nothing is waiting or to the error the stream failed with. */
+int UringReadStream(uring_receiver_ptr receiver, unsigned char *buffer, int bufferLength)
+{
+	int ans = 0;
+
+	while (receiver->pendingCount > 0 && ans < bufferLength)
+	{
+		int id = receiver->pendingId[receiver->pendingHead];
+		int available = receiver->pendingLength[receiver->pendingHead] - receiver->consumed;
+		int n = (available < bufferLength - ans) ? available : bufferLength - ans;
+
+		memcpy(buffer + ans, receiver->buffers + id * receiver->bufferSize + receiver->consumed, n);
+		ans += n;
+		receiver->consumed += n;
+		if (n == available)
+		{
+			receiver->consumed = 0;
+			TakePending(receiver);
+			ProvideBuffer(receiver, id);
+		}
+	}
+
+	if (ans == 0)
+	{
+		if (receiver->finished)
+		{
+			receiver->finishReported = 1;
+			errno = receiver->finishError;
+			ans = (receiver->finishError == 0) ? 0 : -1;
+		}
+		else
+		{
+			errno = EAGAIN;
+			ans = -1;
+		}
+	}
+
+	return ans;
+}
+
+/* Copies the datagram and queues it to be sent with the next submission. Returns false if too many sends are already
+   in flight, in which case the caller should send it directly. */
+int UringSendTo(int fd, unsigned char *data, int length, struct sockaddr *destination, int destinationLength)
+{
+	int ans = 0;
+	uring_send_ptr send = freeSends;
+
+	if (send != NULL)
+	{
+		freeSends = send->next;
+	}
+	else if (numSends < URING_MAX_SENDS)
+	{
+		send = (uring_send_ptr)calloc(1, sizeof(uring_send_t));
+		numSends++;
+	}
+
+	if (send != NULL)
+	{
+		struct io_uring_sqe *sqe;
+
+		if (send->dataSize < length)
+		{
+			free(send->data);
+			send->dataSize = (length > URING_SEND_BUFFER_LEN) ? length : URING_SEND_BUFFER_LEN;
+			send->data = (unsigned char *)malloc(send->dataSize);
+		}
+
+		memcpy(send->data, data, length);
+		memcpy(&send->destination, destination, destinationLength);
+		send->iov.iov_base = send->data;
+		send->iov.iov_len = length;
+		memset(&send->msg, 0, sizeof(send->msg));
+		send->msg.msg_name = &send->destination;
+		send->msg.msg_namelen = destinationLength;
+		send->msg.msg_iov = &send->iov;
+		send->msg.msg_iovlen = 1;
+
+		sqe = GetSqe();
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = fd;
+		sqe->addr = (__u64)(unsigned long)&send->msg;
+		sqe->len = 1;
+		sqe->user_data = (__u64)(unsigned long)send | TAG_SEND;
+		ans = 1;
+	}
+	else if (toSubmit > 0)
+	{
+		/* the caller falls back to a direct send, so push out what is already queued to keep the datagrams in order */
+		Enter(0);
+	}
+
+	return ans;
+}
+
+static int Initialise(void)
+{
+	int ans = 0;
+	struct io_uring_params params;
+	size_t sqRingSize;
+	size_t cqRingSize;
+	void *sqPtr;
+	void *cqPtr;
+
+	memset(&params, 0, sizeof(params));
+	ringFd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (ringFd >= 0)
+	{
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			if (cqRingSize > sqRingSize)
+			{
+				sqRingSize = cqRingSize;
+			}
+			cqRingSize = sqRingSize;
+		}
+
+		sqPtr = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		cqPtr = sqPtr;
+		if (sqPtr != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+		{
+			cqPtr = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		}
+		sqes = (struct io_uring_sqe *)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+		if (sqPtr != MAP_FAILED && cqPtr != MAP_FAILED && sqes != MAP_FAILED)
+		{
+			sqHead = (unsigned *)((char *)sqPtr + params.sq_off.head);
+			sqTail = (unsigned *)((char *)sqPtr + params.sq_off.tail);
+			sqRingMask = (unsigned *)((char *)sqPtr + params.sq_off.ring_mask);
+			sqArray = (unsigned *)((char *)sqPtr + params.sq_off.array);
+			sqEntries = params.sq_entries;
+			cqHead = (unsigned *)((char *)cqPtr + params.cq_off.head);
+			cqTail = (unsigned *)((char *)cqPtr + params.cq_off.tail);
+			cqRingMask = (unsigned *)((char *)cqPtr + params.cq_off.ring_mask);
+			cqes = (struct io_uring_cqe *)((char *)cqPtr + params.cq_off.cqes);
+			sqLocalTail = *sqTail;
+			toSubmit = 0;
+			ans = 1;
+		}
+		else
+		{
+			int err = errno;
+			close(ringFd);
+			ringFd = -1;
+			errno = err;
+		}
+	}
+
+	return ans;
+}
+
+static struct io_uring_sqe *GetSqe(void)
+{
+	struct io_uring_sqe *ans;
+
+	if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+	{
+		/* submission queue is full, hand what is there to the kernel without waiting */
+		Enter(0);
+	}
+
+	ans = &sqes[sqLocalTail & *sqRingMask];
+	memset(ans, 0, sizeof(struct io_uring_sqe));
+	sqArray[sqLocalTail & *sqRingMask] = sqLocalTail & *sqRingMask;
+	sqLocalTail++;
+	__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+	toSubmit++;
+
+	return ans;
+}
+
+static int Enter(unsigned minComplete)
+{
+	int ans = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if (ans >= 0)
+	{
+		toSubmit -= (unsigned)ans <= toSubmit ? (unsigned)ans : toSubmit;
+	}
+
+	return ans;
+}
+
+static int AllocateBufferGroup(void)
+{
+	/* lowest group id not used by any receiver, including those waiting for their receive to be cancelled */
+	int ans = 0;
+	int inUse;
+	uring_receiver_ptr receiver;
+
+	do
+	{
+		inUse = 0;
+		for (receiver = receivers; receiver != NULL; receiver = receiver->next)
+		{
+			if (receiver->bufferGroup == ans)
+			{
+				inUse = 1;
+				ans++;
+				break;
+			}
+		}
+	} while (inUse);
+
+	return ans;
+}
+
+static void ProvideBuffer(uring_receiver_ptr receiver, int id)
+{
+	struct io_uring_buf *buf = &receiver->bufferRing->bufs[receiver->ringTail & (receiver->bufferCount - 1)];
+
+	buf->addr = (__u64)(unsigned long)(receiver->buffers + id * receiver->bufferSize);
+	buf->len = receiver->bufferSize;
+	buf->bid = (__u16)id;
+	receiver->ringTail++;
+	__atomic_store_n(&receiver->bufferRing->tail, receiver->ringTail, __ATOMIC_RELEASE);
+}
+
+static void ArmReceive(uring_receiver_ptr receiver)
+{
+	struct io_uring_sqe *sqe = GetSqe();
+
+	sqe->opcode = receiver->stream ? IORING_OP_RECV : IORING_OP_RECVMSG;
+	sqe->fd = receiver->fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = (__u16)receiver->bufferGroup;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	if (!receiver->stream)
+	{
+		sqe->addr = (__u64)(unsigned long)&receiver->msg;
+		sqe->len = 1;
+	}
+	sqe->user_data = (__u64)(unsigned long)receiver | TAG_RECEIVE;
+	receiver->armed = 1;
+}
+
+static int HasDataWaiting(uring_receiver_ptr receiver)
+{
+	return receiver->pendingCount > 0 || (receiver->stream && receiver->finished && !receiver->finishReported);
+}
+
+static void TakePending(uring_receiver_ptr receiver)
+{
+	receiver->pendingHead = (receiver->pendingHead + 1) & (receiver->bufferCount - 1);
+	receiver->pendingCount--;
+}
+
+static void ReleaseHeldBuffer(uring_receiver_ptr receiver)
+{
+	if (receiver->held >= 0)
+	{
+		ProvideBuffer(receiver, receiver->held);
+		receiver->held = -1;
+	}
+}
+
+static void CompleteReceive(uring_receiver_ptr receiver, struct io_uring_cqe *cqe)
+{
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+	{
+		receiver->armed = 0;
+	}
+
+	if (receiver->closing)
+	{
+		if (!receiver->armed)
+		{
+			FreeReceiver(receiver);
+		}
+	}
+	else
+	{
+		if (cqe->flags & IORING_CQE_F_BUFFER)
+		{
+			int id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			if (cqe->res > 0)
+			{
+				int slot = (receiver->pendingHead + receiver->pendingCount) & (receiver->bufferCount - 1);
+				receiver->pendingId[slot] = id;
+				receiver->pendingLength[slot] = cqe->res;
+				receiver->pendingCount++;
+			}
+			else
+			{
+				ProvideBuffer(receiver, id);
+			}
+		}
+
+		if (cqe->res == 0 && receiver->stream)
+		{
+			receiver->finished = 1;
+			receiver->finishError = 0;
+		}
+		else if (cqe->res < 0 && cqe->res != -ENOBUFS)
+		{
+			/* running out of buffers only pauses the receive, anything else stops it for good */
+			Log(LogSock, LogError, "io_uring receive on handle %d failed: %d\n", receiver->fd, -cqe->res);
+			receiver->finished = 1;
+			receiver->finishError = -cqe->res;
+		}
+	}
+}
+
+static void FreeReceiver(uring_receiver_ptr receiver)
+{
+	uring_receiver_ptr *link = &receivers;
+	struct io_uring_buf_reg reg;
+
+	while (*link != NULL && *link != receiver)
+	{
+		link = &(*link)->next;
+	}
+
+	if (*link != NULL)
+	{
+		*link = receiver->next;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.bgid = (__u16)receiver->bufferGroup;
+	syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+	munmap(receiver->bufferRing, receiver->bufferRingSize);
+	free(receiver->buffers);
+	free(receiver->pendingId);
+	free(receiver->pendingLength);
+	free(receiver);
+}
+
+static void CompleteSend(uring_send_ptr send, struct io_uring_cqe *cqe)
+{
+	if (cqe->res < 0)
+	{
+		Log(LogSock, LogError, "io_uring send failed: %d\n", -cqe->res);
+	}
+
+	send->next = freeSends;
+	freeSends = send;
+}
+
+#endif
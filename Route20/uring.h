@@ -0,0 +1,58 @@
+/* uring.h: io_uring event notification for Linux
+  ------------------------------------------------------------------------------
+
+   Copyright (c) 2012, Robert M. A. Jarratt
+
+   Permission is hereby granted, free of charge, to any person obtaining a
+   copy of this software and associated documentation files (the "Software"),
+   to deal in the Software without restriction, including without limitation
+   the rights to use, copy, modify, merge, publish, distribute, sublicense,
+   and/or sell copies of the Software, and to permit persons to whom the
+   Software is furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+   THE AUTHOR BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+   IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   Except as contained in this notice, the name of the author shall not be
+   used in advertising or otherwise to promote the sale, use or other dealings
+   in this Software without prior written authorization from the author.
+
+  ------------------------------------------------------------------------------*/
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#if !defined(URING_H)
+
+typedef struct
+{
+	void *userData;
+	int   result;   /* poll mask, or negative errno */
+	int   received; /* data is waiting on a ring receiver, rather than a poll request having completed */
+	int   writable; /* a poll request for write readiness completed */
+} uring_event_t;
+
+typedef struct uring_receiver *uring_receiver_ptr;
+
+int  UringIsActive(void);
+void UringAddPoll(int fd, void *userData, int write);
+void UringRemovePoll(void *userData, int write);
+int  UringWait(int timeoutMs, uring_event_t *events, int maxEvents);
+uring_receiver_ptr UringStartReceive(int fd, int stream, int bufferSize, int bufferCount);
+void UringStopReceive(uring_receiver_ptr receiver);
+int  UringAttachReceiver(int fd, void *userData);
+void UringDetachReceiver(void *userData);
+int  UringNextDatagram(uring_receiver_ptr receiver, unsigned char **data, struct sockaddr *from);
+int  UringReadStream(uring_receiver_ptr receiver, unsigned char *buffer, int bufferLength);
+int  UringSendTo(int fd, unsigned char *data, int length, struct sockaddr *destination, int destinationLength);
+
+#define URING_H
+#endif
@@ -466,7 +466,7 @@ static int ElnConfig(char *fileName, ConfigReadMode mode)
     nodeInfo.level = 2;
     nodeInfo.priority = 65;
     strcpy(nodeInfo.name, "A5RTR2");
-    CircuitCreateEthernetPcap(&Circuits[1 + numCircuits++],"eth0", 3, ProcessCircuitEvent);
+    CircuitCreateEthernetPcap(&Circuits[1 + numCircuits++],"eth0", NULL, 3, ProcessCircuitEvent);
     CircuitCreateEthernetSocket(&Circuits[1 + numCircuits++], "130.238.19.25", 4711, 4711, 5, ProcessCircuitEvent);
     Log(LogGeneral, LogDetail, "Finished hard coded configuration.\n");
 
@@ -494,7 +494,7 @@ void ProcessEvents(circuit_t circuits[], int numCircuits, void (*process)(circui
 
     while (1)
     {
-        /* TODO: make timeout be seconds due */
+        /* TODO: make timeout be milliseconds due */
 
         if (eventHandlersChanged)
         {
@@ -506,6 +506,7 @@ void ProcessEvents(circuit_t circuits[], int numCircuits, void (*process)(circui
         /*Log(LogGeneral, LogInfo, "Queue lengths: Port Free %d. Sock Free %d. Process %d\n", FreePortBufferQueue.length, FreeSockBufferQueue.length, ProcessBufferQueue.length);*/
         Log(LogGeneral, LogVerbose, "Waiting for a buffer\n");
         BufferQueueEntry_t *buffer = DequeueWithWait(&ProcessBufferQueue, &timeout);
+        ClockUpdate();
         ProcessTimers();
         Log(LogGeneral, LogVerbose, "Finished processing timers\n");
         if (buffer != NULL)
@@ -596,6 +597,7 @@ static void ProcessEventsSock()
     unsigned long emask = 0;
     int nfds;
     unsigned long sockHandleMask;
+    unsigned long sockWriteMask;
 
     while (1)
     {
@@ -612,6 +614,7 @@ static void ProcessEventsSock()
             numHandles = 0;
             nfds = 0;
             sockHandleMask = 0;
+            sockWriteMask = 0;
 
             for (i = 0; i < numEventHandlers; i++)
             {
@@ -619,6 +622,11 @@ static void ProcessEventsSock()
                 {
                     memcpy(&handlers[numHandles++], &eventHandlers[i], sizeof(event_handler_t));
                     sockHandleMask = sockHandleMask | (1 << (eventHandlers[i].waitHandle));
+                    if (eventHandlers[i].writeHandler != NULL)
+                    {
+                        sockWriteMask = sockWriteMask | (1 << (eventHandlers[i].waitHandle));
+                    }
+
                     if (eventHandlers[i].waitHandle > nfds)
                     {
                         nfds = eventHandlers[i].waitHandle;
@@ -632,6 +640,7 @@ static void ProcessEventsSock()
         if (numHandles > 0)
         {
             unsigned long handles = sockHandleMask;
+            wmask = sockWriteMask;
             Log(LogGeneral, LogVerbose, "Waiting for sockets\n");
 
             i = select(nfds + 1, &handles, &wmask, &emask, NULL);
@@ -645,6 +654,12 @@ static void ProcessEventsSock()
                 {
                     for (h = 0; h < numHandles; h++)
                     {
+                        if ((wmask & (1 << (handlers[h].waitHandle))) && handlers[h].writeHandler != NULL)
+                        {
+                            Log(LogGeneral, LogDetail, "Calling write handler for %s\n", handlers[h].name);
+                            handlers[h].writeHandler(handlers[h].writeContext);
+                        }
+
                         if (handles & (1 << (handlers[h].waitHandle)))
                         {
                             Log(LogGeneral, LogDetail, "Queueing event handler for %s\n", handlers[h].name);
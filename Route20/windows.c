@@ -315,9 +315,10 @@ void ProcessEvents(circuit_t circuits[], int numCircuits, void (*process)(circui
 			eventHandlersChanged = 0;
 		}
 
-		timeout = SecondsUntilNextDue();
-		Log(LogGeneral, LogVerbose, "Waiting for %d events, timeout is %d\n", numEventHandlers, timeout);
-		i = WaitForMultipleObjects(numEventHandlers, handles, 0, timeout * 1000);
+		timeout = MillisecondsUntilNextDue();
+		Log(LogGeneral, LogVerbose, "Waiting for %d events, timeout is %d ms\n", numEventHandlers, timeout);
+		i = WaitForMultipleObjects(numEventHandlers, handles, 0, timeout);
+		ClockUpdate();
 		if (i == -1)
 		{
 			DWORD err = GetLastError();
@@ -337,6 +338,12 @@ void ProcessEvents(circuit_t circuits[], int numCircuits, void (*process)(circui
 				i = i - WAIT_OBJECT_0;
 				ResetEvent((HANDLE)eventHandlers[i].waitHandle);
                 Log(LogGeneral, LogDetail, "Processing event handler for %s\n", eventHandlers[i].name);
+				if (eventHandlers[i].writeHandler != NULL)
+				{
+					/* FD_WRITE signals the same event as FD_READ, so the write handler gets a try whenever the event is signalled */
+					eventHandlers[i].writeHandler(eventHandlers[i].writeContext);
+				}
+
 				eventHandlers[i].eventHandler(eventHandlers[i].context);
 			}
 		}